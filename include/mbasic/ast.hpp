@@ -155,6 +155,8 @@ struct GetStmt;
 struct PutStmt;
 struct LsetStmt;
 struct RsetStmt;
+struct LockStmt;
+struct UnlockStmt;
 struct WriteStmt;
 struct ChainStmt;
 struct CommonStmt;
@@ -215,6 +217,8 @@ using Stmt = std::variant<
     std::unique_ptr<PutStmt>,
     std::unique_ptr<LsetStmt>,
     std::unique_ptr<RsetStmt>,
+    std::unique_ptr<LockStmt>,
+    std::unique_ptr<UnlockStmt>,
     std::unique_ptr<WriteStmt>,
     std::unique_ptr<ChainStmt>,
     std::unique_ptr<CommonStmt>,
@@ -405,6 +409,7 @@ struct TroffStmt : StmtInfo {};
 struct WidthStmt : StmtInfo {
     Expr width;
     std::optional<Expr> file_number;
+    bool printer = false;   // WIDTH LPRINT
 };
 
 struct PokeStmt : StmtInfo {
@@ -435,6 +440,7 @@ struct OpenStmt : StmtInfo {
     FileMode mode = FileMode::INPUT;
     Expr file_number;
     std::optional<Expr> record_length;
+    bool shared = false;    // SHARED: other processes update the file too
 };
 
 struct CloseStmt : StmtInfo {
@@ -470,6 +476,19 @@ struct RsetStmt : StmtInfo {
     Expr value;
 };
 
+// LOCK/UNLOCK #n [, [first] [TO last]]; no records means the whole file
+struct LockStmt : StmtInfo {
+    Expr file_number;
+    std::optional<Expr> first_record;
+    std::optional<Expr> last_record;
+};
+
+struct UnlockStmt : StmtInfo {
+    Expr file_number;
+    std::optional<Expr> first_record;
+    std::optional<Expr> last_record;
+};
+
 struct WriteStmt : StmtInfo {
     std::optional<Expr> file_number;
     std::vector<Expr> expressions;
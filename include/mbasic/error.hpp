@@ -64,6 +64,7 @@ namespace ErrorCode {
     constexpr int RESUME_WITHOUT_ERROR = 20;
     constexpr int MISSING_OPERAND = 22;
     constexpr int LINE_BUFFER_OVERFLOW = 23;
+    constexpr int DEVICE_FAULT = 25;
     constexpr int FOR_WITHOUT_NEXT = 26;
     constexpr int WHILE_WITHOUT_WEND = 29;
     constexpr int WEND_WITHOUT_WHILE = 30;
@@ -82,6 +83,7 @@ namespace ErrorCode {
     constexpr int INTERNAL_ERROR = 51;
     constexpr int DISK_IO_ERROR = 57;
     constexpr int FILE_ALREADY_EXISTS = 58;
+    constexpr int PERMISSION_DENIED = 70;
 }
 
 // Get error message for error code
@@ -109,6 +111,7 @@ inline std::string error_message(int code) {
         case ErrorCode::RESUME_WITHOUT_ERROR: return "RESUME without error";
         case ErrorCode::MISSING_OPERAND: return "Missing operand";
         case ErrorCode::LINE_BUFFER_OVERFLOW: return "Line buffer overflow";
+        case ErrorCode::DEVICE_FAULT: return "Device fault";
         case ErrorCode::FOR_WITHOUT_NEXT: return "FOR without NEXT";
         case ErrorCode::WHILE_WITHOUT_WEND: return "WHILE without WEND";
         case ErrorCode::WEND_WITHOUT_WHILE: return "WEND without WHILE";
@@ -126,8 +129,13 @@ inline std::string error_message(int code) {
         case ErrorCode::INTERNAL_ERROR: return "Internal error";
         case ErrorCode::DISK_IO_ERROR: return "Disk I/O error";
         case ErrorCode::FILE_ALREADY_EXISTS: return "File already exists";
+        case ErrorCode::PERMISSION_DENIED: return "Permission denied";
         default: return "Unknown error";
     }
 }
 
+// Text of a system errno value; unlike std::strerror, safe to call from
+// several threads at once
+std::string system_error_text(int err);
+
 } // namespace mbasic
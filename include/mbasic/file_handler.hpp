@@ -7,11 +7,98 @@
 // different platforms (native filesystem, WebAssembly virtual FS, etc.)
 
 #include <string>
+#include <string_view>
 #include <memory>
+#include <atomic>
 #include <cstdint>
 
 namespace mbasic {
 
+// ============================================================================
+// FileStats - I/O counters shared by the files of a FileSystem
+// ============================================================================
+// Atomic because read-ahead threads update them too.
+
+struct FileStats {
+    std::atomic<uint64_t> read_calls{0};        // read(2)/pread(2) calls
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> write_calls{0};       // pwrite(2)/pwritev(2) calls
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> sync_calls{0};        // fdatasync(2)/msync(2) calls
+    std::atomic<uint64_t> read_ahead_hits{0};   // Next buffer was ready
+    std::atomic<uint64_t> read_ahead_waits{0};  // Had to wait for it
+    std::atomic<uint64_t> record_cache_hits{0};
+    std::atomic<uint64_t> record_cache_misses{0};
+    std::atomic<uint64_t> descriptor_reopens{0};  // Evicted files opened again
+};
+
+// ============================================================================
+// FileOptions - Buffering and durability settings for native files
+// ============================================================================
+
+struct FileOptions {
+    // Flush sequential output after every PRINT#/WRITE# statement instead of
+    // buffering it (for crash-sensitive jobs; costs one write(2) per line)
+    bool sync_writes = false;
+
+    // Flush buffered output once it has been pending this long, checked on
+    // each write to the file and between statements, and before the program
+    // waits for input (0 = only on CLOSE, END or a full buffer)
+    int flush_interval_ms = 0;
+
+    // How hard to push written data to stable storage:
+    //   NONE    - leave it to the OS once written
+    //   CLOSE   - fdatasync when a written file is closed
+    //   RECORDS - also fdatasync after every sync_every_records PUTs
+    enum class Durability { NONE, CLOSE, RECORDS };
+    Durability durability = Durability::NONE;
+    int sync_every_records = 0;
+
+    // Serve RANDOM files from a memory mapping (MappedFileHandle)
+    bool mmap_random = false;
+
+    // Keep this many recently used records of each RANDOM file in memory
+    // (0 = no record cache). PUTs update the cache and are written through
+    // to the file, or with record_cache_write_back only when evicted,
+    // flushed or closed.
+    int record_cache_records = 0;
+    bool record_cache_write_back = false;
+
+    // Read sequential INPUT files ahead on a background thread, filling
+    // the next buffer while the program works through the current one.
+    // Can be set per file through NativeFileHandle::open_file.
+    bool read_ahead = false;
+
+    // Open sequential files named *.gz (and *.zst when built with zstd)
+    // through CompressedFileHandle, compressing and decompressing on the
+    // fly. compression_level 0 means the codec's default.
+    bool compressed_files = true;
+    int compression_level = 0;
+
+    // Keep no file data in the process between statements: PUT writes
+    // straight through and GET always reads the file, so other processes
+    // updating the same file are seen at once. Set per file by
+    // OPEN ... SHARED.
+    bool shared = false;
+
+    // Most descriptors the buffered files of a NativeFileSystem hold open
+    // at once (0 = the RLIMIT_NOFILE soft limit less a reserve). Past it,
+    // the least recently used regular file gives up its descriptor and
+    // reopens it on its next access, so a program may keep more files open
+    // than the OS allows.
+    int max_descriptors = 0;
+
+    // Where to count I/O (nullptr = don't count)
+    std::shared_ptr<FileStats> stats;
+};
+
+// Descriptor budget shared by the NativeFileHandles of a NativeFileSystem
+// (see FileOptions::max_descriptors); defined in file_handler.cpp
+class DescriptorPool;
+
+// Block size LOC counts in for sequential files (a CP/M sector)
+inline constexpr int64_t LOC_BLOCK_SIZE = 128;
+
 // ============================================================================
 // FileHandle - Abstract interface for file operations
 // ============================================================================
@@ -29,8 +116,8 @@ public:
     virtual void close() = 0;
 
     // Read a line (for sequential files)
-    // Returns false on EOF or error
-    virtual bool read_line(std::string& line) = 0;
+    // Returns false on EOF or error. The default reads through peek().
+    virtual bool read_line(std::string& line);
 
     // Write a line (for sequential files)
     virtual void write_line(const std::string& line) = 0;
@@ -38,38 +125,110 @@ public:
     // Write string without newline
     virtual void write(const std::string& data) = 0;
 
-    // Read n characters
-    virtual std::string read_chars(int n) = 0;
+    // Read up to n characters (fewer at end of file); the default reads
+    // through peek()
+    virtual std::string read_chars(int n);
 
-    // Check for end of file
+    // Check for end of file (EOF function). Called once per loop iteration
+    // by typical programs, so it should not need a system call.
     virtual bool eof() const = 0;
 
-    // Get current position (LOC function)
+    // Get current position (LOC function): for random files the number of
+    // the last record read or written, for sequential files the number of
+    // 128-byte blocks read or written
     virtual int64_t position() const = 0;
 
     // Get file length (LOF function)
     virtual int64_t length() const = 0;
 
-    // For random access files:
+    // Record length given to OPEN
+    virtual int record_length() const = 0;
 
-    // Seek to record number (1-based)
-    virtual void seek_record(int record, int record_length) = 0;
+    // For random access files (the defaults, for handles that only stream,
+    // report "Bad file mode"):
+
+    // Seek to record number (1-based); offsets are 64-bit, so files may
+    // be larger than 2 GB
+    virtual void seek_record(int64_t record, int record_length);
 
     // Read raw bytes into buffer
-    virtual void read_raw(char* buffer, int size) = 0;
+    // Returns the number of bytes actually read (short at end of file)
+    virtual int read_raw(char* buffer, int size);
 
     // Write raw bytes from buffer
-    virtual void write_raw(const char* buffer, int size) = 0;
+    virtual void write_raw(const char* buffer, int size);
 
     // Flush output
     virtual void flush() = 0;
+
+    // Flush buffered output that has waited FileOptions::flush_interval_ms,
+    // or any of it when waiting is set (the program stopped for input).
+    // Called between statements, so output reaches the file while the
+    // program leaves it alone. Files without a flush interval ignore it.
+    virtual void flush_due([[maybe_unused]] bool waiting) {}
+
+    // Read a whole record (GET); returns bytes read like read_raw.
+    // Implementations may serve it from a record cache.
+    virtual int read_record(int64_t record, char* buffer, int size) {
+        seek_record(record, size);
+        return read_raw(buffer, size);
+    }
+
+    // Write a whole record (PUT). Implementations may defer the write
+    // until flush() or close().
+    virtual void write_record(int64_t record, const char* buffer, int size) {
+        seek_record(record, size);
+        write_raw(buffer, size);
+    }
+
+    // Zero-copy input (INPUT#): the unread bytes currently buffered,
+    // refilling first if none are; empty only at end of file. The view is
+    // valid until the next call on the handle other than consume().
+    virtual std::string_view peek() = 0;
+
+    // Mark the first n bytes returned by peek() as read
+    virtual void consume(size_t n) = 0;
+
+    // LOCK: lock records first..last (1-based) against other processes
+    // and other handles on the file, or the whole file when first is 0.
+    // Returns false if a conflicting lock is held elsewhere. Cached file
+    // data is dropped, so what is read under the lock is current.
+    // Handles nobody else can reach have nothing to lock.
+    virtual bool lock_records([[maybe_unused]] int64_t first, [[maybe_unused]] int64_t last) {
+        return true;
+    }
+
+    // UNLOCK: write out pending data, then release the records
+    virtual void unlock_records([[maybe_unused]] int64_t first, [[maybe_unused]] int64_t last) {
+        flush();
+    }
+
+protected:
+    // An operation the file's mode doesn't allow
+    [[noreturn]] static void throw_bad_mode();
 };
 
+// Write all of data to fd, retrying short writes and EINTR, counting the
+// calls in stats if given (for the handles that stream to a descriptor)
+void write_all(int fd, const char* data, size_t size, FileStats* stats);
+
+// Read one INPUT# item using MBASIC's rules: leading spaces and line ends
+// are skipped (so items may continue onto the next line); a string item
+// starting with a quote runs to the closing quote, anything up to the next
+// comma or line end being ignored; an unquoted string ends at a comma or
+// line end (or after 255 characters) with trailing spaces dropped; a number
+// also ends at a space. End of file ends an item.
+// @param item: set to the item text, viewing the handle's buffer or scratch,
+//              valid until the handle is used again
+// @return: false if end of file was reached before any item
+bool read_input_item(FileHandle& file, bool string_item, std::string& scratch,
+                     std::string_view& item);
+
 // ============================================================================
 // FileSystem - Abstract factory for file operations
 // ============================================================================
 // Implement this interface to provide custom file system access.
-// Default implementation uses std::fstream for native file system.
+// Default implementation uses POSIX file descriptors for native file system.
 
 class FileSystem {
 public:
@@ -87,11 +246,13 @@ public:
     // @param filename: The file path
     // @param mode: Open mode
     // @param record_length: Record length for random access (default 128)
+    // @param shared: OPEN ... SHARED, other processes use the file too
     // @return: A FileHandle, or nullptr on failure
     virtual std::unique_ptr<FileHandle> open(
         const std::string& filename,
         Mode mode,
-        int record_length = 128) = 0;
+        int record_length = 128,
+        bool shared = false) = 0;
 
     // Check if a file exists
     virtual bool exists(const std::string& filename) = 0;
@@ -103,21 +264,33 @@ public:
     virtual bool rename(const std::string& old_name, const std::string& new_name) = 0;
 
     // Get the default/native file system implementation
-    static std::unique_ptr<FileSystem> create_native();
+    static std::unique_ptr<FileSystem> create_native(const FileOptions& options = {});
 };
 
 // ============================================================================
-// NativeFileHandle - std::fstream-based implementation
+// NativeFileHandle - file descriptor based implementation
 // ============================================================================
-// Default implementation for native filesystem I/O
+// Default implementation for native filesystem I/O. All reads and writes go
+// through a large user-space buffer, so sequential INPUT#/PRINT# and
+// neighbouring GET/PUT records cost one syscall per buffer, not per statement.
+// PUT records collect in a dirty-record cache and are written in offset
+// order, one pwritev(2) per run of contiguous records.
+// Errors are reported by throwing RuntimeError (Disk I/O error / Disk full).
+// Opened with a DescriptorPool, a regular file may lose its descriptor
+// between calls and reopen it on demand; every access is at an explicit
+// offset, so nothing but the descriptor has to be restored. Files holding
+// LOCKed records, and files that aren't regular, keep their descriptors.
 
 class NativeFileHandle : public FileHandle {
 public:
     NativeFileHandle();
     ~NativeFileHandle() override;
 
-    // Open file with specified mode
-    bool open_file(const std::string& filename, FileSystem::Mode mode, int record_length);
+    // Open file with specified mode; with a pool, the descriptor counts
+    // against its budget and may be closed while the file is idle
+    bool open_file(const std::string& filename, FileSystem::Mode mode, int record_length,
+                   const FileOptions& options = {},
+                   std::shared_ptr<DescriptorPool> pool = nullptr);
 
     // FileHandle interface
     bool is_open() const override;
@@ -129,10 +302,18 @@ public:
     bool eof() const override;
     int64_t position() const override;
     int64_t length() const override;
-    void seek_record(int record, int record_length) override;
-    void read_raw(char* buffer, int size) override;
+    int record_length() const override;
+    void seek_record(int64_t record, int record_length) override;
+    int read_raw(char* buffer, int size) override;
     void write_raw(const char* buffer, int size) override;
     void flush() override;
+    void flush_due(bool waiting) override;
+    int read_record(int64_t record, char* buffer, int size) override;
+    void write_record(int64_t record, const char* buffer, int size) override;
+    std::string_view peek() override;
+    void consume(size_t n) override;
+    bool lock_records(int64_t first, int64_t last) override;
+    void unlock_records(int64_t first, int64_t last) override;
 
 private:
     struct Impl;
@@ -140,19 +321,208 @@ private:
 };
 
 // ============================================================================
-// NativeFileSystem - std::fstream-based implementation
+// MappedFileHandle - mmap based random access files
 // ============================================================================
+// Used by NativeFileSystem for RANDOM files when FileOptions::mmap_random is
+// set. GET copies straight out of the mapping and PUT writes into it, so
+// record access costs no syscalls. While open, the file and the mapping grow
+// in chunks ahead of appended records; flush() and close() trim the file
+// back to its real length.
+
+class MappedFileHandle : public FileHandle {
+public:
+    MappedFileHandle();
+    ~MappedFileHandle() override;
+
+    // Open (creating if needed) a regular file for random access.
+    // Returns false if it can't be opened or mapped.
+    bool open_file(const std::string& filename, int record_length,
+                   const FileOptions& options = {});
+
+    // FileHandle interface
+    bool is_open() const override;
+    void close() override;
+    bool read_line(std::string& line) override;
+    void write_line(const std::string& line) override;
+    void write(const std::string& data) override;
+    std::string read_chars(int n) override;
+    bool eof() const override;
+    int64_t position() const override;
+    int64_t length() const override;
+    int record_length() const override;
+    void seek_record(int64_t record, int record_length) override;
+    int read_raw(char* buffer, int size) override;
+    void write_raw(const char* buffer, int size) override;
+    void flush() override;
+    int read_record(int64_t record, char* buffer, int size) override;
+    void write_record(int64_t record, const char* buffer, int size) override;
+    std::string_view peek() override;
+    void consume(size_t n) override;
+    bool lock_records(int64_t first, int64_t last) override;
+    void unlock_records(int64_t first, int64_t last) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// ============================================================================
+// CompressedFileHandle - gzip/zstd sequential files
+// ============================================================================
+// Used by NativeFileSystem for INPUT, OUTPUT and APPEND files whose names
+// end in a compressed extension (see compressed_extension). The codec runs
+// on a helper thread: input is decompressed a block ahead of the program,
+// and output blocks are compressed and written while the program fills the
+// next one. APPEND adds a new gzip member or zstd frame, which readers
+// treat as a continuation of the file. LOF reports the compressed size on
+// disk; LOC and EOF follow the uncompressed data. sync_writes and
+// flush_interval_ms don't apply: flush() ends a compressed block, which
+// costs compression ratio.
+
+class CompressedFileHandle : public FileHandle {
+public:
+    CompressedFileHandle();
+    ~CompressedFileHandle() override;
+
+    // True if filename has an extension this build can (de)compress
+    static bool compressed_extension(const std::string& filename);
+
+    // Open a sequential file; RANDOM is not supported
+    bool open_file(const std::string& filename, FileSystem::Mode mode, int record_length,
+                   const FileOptions& options = {});
+
+    // FileHandle interface (the record operations raise Bad file mode)
+    bool is_open() const override;
+    void close() override;
+    void write_line(const std::string& line) override;
+    void write(const std::string& data) override;
+    bool eof() const override;
+    int64_t position() const override;
+    int64_t length() const override;
+    int record_length() const override;
+    void flush() override;
+    std::string_view peek() override;
+    void consume(size_t n) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// ============================================================================
+// DeviceFileHandle - PIPE: devices
+// ============================================================================
+// Used by NativeFileSystem for file names starting PIPE: (in any case):
+//   PIPE:command   "/bin/sh -c command", read from (INPUT) or written to
+//                  (OUTPUT/APPEND); CLOSE waits for it to exit
+// so BASIC filters can sit in shell pipelines. Reads and writes go through
+// a 64 KB buffer; output to a terminal is written after every PRINT#/WRITE#.
+// EOF waits until the command sends more data or exits. LOF counts the
+// bytes that have gone through; the record operations raise Bad file mode.
+
+class DeviceFileHandle : public FileHandle {
+public:
+    DeviceFileHandle();
+    ~DeviceFileHandle() override;
+
+    // True if filename names a device
+    static bool device_name(const std::string& filename);
+
+    // Open a device. Raises Bad file mode for a mode the device doesn't
+    // support; returns false if it can't be opened or the command started.
+    bool open_device(const std::string& filename, FileSystem::Mode mode,
+                     const FileOptions& options = {});
+
+    // FileHandle interface
+    bool is_open() const override;
+    void close() override;
+    void write_line(const std::string& line) override;
+    void write(const std::string& data) override;
+    bool eof() const override;
+    int64_t position() const override;
+    int64_t length() const override;
+    int record_length() const override;
+    void flush() override;
+    std::string_view peek() override;
+    void consume(size_t n) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// ============================================================================
+// ConsoleFileHandle - STDIN: and STDOUT: devices
+// ============================================================================
+// The interpreter's console as a file, opened by OPEN for the names STDIN:
+// (INPUT) and STDOUT: (OUTPUT or APPEND) in any case, whatever the
+// FileSystem. PRINT# and WRITE# go to IOHandler::print, so they come out in
+// order with PRINT and move the console column; INPUT# reads through
+// IOHandler::input_block. A console without input (a SessionHost session's)
+// is at end of file. LOF counts the bytes that have gone through; the
+// record operations raise Bad file mode.
+
+class IOHandler;
+
+class ConsoleFileHandle : public FileHandle {
+public:
+    // True if filename names one of the console devices
+    static bool device_name(const std::string& filename);
+
+    // Open the device filename names on io. Raises Bad file mode for a mode
+    // the device doesn't support.
+    ConsoleFileHandle(const std::string& filename, FileSystem::Mode mode, IOHandler& io);
+    ~ConsoleFileHandle() override;
+
+    // FileHandle interface
+    bool is_open() const override;
+    void close() override;
+    void write_line(const std::string& line) override;
+    void write(const std::string& data) override;
+    bool eof() const override;
+    int64_t position() const override;
+    int64_t length() const override;
+    int record_length() const override;
+    void flush() override;
+    std::string_view peek() override;
+    void consume(size_t n) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// ============================================================================
+// NativeFileSystem - native filesystem backed by NativeFileHandle
+// ============================================================================
+// RANDOM files use MappedFileHandle instead when FileOptions::mmap_random is
+// set and the file can be mapped, unless it is opened SHARED. Compressed
+// sequential files use CompressedFileHandle when
+// FileOptions::compressed_files is set, and device names DeviceFileHandle.
+// The buffered files share one
+// DescriptorPool; its handles must then be used from one thread at a time,
+// since opening one file may close another's descriptor. KILL and NAME keep
+// the pool pointed at files that are open.
 
 class NativeFileSystem : public FileSystem {
 public:
+    explicit NativeFileSystem(const FileOptions& options = {});
+
+    const FileOptions& options() const { return options_; }
+
     std::unique_ptr<FileHandle> open(
         const std::string& filename,
         Mode mode,
-        int record_length = 128) override;
+        int record_length = 128,
+        bool shared = false) override;
 
     bool exists(const std::string& filename) override;
     bool remove(const std::string& filename) override;
     bool rename(const std::string& old_name, const std::string& new_name) override;
+
+private:
+    FileOptions options_;
+    std::shared_ptr<DescriptorPool> pool_;
 };
 
 } // namespace mbasic
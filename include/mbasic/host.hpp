@@ -0,0 +1,102 @@
+#pragma once
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Session Host - many BASIC programs in one process on a pool of threads
+
+#include "file_handler.hpp"
+#include "interpreter.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mbasic {
+
+// ============================================================================
+// SessionHost - runs sessions on a fixed pool of worker threads
+// ============================================================================
+// Each session is a program with its own Runtime and Interpreter. A worker
+// runs a session for a time slice of at most slice_statements statements
+// and then puts it at the back of its own queue, so a busy program can't
+// keep others waiting. A worker whose queue is empty takes sessions from
+// the back of the other workers' queues. A session waiting for input is
+// parked: it sits in no queue until provide_input() (or cancel()) makes it
+// runnable again.
+//
+// Console output is collected per session and handed to the session's
+// output callback at the end of each slice and before it waits for input.
+// Callbacks run on worker threads, one at a time per session; they must
+// not call back into the host for the same session. LPRINT output goes to
+// the session's console. CHAIN and RUN "file" end the session.
+
+struct HostOptions {
+    int workers = 0;                        // Worker threads (0 = one per CPU)
+    size_t slice_statements = 10000;        // Statements per time slice
+    // Shared by all sessions, which run on different threads, so it must
+    // allow that (MemoryFileSystem does, even for sessions opening the same
+    // file; a NativeFileSystem's descriptor pool does not). Each session
+    // gets its own native one if not set.
+    std::shared_ptr<FileSystem> filesystem;
+    int max_files = 15;                     // Runtime::max_files of each session
+};
+
+struct SessionResult {
+    StopReason reason = StopReason::END;    // BREAK if cancelled
+    std::optional<InterpreterState::ErrorInfo> error;   // Unhandled runtime error
+};
+
+// Counters since the host started
+struct HostStats {
+    uint64_t sessions_started = 0;
+    uint64_t sessions_finished = 0;
+    uint64_t slices = 0;                    // Time slices run
+    uint64_t steals = 0;                    // Sessions taken from another worker
+    uint64_t parks = 0;                     // Times a session waited for input
+};
+
+class SessionHost {
+public:
+    using SessionId = uint64_t;
+    using OutputCallback = std::function<void(SessionId, std::string_view)>;
+    using ExitCallback = std::function<void(SessionId, const SessionResult&)>;
+
+    explicit SessionHost(HostOptions options = {});
+    ~SessionHost();     // Cancels the sessions still running and waits for them
+
+    SessionHost(const SessionHost&) = delete;
+    SessionHost& operator=(const SessionHost&) = delete;
+
+    // Start a session running source; parse errors are thrown here.
+    // on_exit is called once, after the last output.
+    SessionId start(const std::string& source, OutputCallback on_output,
+                    ExitCallback on_exit = nullptr);
+
+    // Start a session running a program parsed once and shared by as many
+    // sessions as use it; a MERGE in one session doesn't affect the others
+    SessionId start(std::shared_ptr<const CompiledProgram> program, OutputCallback on_output,
+                    ExitCallback on_exit = nullptr);
+
+    // Queue a line for the session's next INPUT or LINE INPUT.
+    // Returns false if there is no such session (it may have finished).
+    bool provide_input(SessionId id, std::string line);
+
+    // End a session at its next statement, or while it waits for input
+    bool cancel(SessionId id);
+
+    // Wait until every session has finished
+    void wait_idle();
+
+    // Sessions started and not yet finished
+    size_t session_count() const;
+
+    HostStats stats() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace mbasic
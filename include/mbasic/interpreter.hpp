@@ -6,6 +6,7 @@
 #include <optional>
 #include <memory>
 #include "io_handler.hpp"
+#include "printer.hpp"
 #include "runtime.hpp"
 #include "ast.hpp"
 
@@ -16,10 +17,14 @@ namespace mbasic {
 // ============================================================================
 
 struct InterpreterState {
-    // Input handling
+    // Input handling. While tick() is stopped with StopReason::INPUT,
+    // input_prompt is the prompt already shown and pending_vars the
+    // variables the INPUT or LINE INPUT is waiting to fill; input_chars is
+    // how many characters INPUT$ still needs (0 when a line is wanted).
     std::optional<std::string> input_prompt;
     std::vector<std::string> pending_vars;  // Variables waiting for input
-    std::vector<std::string> input_buffer;  // Buffered input values
+    int input_chars = 0;
+    std::vector<std::string> input_buffer;  // Lines from provide_input, not yet read
     std::optional<int> input_file;          // Reading from file
 
     // Error info
@@ -58,25 +63,49 @@ struct InterpreterState {
 // ============================================================================
 // Interpreter
 // ============================================================================
+// Threads: the library keeps no global mutable state (RND has its engine in
+// the Runtime, times use localtime_r, parsing shares nothing), so any
+// number of interpreters can run on different threads at once. What one
+// interpreter uses - its Runtime, IOHandler, Printer and FileSystem - must
+// be used by one thread at a time unless the class says otherwise; a
+// CompiledProgram may be shared freely. ConsoleIO's default streams and the
+// STDIN:/STDOUT: devices are the process's own, and ENVIRON$ reads the
+// environment, which must not be changed while programs run.
 
 class Interpreter {
 public:
     Interpreter(Runtime& runtime, IOHandler* io = nullptr);
 
-    // Run entire program
+    // Run entire program, reading console input through the IOHandler
+    // whenever the program stops for it
     void run();
 
     // Execute one statement (tick)
     bool tick();  // Returns true if still running
 
+    // Console INPUT, LINE INPUT and INPUT$ never block: with no line from
+    // provide_input() queued, the statement shows its prompt and tick()
+    // returns false with runtime().pc.reason == StopReason::INPUT. The
+    // statement runs again once provide_input() is called. An event-driven
+    // host can so keep any number of interpreters waiting for input on one
+    // thread.
+
+    // Write out buffered console, printer and file output once the program
+    // has stopped; run() does this, hosts calling tick() call it themselves
+    void finish();
+
     // Control
     void pause() { state_.pause_requested = true; }
     void resume() { state_.pause_requested = false; }
     void stop();
 
-    // Input handling
+    // Queue a line of console input and resume a program stopped for
+    // input. INPUT$ takes characters from the lines without a line end;
+    // an empty line ends an INPUT$ with the characters it has.
     void provide_input(const std::string& input);
 
+    bool waiting_for_input() const { return runtime_.pc.reason == StopReason::INPUT; }
+
     // Accessors
     Runtime& runtime() { return runtime_; }
     const Runtime& runtime() const { return runtime_; }
@@ -89,66 +118,132 @@ private:
     IOHandler* io_;
     InterpreterState state_;
 
+    // LPRINT device when the runtime has no printer
+    std::unique_ptr<ConsolePrinter> console_printer_;
+
+    // Where LPRINT output goes
+    Printer& printer();
+
+    // Program version a MERGE replaced, kept until the statement that ran
+    // the MERGE is done with its own line
+    std::shared_ptr<const CompiledProgram> replaced_program_;
+
+    // Reused by INPUT# for items that span buffer refills
+    std::string input_scratch_;
+
+    // Results of the INPUT$, INKEY$ and RND calls the current statement has
+    // finished, so a statement run again after stopping for input gets them
+    // back instead of reading or drawing again, and the characters the
+    // INPUT$ it stopped in had taken
+    std::vector<Value> input_replay_;
+    size_t input_replay_pos_ = 0;
+    std::string input_partial_;
+
+    // The result to hand back for a call with side effects, if the
+    // statement made it before it stopped for input
+    const Value* replayed_call();
+
+    // Keep the result of a call with side effects for replayed_call()
+    const Value& record_call(Value result);
+
+    // Where the current statement stopped for input inside inline IFs, one
+    // entry per IF from the outermost in, so running it again skips the
+    // conditions and the inline statements already done
+    struct IfResume {
+        bool then_branch;
+        size_t index;           // Inline statement that stopped
+    };
+    std::vector<IfResume> input_resume_;
+    size_t input_resume_pos_ = 0;
+
+    // Next line of console input; stops for input if there is none
+    std::string take_input_line(const std::string& prompt);
+
+    // n characters of console input for INPUT$
+    std::string take_input_chars(int n);
+
+    // Forget input state once a statement is done with it
+    void end_input();
+
+    // PRINT, PRINT#, LPRINT and WRITE format straight into this buffer,
+    // which keeps its capacity from statement to statement
+    std::string print_buffer_;
+
+    // Column the PRINT being formatted has reached, for TAB (-1 if none),
+    // and where it goes, so POS or LPOS inside it can count it too
+    enum class PrintTarget { CONSOLE, PRINTER, FILE };
+    int print_column_ = -1;
+    PrintTarget print_target_ = PrintTarget::CONSOLE;
+
+    // Format a PRINT/LPRINT item list into print_buffer_, starting at column
+    void format_print_list(const std::vector<Expr>& expressions,
+                           const std::vector<char>& separators, int column,
+                           PrintTarget target);
+
     // Statement execution
-    void execute(Stmt& stmt);
-
-    void exec_print(PrintStmt& s);
-    void exec_print_using(PrintUsingStmt& s);
-    void exec_lprint(LprintStmt& s);
-    void exec_lprint_using(LprintUsingStmt& s);
-    void exec_input(InputStmt& s);
-    void exec_line_input(LineInputStmt& s);
-    void exec_let(LetStmt& s);
-    void exec_if(IfStmt& s);
-    void exec_for(ForStmt& s);
-    void exec_next(NextStmt& s);
-    void exec_while(WhileStmt& s);
-    void exec_wend(WendStmt& s);
-    void exec_goto(GotoStmt& s);
-    void exec_gosub(GosubStmt& s);
-    void exec_return(ReturnStmt& s);
-    void exec_on_goto(OnGotoStmt& s);
-    void exec_on_gosub(OnGosubStmt& s);
-    void exec_data(DataStmt& s);
-    void exec_read(ReadStmt& s);
-    void exec_restore(RestoreStmt& s);
-    void exec_dim(DimStmt& s);
-    void exec_def_fn(DefFnStmt& s);
-    void exec_def_type(DefTypeStmt& s);
-    void exec_end(EndStmt& s);
-    void exec_cls(ClsStmt& s);
-    void exec_stop(StopStmt& s);
-    void exec_rem(RemStmt& s);
-    void exec_swap(SwapStmt& s);
-    void exec_erase(EraseStmt& s);
-    void exec_clear(ClearStmt& s);
-    void exec_option_base(OptionBaseStmt& s);
-    void exec_randomize(RandomizeStmt& s);
-    void exec_tron(TronStmt& s);
-    void exec_troff(TroffStmt& s);
-    void exec_width(WidthStmt& s);
-    void exec_poke(PokeStmt& s);
-    void exec_error(ErrorStmt& s);
-    void exec_on_error(OnErrorStmt& s);
-    void exec_resume(ResumeStmt& s);
-    void exec_open(OpenStmt& s);
-    void exec_close(CloseStmt& s);
-    void exec_field(FieldStmt& s);
-    void exec_get(GetStmt& s);
-    void exec_put(PutStmt& s);
-    void exec_lset(LsetStmt& s);
-    void exec_rset(RsetStmt& s);
-    void exec_write(WriteStmt& s);
-    void exec_chain(ChainStmt& s);
-    void exec_common(CommonStmt& s);
-    void exec_mid_assign(MidAssignStmt& s);
-    void exec_call(CallStmt& s);
-    void exec_out(OutStmt& s);
-    void exec_wait(WaitStmt& s);
-    void exec_kill(KillStmt& s);
-    void exec_name(NameStmt& s);
-    void exec_merge(MergeStmt& s);
-    void exec_run(RunStmt& s);
+    void execute(const Stmt& stmt);
+
+    void exec_print(const PrintStmt& s);
+    void exec_print_using(const PrintUsingStmt& s);
+    void exec_lprint(const LprintStmt& s);
+    void exec_lprint_using(const LprintUsingStmt& s);
+    void exec_input(const InputStmt& s);
+    void exec_line_input(const LineInputStmt& s);
+    void exec_let(const LetStmt& s);
+    void exec_if(const IfStmt& s);
+    void exec_for(const ForStmt& s);
+    void exec_next(const NextStmt& s);
+    void exec_while(const WhileStmt& s);
+    void exec_wend(const WendStmt& s);
+    void exec_goto(const GotoStmt& s);
+    void exec_gosub(const GosubStmt& s);
+    void exec_return(const ReturnStmt& s);
+    void exec_on_goto(const OnGotoStmt& s);
+    void exec_on_gosub(const OnGosubStmt& s);
+    void exec_data(const DataStmt& s);
+    void exec_read(const ReadStmt& s);
+    void exec_restore(const RestoreStmt& s);
+    void exec_dim(const DimStmt& s);
+    void exec_def_fn(const DefFnStmt& s);
+    void exec_def_type(const DefTypeStmt& s);
+    void exec_end(const EndStmt& s);
+    void exec_cls(const ClsStmt& s);
+    void exec_stop(const StopStmt& s);
+    void exec_rem(const RemStmt& s);
+    void exec_swap(const SwapStmt& s);
+    void exec_erase(const EraseStmt& s);
+    void exec_clear(const ClearStmt& s);
+    void exec_option_base(const OptionBaseStmt& s);
+    void exec_randomize(const RandomizeStmt& s);
+    void exec_tron(const TronStmt& s);
+    void exec_troff(const TroffStmt& s);
+    void exec_width(const WidthStmt& s);
+    void exec_poke(const PokeStmt& s);
+    void exec_error(const ErrorStmt& s);
+    void exec_on_error(const OnErrorStmt& s);
+    void exec_resume(const ResumeStmt& s);
+    void exec_open(const OpenStmt& s);
+    void exec_close(const CloseStmt& s);
+    void exec_field(const FieldStmt& s);
+    void exec_get(const GetStmt& s);
+    void exec_put(const PutStmt& s);
+    void exec_lset(const LsetStmt& s);
+    void exec_rset(const RsetStmt& s);
+    void exec_lock(const LockStmt& s);
+    void exec_unlock(const UnlockStmt& s);
+    void lock_range(const std::optional<Expr>& first_expr, const std::optional<Expr>& last_expr,
+                    const FileHandle& file, int64_t& first, int64_t& last);
+    void exec_write(const WriteStmt& s);
+    void exec_chain(const ChainStmt& s);
+    void exec_common(const CommonStmt& s);
+    void exec_mid_assign(const MidAssignStmt& s);
+    void exec_call(const CallStmt& s);
+    void exec_out(const OutStmt& s);
+    void exec_wait(const WaitStmt& s);
+    void exec_kill(const KillStmt& s);
+    void exec_name(const NameStmt& s);
+    void exec_merge(const MergeStmt& s);
+    void exec_run(const RunStmt& s);
 
     // Expression evaluation
     Value eval(const Expr& expr);
@@ -217,6 +312,9 @@ private:
     void advance_pc();
     void jump_to(int line);
 
+    // Look up an open file by number, raising "Bad file number" if not open
+    FileHandle& get_file(int filenum);
+
     // Get value from lvalue
     Value get_lvalue(const std::variant<VariableExpr, ArrayAccessExpr>& lv);
     void set_lvalue(const std::variant<VariableExpr, ArrayAccessExpr>& lv, const Value& val);
@@ -7,10 +7,22 @@
 // platforms (console, WebAssembly, embedded systems, etc.)
 
 #include <string>
+#include <string_view>
 #include <optional>
+#include <memory>
+#include <cstddef>
+#include <iosfwd>
 
 namespace mbasic {
 
+// Width of the print zones that commas and tabs move to
+constexpr int PRINT_ZONE_WIDTH = 14;
+
+// Column reached by printing text starting at column: a newline returns to
+// column 0 and a tab moves to the next print zone. Only the text after the
+// last newline is looked at.
+int advance_column(int column, std::string_view text);
+
 // ============================================================================
 // IOHandler - Abstract interface for console I/O
 // ============================================================================
@@ -23,13 +35,32 @@ public:
 
     // Output text to the console
     // Should handle newlines and update internal column tracking
+    // May buffer the text until flush()
     virtual void print(const std::string& text) = 0;
 
+    // Write out buffered output. The interpreter calls it when a program
+    // stops and before reading the console other than through input().
+    virtual void flush() {}
+
     // Read a line of input from the user
     // @param prompt: Optional prompt to display before reading
     // @return: The input line (without trailing newline)
     virtual std::string input(const std::string& prompt) = 0;
 
+    // Read up to n characters for INPUT$, line ends included; an empty
+    // result means there is no more input. Interpreter::run() uses it.
+    virtual std::string input_chars([[maybe_unused]] int n) {
+        return input("");
+    }
+
+    // Read the next input for the STDIN: device: at least one byte, line
+    // ends included, or an empty result once there is no more input. max
+    // is the size the caller would like; an implementation that reads by
+    // lines may return more.
+    virtual std::string input_block(size_t max) {
+        return input_chars(static_cast<int>(max));
+    }
+
     // Non-blocking key check (for INKEY$ function)
     // @return: A character if one is available, nullopt otherwise
     virtual std::optional<char> inkey() = 0;
@@ -56,24 +87,56 @@ public:
 };
 
 // ============================================================================
-// ConsoleIO - Standard console implementation using std::cin/std::cout
+// ConsoleIO - Console implementation on std::cin/std::cout or given streams
 // ============================================================================
 // This is the default implementation for terminal/console applications.
-// For WebAssembly or other platforms, provide a custom IOHandler.
+// For WebAssembly or other platforms, provide a custom IOHandler. Every
+// ConsoleIO made with the default constructor shares the process's
+// std::cin and std::cout; interpreters on different threads need their
+// own streams (or IOHandlers).
+//
+// Output is buffered rather than flushed on every PRINT: it is written out
+// at each newline when stdout is a terminal, otherwise only as the stream
+// buffer fills. Either way it is flushed before input is read, by flush(),
+// and by a background timer once it has waited flush_interval ms, so the
+// progress of long-running jobs still shows.
 
 class ConsoleIO : public IOHandler {
 public:
+    // Default for set_flush_interval
+    static constexpr int DEFAULT_FLUSH_INTERVAL_MS = 200;
+
+    ConsoleIO();
+
+    // Read from in and write to out; terminal makes every finished line go
+    // out at once, as for a tty
+    ConsoleIO(std::istream& in, std::ostream& out, bool terminal = false);
+    ~ConsoleIO() override;
+
     void print(const std::string& text) override;
     std::string input(const std::string& prompt) override;
+    std::string input_chars(int n) override;
+    std::string input_block(size_t max) override;
     std::optional<char> inkey() override;
+    void flush() override;
     int get_column() const override { return column_; }
     void set_column(int col) override { column_ = col; }
     int get_width() const override { return width_; }
     void set_width(int w) override { width_ = w; }
 
+    // Longest output may stay buffered (0 = no timer)
+    void set_flush_interval(int ms);
+
 private:
+    struct Timer;
+
+    std::istream& in_;
+    std::ostream& out_;
     int column_ = 0;
     int width_ = 80;
+    bool tty_ = false;
+    int flush_interval_ms_ = DEFAULT_FLUSH_INTERVAL_MS;
+    std::unique_ptr<Timer> timer_;   // Started by the first buffered print
 };
 
 } // namespace mbasic
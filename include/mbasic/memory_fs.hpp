@@ -0,0 +1,69 @@
+#pragma once
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// In-memory FileSystem - a RAM disk for tests and scratch files
+
+#include "file_handler.hpp"
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mbasic {
+
+// ============================================================================
+// MemoryFileSystem - files kept in memory
+// ============================================================================
+// Supports every OPEN mode with the same FileHandle semantics as the native
+// file system. A file removed (KILL) or renamed (NAME) while open stays
+// readable and writable through its open handles, as on POSIX. The file
+// table and each file's bytes are locked, so runtimes on different threads
+// may share one MemoryFileSystem and even open the same file (each
+// statement's read or write is atomic, but nothing orders them further).
+// All handles on a file see the same bytes, so SHARED needs no special
+// handling, and LOCK always succeeds.
+
+// A file's bytes and the mutex every handle on it takes to use them
+struct MemoryFile;
+
+class MemoryFileSystem : public FileSystem {
+public:
+    MemoryFileSystem() = default;
+
+    std::unique_ptr<FileHandle> open(
+        const std::string& filename,
+        Mode mode,
+        int record_length = 128,
+        bool shared = false) override;
+
+    bool exists(const std::string& filename) override;
+    bool remove(const std::string& filename) override;
+    bool rename(const std::string& old_name, const std::string& new_name) override;
+
+    // Embedding API
+
+    // Create or replace a file
+    void put(const std::string& filename, const std::string& contents);
+
+    // Contents of a file, if it exists
+    std::optional<std::string> get(const std::string& filename) const;
+
+    // Names of all files, sorted
+    std::vector<std::string> list() const;
+
+    // Load the regular files of a directory (not recursive).
+    // Returns false if the directory can't be read.
+    bool seed_from(const std::string& directory);
+
+    // Write every file to a directory, which must exist.
+    // Returns false if any file can't be written.
+    bool dump_to(const std::string& directory) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<MemoryFile>> files_;
+};
+
+} // namespace mbasic
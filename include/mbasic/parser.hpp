@@ -89,6 +89,9 @@ private:
     Stmt parse_put();
     Stmt parse_lset();
     Stmt parse_rset();
+    Stmt parse_lock();
+    Stmt parse_unlock();
+    void parse_lock_range(std::optional<Expr>& first, std::optional<Expr>& last);
     Stmt parse_write();
     Stmt parse_chain();
     Stmt parse_common();
@@ -0,0 +1,108 @@
+#pragma once
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Printer Abstraction - where LPRINT and LPRINT USING output goes
+
+#include "io_handler.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mbasic {
+
+// ============================================================================
+// Printer - the line printer device
+// ============================================================================
+// Keeps the print head column for LPOS and breaks lines at the WIDTH LPRINT
+// width. Subclasses only deliver the text.
+
+class Printer {
+public:
+    // A width of 255 means lines are never broken (as in MBASIC)
+    static constexpr int UNLIMITED_WIDTH = 255;
+
+    virtual ~Printer() = default;
+
+    // Print text, starting a new line wherever it reaches the width
+    void print(std::string_view text);
+
+    // Deliver output still held back; throws RuntimeError if the device
+    // failed. The interpreter calls it when a program stops.
+    virtual void flush() {}
+
+    // Print head column (0-based), for LPOS and TAB in LPRINT
+    int get_column() const { return column_; }
+
+    int get_width() const { return width_; }
+    void set_width(int w) { width_ = w; }
+
+protected:
+    // Deliver text to the device
+    virtual void write(std::string_view text) = 0;
+
+private:
+    int column_ = 0;
+    int width_ = UNLIMITED_WIDTH;
+};
+
+// ============================================================================
+// ConsolePrinter - LPRINT to the console
+// ============================================================================
+// What the interpreter uses when no printer is configured. The console
+// keeps its own column; this one only counts printer output.
+
+class ConsolePrinter : public Printer {
+public:
+    explicit ConsolePrinter(IOHandler& io) : io_(io) {}
+
+    void flush() override { io_.flush(); }
+
+protected:
+    void write(std::string_view text) override { io_.print(std::string(text)); }
+
+private:
+    IOHandler& io_;
+};
+
+// ============================================================================
+// SpoolPrinter - LPRINT to a spool file or named pipe
+// ============================================================================
+// Output is appended to the file at path, created if needed, by a
+// background thread, so a slow printer or a pipe whose reader lags only
+// holds up the program once the ring buffer between them is full. The
+// program thread and the writer share the ring without locks; they only
+// take a mutex to sleep when it is empty or full.
+//
+// The file is opened when the first output arrives, so opening a named pipe
+// doesn't wait for its reader before the program needs it. A failed open or
+// write is reported as "Device fault" by the next print() or flush(), and the
+// output queued at the time is dropped; after that the device is reopened.
+// A SpoolPrinter must be used from one thread at a time.
+
+class SpoolPrinter : public Printer {
+public:
+    // Default ring buffer size
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    // buffer_size is rounded up to a power of two
+    explicit SpoolPrinter(std::string path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~SpoolPrinter() override;   // Writes out everything queued
+
+    SpoolPrinter(const SpoolPrinter&) = delete;
+    SpoolPrinter& operator=(const SpoolPrinter&) = delete;
+
+    // Wait until everything printed so far has been written
+    void flush() override;
+
+    const std::string& path() const;
+
+protected:
+    void write(std::string_view text) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace mbasic
@@ -4,6 +4,9 @@
 
 namespace mbasic {
 
+// Line editing uses the editline library's process-wide state (terminal,
+// history, hooks): call these from one thread at a time.
+
 // Initialize the readline subsystem (call once at startup)
 void readline_init();
 
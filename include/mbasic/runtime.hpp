@@ -5,15 +5,20 @@
 #include <vector>
 #include <stack>
 #include <optional>
-#include <fstream>
+#include <memory>
 #include <set>
 #include <functional>
+#include <random>
+#include <string_view>
 #include "value.hpp"
 #include "ast.hpp"
 #include "error.hpp"
+#include "file_handler.hpp"
 
 namespace mbasic {
 
+class Printer;
+
 // ============================================================================
 // Program Counter
 // ============================================================================
@@ -76,18 +81,25 @@ struct StackEntry {
 };
 
 // ============================================================================
-// Statement Table
+// Compiled Program
 // ============================================================================
-
-class StatementTable {
+// A parsed program ready to run: its statements by line, its DATA and its
+// DEF FN functions. It never changes once built, so any number of Runtimes
+// (on any threads) can run one copy at the same time; share it with
+// std::shared_ptr<const CompiledProgram>. MERGE builds a new version that
+// shares the unchanged lines with the old one, which stays valid for the
+// runtimes still using it.
+
+class CompiledProgram {
 public:
-    void build(Program& program);
+    // Take ownership of a parsed program
+    static std::shared_ptr<const CompiledProgram> compile(Program program);
 
-    // Merge lines from another program (MERGE command)
-    void merge(Program& program);
+    // A copy with lines added or replaced by another program (MERGE)
+    std::shared_ptr<const CompiledProgram> merge(Program program) const;
 
     // Get statement at PC
-    Stmt* get(const PC& pc);
+    const Stmt* get(const PC& pc) const;
 
     // Get first PC
     PC first() const;
@@ -101,27 +113,32 @@ public:
     // Check if PC is valid
     bool valid(const PC& pc) const;
 
-    // Get line text for error messages
-    const std::string& line_text(int line_num) const;
+    // Get line text for error messages (empty for missing lines)
+    std::string_view line_text(int line_num) const;
 
-    // Storage for merged statements (must persist for lifetime of table)
-    std::vector<std::unique_ptr<Line>> merged_lines_;
+    // DEFINT/DEFSNG/DEFDBL/DEFSTR types by first letter
+    const std::unordered_map<char, VarType>& def_types() const { return def_type_map_; }
 
-private:
-    // Map of (line, stmt) -> statement pointer
-    std::map<std::pair<int, int>, Stmt*> table_;
+    // All DATA values in line order
+    const std::vector<Value>& data() const { return data_values_; }
 
-    // Map of line number -> first statement offset
-    std::map<int, int> line_first_stmt_;
+    // Index of the first DATA value at or after a line (RESTORE n)
+    size_t data_index(int line_num) const;
 
-    // Ordered list of line numbers
-    std::vector<int> line_numbers_;
+    // A DEF FN function, or nullptr
+    const DefFnStmt* user_function(const std::string& name) const;
+
+private:
+    // Collect DATA and DEF FN from the lines
+    void index();
 
-    // Line text for error messages
-    std::unordered_map<int, std::string> line_text_;
+    // Lines by number; MERGE versions share the lines they don't replace
+    std::map<int, std::shared_ptr<const Line>> lines_;
 
-    // Empty string for missing lines
-    static const std::string empty_string_;
+    std::unordered_map<char, VarType> def_type_map_;
+    std::vector<Value> data_values_;
+    std::map<int, size_t> data_lines_;      // Line -> first data index
+    std::unordered_map<std::string, const DefFnStmt*> user_functions_;
 };
 
 // ============================================================================
@@ -133,7 +150,8 @@ public:
     Runtime();
 
     // Initialize from program
-    void load(Program& program);
+    void load(std::shared_ptr<const CompiledProgram> compiled);
+    void load(Program program);
 
     // Reset state (but keep program)
     void reset();
@@ -146,6 +164,11 @@ public:
     void set_variable(const std::string& name, const Value& value);
     bool has_variable(const std::string& name) const;
 
+    // Storage of a variable, created with its default value if needed.
+    // Stays valid until the variables are cleared by reset(), which also
+    // drops the FIELD bindings that hold on to it.
+    Value& variable_storage(const std::string& name);
+
     // ========== Array Access ==========
     Value get_array(const std::string& name, const std::vector<int>& indices);
     void set_array(const std::string& name, const std::vector<int>& indices, const Value& value);
@@ -156,19 +179,14 @@ public:
     // ========== Execution State ==========
     PC pc;                              // Current program counter
     std::optional<PC> next_pc;          // Jump target (set by GOTO/GOSUB)
-    StatementTable statements;          // Statement lookup
+    std::shared_ptr<const CompiledProgram> program;  // Never null (empty until load)
 
     // ========== Control Flow ==========
     std::vector<StackEntry> exec_stack; // GOSUB/WHILE stack
     std::unordered_map<std::string, ForLoopState> for_states;  // FOR loop states
 
     // ========== DATA/READ ==========
-    std::vector<Value> data_values;     // All DATA values
-    size_t data_ptr = 0;                // Current READ position
-    std::unordered_map<int, size_t> data_line_map;  // Line -> first data index
-
-    // Collect DATA from program
-    void collect_data(Program& program);
+    size_t data_ptr = 0;                // Current READ position in program->data()
 
     // Read next DATA value
     Value read_data();
@@ -176,20 +194,54 @@ public:
     // RESTORE to beginning or specific line
     void restore_data(std::optional<int> line = std::nullopt);
 
-    // ========== User Functions ==========
-    std::unordered_map<std::string, DefFnStmt*> user_functions;
-
     // ========== File I/O ==========
-    std::unordered_map<int, std::fstream> files;
+    std::shared_ptr<FileSystem> filesystem;                     // Backend for OPEN/KILL/NAME
+    std::unordered_map<int, std::unique_ptr<FileHandle>> files; // Open files by number
+
+    // LPRINT device (see printer.hpp); the console when not set
+    std::shared_ptr<Printer> printer;
+
+    // Highest file number, and most files open at once (MBASIC's /F:
+    // switch). MBASIC allows at most 15; larger limits are an extension.
+    int max_files = 15;
+
+    // Close all open files and drop their FIELD buffers
+    void close_files();
+
+    // Write out buffered output of all open files (END, program stop)
+    void flush_files();
+
+    // Write out file output whose flush interval has passed, or all of it
+    // with an interval when waiting for input (see FileHandle::flush_due)
+    void flush_due_files(bool waiting);
+
+    // A FIELD variable bound to its storage, so GET can fill it without
+    // looking it up by name
+    struct FieldBinding {
+        std::string name;
+        Value* value;
+        int offset;
+        int width;
+    };
 
     // Field buffer for random access files
     struct FieldBuffer {
-        std::vector<char> buffer;                                    // The actual data buffer
-        std::unordered_map<std::string, std::pair<int, int>> fields; // var_name -> (offset, width)
-        int current_record = 0;
+        std::vector<char> buffer;               // The actual data buffer
+        std::vector<FieldBinding> bindings;     // Fields in FIELD order
+        int64_t current_record = 0;
     };
     std::unordered_map<int, FieldBuffer> field_buffers;
 
+    // Which field buffer a variable was last FIELDed into (for LSET/RSET)
+    struct FieldRef {
+        FieldBuffer* buffer;
+        size_t binding;
+    };
+    std::unordered_map<std::string, FieldRef> field_index;
+
+    // Drop a file's FIELD definition and its field_index entries
+    void drop_fields(int filenum);
+
     // ========== Error Handling ==========
     std::optional<int> error_handler_line;
     bool error_handler_is_gosub = false;
@@ -201,6 +253,7 @@ public:
     int array_base = 0;         // OPTION BASE (0 or 1)
     bool trace_on = false;      // TRON/TROFF
     double rnd_last = 0.5;      // Last RND value (for seeding)
+    std::mt19937 rnd_engine;    // RND sequence, seeded per runtime
     std::set<PC> breakpoints;   // Breakpoints
     bool break_requested = false;  // Ctrl+C
     bool direct_mode = false;   // True when executing in immediate/direct mode
@@ -44,6 +44,9 @@ enum class TokenType {
     RESET,
     RSET,
     APPEND,
+    LOCK,
+    UNLOCK,
+    SHARED,
 
     // Keywords - Control Flow
     ALL,
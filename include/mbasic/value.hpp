@@ -2,7 +2,10 @@
 
 #include <variant>
 #include <string>
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
+#include <cstdio>
 #include <cmath>
 
 namespace mbasic {
@@ -63,40 +66,58 @@ inline int16_t to_integer(const Value& v) {
     return static_cast<int16_t>(std::rint(d));
 }
 
-// Convert value to string representation
-inline std::string to_string(const Value& v) {
-    return std::visit([](auto&& arg) -> std::string {
-        using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, std::string>) {
-            return arg;
-        } else if constexpr (std::is_same_v<T, int16_t>) {
-            std::string s = std::to_string(arg);
-            // MBASIC adds leading space for positive numbers, trailing space for all
-            if (arg >= 0) s = " " + s;
-            s += " ";
-            return s;
+// Append the PRINT form of a value to out without building it separately:
+// strings as they are, numbers with a leading space (or minus sign) and a
+// trailing space. Without padded, numbers get neither space (the WRITE form).
+inline void append_value(std::string& out, const Value& v, bool padded = true) {
+    if (const auto* str = std::get_if<std::string>(&v)) {
+        out += *str;
+        return;
+    }
+    // Room for a %f double at the top of its range (309 digits and 6
+    // decimals), the sign and the two spaces
+    char buf[336];
+    char* p = buf + 1;
+    char* end;
+    bool negative;
+    if (const auto* i = std::get_if<int16_t>(&v)) {
+        end = std::to_chars(p, buf + sizeof(buf), *i).ptr;
+        negative = *i < 0;
+    } else {
+        // Float/double formatting
+        double d = std::holds_alternative<float>(v) ? std::get<float>(v) : std::get<double>(v);
+        if (std::abs(d) < 1e10 && d == static_cast<int64_t>(d)) {
+            // Integer value, display without decimal
+            end = std::to_chars(p, buf + sizeof(buf), static_cast<int64_t>(d)).ptr;
         } else {
-            // Float/double formatting
-            std::string s;
-            double d = static_cast<double>(arg);
-            if (d == static_cast<int64_t>(d) && std::abs(d) < 1e10) {
-                // Integer value, display without decimal
-                s = std::to_string(static_cast<int64_t>(d));
-            } else {
-                // Use default formatting
-                s = std::to_string(d);
-                // Remove trailing zeros after decimal
-                if (s.find('.') != std::string::npos) {
-                    while (s.back() == '0') s.pop_back();
-                    if (s.back() == '.') s.pop_back();
-                }
+            // Fixed notation, trailing zeros after the decimal point removed
+            int n = std::snprintf(p, sizeof(buf) - 2, "%f", d);
+            end = p + (n > 0 ? n : 0);
+            if (std::char_traits<char>::find(p, static_cast<size_t>(end - p), '.')) {
+                while (end[-1] == '0') --end;
+                if (end[-1] == '.') --end;
             }
-            // MBASIC adds leading space for positive numbers, trailing space for all
-            if (d >= 0) s = " " + s;
-            s += " ";
-            return s;
         }
-    }, v);
+        negative = !(d >= 0);
+    }
+    // MBASIC adds leading space for positive numbers, trailing space for all
+    if (padded) {
+        if (!negative) {
+            *--p = ' ';
+        }
+        *end++ = ' ';
+    }
+    out.append(p, end);
+}
+
+// Convert value to string representation
+inline std::string to_string(const Value& v) {
+    if (const auto* str = std::get_if<std::string>(&v)) {
+        return *str;
+    }
+    std::string s;
+    append_value(s, v);
+    return s;
 }
 
 // Convert value to boolean (for conditionals)
@@ -0,0 +1,66 @@
+#pragma once
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Zygote - a resident process that forks a ready interpreter per job
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace mbasic {
+
+// ============================================================================
+// Zygote server
+// ============================================================================
+// A resident process listens on a Unix socket. A client sends the command
+// line of a job along with its standard input, output and error and its
+// working directory (passed as descriptors with SCM_RIGHTS). The zygote
+// forks; the child puts the descriptors in place and runs the job, and
+// the zygote sends the job's exit status back to the client once it ends.
+// Jobs skip exec, dynamic linking and whatever the zygote prepared before
+// forking, which they share copy-on-write.
+//
+// If the client goes away before its job ends, the job is sent SIGTERM.
+// Only clients of the zygote's own user are served (checked with
+// SO_PEERCRED; the socket is a SOCK_SEQPACKET one, so this is Linux only).
+// Jobs see the zygote's environment, not the client's.
+//
+// run_zygote() installs handlers for SIGCHLD, SIGINT and SIGTERM and
+// owns the process until one of the latter two arrives, so there can be
+// one per process. The zygote itself runs on a single thread; it must not
+// start others before forking.
+
+struct ZygoteJob {
+    std::vector<std::string> args;      // Command line, args[0] being the program name
+    int cwd_fd = -1;                    // Client's working directory (zygote side only)
+};
+
+struct ZygoteOptions {
+    std::string socket_path;            // Removed and recreated if stale
+
+    // Runs in the zygote just before each fork, to prepare what the job
+    // will need (a parsed program, say) so that later jobs can reuse it
+    std::function<void(const ZygoteJob&)> before_fork;
+
+    // Runs in the child once the descriptors are in place; its result is
+    // the job's exit status
+    std::function<int(const ZygoteJob&)> run;
+};
+
+// Serve jobs until SIGINT or SIGTERM, then end the jobs still running and
+// remove the socket. Returns 0, or 1 after printing why it couldn't start.
+int run_zygote(const ZygoteOptions& options);
+
+// Socket path used when none is given: $XDG_RUNTIME_DIR/mbasicc.sock, or
+// /tmp/mbasicc-UID.sock
+std::string default_zygote_socket();
+
+// Client side: run args as a job of the zygote at socket_path with the given
+// descriptors as its standard input, output and error, in the current
+// directory. Returns the job's exit status (128 + N if killed by signal N),
+// or -1 with errno set if the zygote couldn't be reached or went away.
+int run_zygote_job(const std::string& socket_path, const std::vector<std::string>& args,
+                   int in_fd = 0, int out_fd = 1, int err_fd = 2);
+
+} // namespace mbasic
@@ -0,0 +1,733 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Compressed File Handler Implementation - gzip and zstd sequential files
+
+#include "mbasic/file_handler.hpp"
+#include "mbasic/error.hpp"
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef MBASIC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MBASIC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace mbasic {
+
+// Uncompressed bytes handed between the program and the codec thread
+constexpr size_t COMPRESSED_BLOCK_SIZE = 256 * 1024;
+
+// Compressed bytes read from the file at a time
+constexpr size_t COMPRESSED_READ_SIZE = 64 * 1024;
+
+// Blocks queued ahead of (input) or behind (output) the program
+constexpr size_t COMPRESSED_QUEUE_DEPTH = 2;
+
+namespace {
+
+[[noreturn]] void throw_io_error(int err) {
+    if (err == ENOSPC) {
+        throw RuntimeError(ErrorCode::DISK_FULL, "Disk full");
+    }
+    throw RuntimeError(ErrorCode::DISK_IO_ERROR,
+                       "Disk I/O error: " + system_error_text(err));
+}
+
+[[noreturn]] void throw_codec_error(const char* what) {
+    throw RuntimeError(ErrorCode::DISK_IO_ERROR, std::string("Disk I/O error: ") + what);
+}
+
+size_t read_some(int fd, char* data, size_t size, FileStats* stats) {
+    for (;;) {
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_io_error(errno);
+        }
+        if (stats) {
+            stats->read_calls.fetch_add(1, std::memory_order_relaxed);
+            stats->bytes_read.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        }
+        return static_cast<size_t>(n);
+    }
+}
+
+bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// ============================================================================
+// Codecs
+// ============================================================================
+
+enum class Codec { GZIP, ZSTD };
+
+enum class EncodeMode {
+    CONTINUE,   // Compress what fits, keep the rest for later
+    FLUSH,      // End the block so everything so far can be decoded
+    FINISH      // End the stream (gzip member / zstd frame)
+};
+
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+
+    // Decode from in into out, advancing both past the bytes used
+    virtual void decode(const char*& in, size_t& in_len, char*& out, size_t& out_len) = 0;
+
+    // True when the input so far ends on a complete stream
+    virtual bool complete() const = 0;
+};
+
+class Encoder {
+public:
+    virtual ~Encoder() = default;
+
+    // Compress data, appending the output to out
+    virtual void encode(const char* data, size_t size, EncodeMode mode, std::vector<char>& out) = 0;
+};
+
+#ifdef MBASIC_HAVE_ZLIB
+
+// Output grown by this much per deflate() call
+constexpr size_t ZLIB_OUT_CHUNK = 64 * 1024;
+
+// windowBits selecting the gzip wrapper
+constexpr int GZIP_WINDOW_BITS = 15 + 16;
+
+class GzipDecoder : public Decoder {
+public:
+    GzipDecoder() {
+        if (::inflateInit2(&z_, GZIP_WINDOW_BITS) != Z_OK) {
+            throw_codec_error("cannot start gzip decoder");
+        }
+    }
+    ~GzipDecoder() override { ::inflateEnd(&z_); }
+
+    void decode(const char*& in, size_t& in_len, char*& out, size_t& out_len) override {
+        z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+        z_.avail_in = static_cast<uInt>(std::min<size_t>(in_len, UINT_MAX));
+        z_.next_out = reinterpret_cast<Bytef*>(out);
+        z_.avail_out = static_cast<uInt>(std::min<size_t>(out_len, UINT_MAX));
+        uInt in_before = z_.avail_in;
+        uInt out_before = z_.avail_out;
+
+        int rc = ::inflate(&z_, Z_NO_FLUSH);
+        size_t used = in_before - z_.avail_in;
+        size_t produced = out_before - z_.avail_out;
+        in += used;
+        in_len -= used;
+        out += produced;
+        out_len -= produced;
+
+        if (rc == Z_STREAM_END) {
+            // Appended files hold several members, one after the other
+            ::inflateReset(&z_);
+            in_member_ = false;
+        } else if (rc == Z_OK) {
+            if (used > 0) in_member_ = true;
+        } else if (rc != Z_BUF_ERROR) {
+            throw_codec_error(z_.msg ? z_.msg : "corrupt gzip data");
+        }
+    }
+
+    bool complete() const override { return !in_member_; }
+
+private:
+    z_stream z_{};
+    bool in_member_ = false;
+};
+
+class GzipEncoder : public Encoder {
+public:
+    explicit GzipEncoder(int level) {
+        if (level <= 0) level = Z_DEFAULT_COMPRESSION;
+        if (level > Z_BEST_COMPRESSION) level = Z_BEST_COMPRESSION;
+        if (::deflateInit2(&z_, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                           Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw_codec_error("cannot start gzip encoder");
+        }
+    }
+    ~GzipEncoder() override { ::deflateEnd(&z_); }
+
+    void encode(const char* data, size_t size, EncodeMode mode, std::vector<char>& out) override {
+        int flush = mode == EncodeMode::FINISH  ? Z_FINISH
+                    : mode == EncodeMode::FLUSH ? Z_SYNC_FLUSH
+                                                : Z_NO_FLUSH;
+        z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        z_.avail_in = static_cast<uInt>(size);
+        do {
+            size_t old_size = out.size();
+            out.resize(old_size + ZLIB_OUT_CHUNK);
+            z_.next_out = reinterpret_cast<Bytef*>(out.data() + old_size);
+            z_.avail_out = static_cast<uInt>(ZLIB_OUT_CHUNK);
+            if (::deflate(&z_, flush) == Z_STREAM_ERROR) {
+                throw_codec_error("gzip compression failed");
+            }
+            out.resize(old_size + ZLIB_OUT_CHUNK - z_.avail_out);
+        } while (z_.avail_out == 0);
+    }
+
+private:
+    z_stream z_{};
+};
+
+#endif // MBASIC_HAVE_ZLIB
+
+#ifdef MBASIC_HAVE_ZSTD
+
+class ZstdDecoder : public Decoder {
+public:
+    ZstdDecoder() : ds_(::ZSTD_createDStream()) {
+        if (!ds_) throw_codec_error("cannot start zstd decoder");
+    }
+    ~ZstdDecoder() override { ::ZSTD_freeDStream(ds_); }
+
+    void decode(const char*& in, size_t& in_len, char*& out, size_t& out_len) override {
+        ZSTD_inBuffer input{in, in_len, 0};
+        ZSTD_outBuffer output{out, out_len, 0};
+        size_t rc = ::ZSTD_decompressStream(ds_, &output, &input);
+        if (::ZSTD_isError(rc)) {
+            throw_codec_error(::ZSTD_getErrorName(rc));
+        }
+        in += input.pos;
+        in_len -= input.pos;
+        out += output.pos;
+        out_len -= output.pos;
+        // 0 means a frame was completely decoded and flushed
+        if (input.pos > 0 || output.pos > 0) in_frame_ = rc != 0;
+    }
+
+    bool complete() const override { return !in_frame_; }
+
+private:
+    ZSTD_DStream* ds_;
+    bool in_frame_ = false;
+};
+
+class ZstdEncoder : public Encoder {
+public:
+    explicit ZstdEncoder(int level) : cctx_(::ZSTD_createCCtx()) {
+        if (!cctx_) throw_codec_error("cannot start zstd encoder");
+        if (level > 0) {
+            ::ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+        }
+    }
+    ~ZstdEncoder() override { ::ZSTD_freeCCtx(cctx_); }
+
+    void encode(const char* data, size_t size, EncodeMode mode, std::vector<char>& out) override {
+        ZSTD_EndDirective directive = mode == EncodeMode::FINISH  ? ZSTD_e_end
+                                      : mode == EncodeMode::FLUSH ? ZSTD_e_flush
+                                                                  : ZSTD_e_continue;
+        ZSTD_inBuffer input{data, size, 0};
+        size_t chunk = ::ZSTD_CStreamOutSize();
+        for (;;) {
+            size_t old_size = out.size();
+            out.resize(old_size + chunk);
+            ZSTD_outBuffer output{out.data() + old_size, chunk, 0};
+            size_t rc = ::ZSTD_compressStream2(cctx_, &output, &input, directive);
+            if (::ZSTD_isError(rc)) {
+                throw_codec_error(::ZSTD_getErrorName(rc));
+            }
+            out.resize(old_size + output.pos);
+            bool done = directive == ZSTD_e_continue ? input.pos == input.size : rc == 0;
+            if (done) break;
+        }
+    }
+
+private:
+    ZSTD_CCtx* cctx_;
+};
+
+#endif // MBASIC_HAVE_ZSTD
+
+std::unique_ptr<Decoder> make_decoder(Codec codec) {
+    switch (codec) {
+#ifdef MBASIC_HAVE_ZLIB
+        case Codec::GZIP:
+            return std::make_unique<GzipDecoder>();
+#endif
+#ifdef MBASIC_HAVE_ZSTD
+        case Codec::ZSTD:
+            return std::make_unique<ZstdDecoder>();
+#endif
+        default:
+            throw_codec_error("compression not supported");
+    }
+}
+
+std::unique_ptr<Encoder> make_encoder(Codec codec, int level) {
+    switch (codec) {
+#ifdef MBASIC_HAVE_ZLIB
+        case Codec::GZIP:
+            return std::make_unique<GzipEncoder>(level);
+#endif
+#ifdef MBASIC_HAVE_ZSTD
+        case Codec::ZSTD:
+            return std::make_unique<ZstdEncoder>(level);
+#endif
+        default:
+            (void)level;
+            throw_codec_error("compression not supported");
+    }
+}
+
+// ============================================================================
+// DecompressThread - decodes input blocks ahead of the program
+// ============================================================================
+// Keeps up to COMPRESSED_QUEUE_DEPTH full blocks ready. Errors (read
+// failures, corrupt or truncated data) are handed to the program when it
+// reaches the point where they happened.
+
+class DecompressThread {
+public:
+    DecompressThread(int fd, std::unique_ptr<Decoder> decoder, FileStats* stats)
+        : fd_(fd), decoder_(std::move(decoder)), stats_(stats), thread_([this] { run(); }) {}
+
+    ~DecompressThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // Swap the next decoded block into block; false at end of file
+    bool next(std::vector<char>& block) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !ready_.empty() || done_; });
+        if (ready_.empty()) {
+            if (error_) std::rethrow_exception(error_);
+            return false;
+        }
+        block.swap(ready_.front());
+        spare_.push_back(std::move(ready_.front()));
+        ready_.pop_front();
+        lock.unlock();
+        cv_.notify_all();
+        return true;
+    }
+
+private:
+    void run() {
+        std::vector<char> input(COMPRESSED_READ_SIZE);
+        size_t in_pos = 0;
+        size_t in_len = 0;
+        bool input_done = false;
+        try {
+            for (;;) {
+                std::vector<char> block;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this] {
+                        return ready_.size() < COMPRESSED_QUEUE_DEPTH || stop_;
+                    });
+                    if (stop_) return;
+                    if (!spare_.empty()) {
+                        block = std::move(spare_.back());
+                        spare_.pop_back();
+                    }
+                }
+                block.resize(COMPRESSED_BLOCK_SIZE);
+
+                size_t filled = 0;
+                bool finished = false;
+                while (filled < block.size()) {
+                    const char* in = input.data() + in_pos;
+                    size_t in_avail = in_len - in_pos;
+                    char* out = block.data() + filled;
+                    size_t out_avail = block.size() - filled;
+                    decoder_->decode(in, in_avail, out, out_avail);
+                    size_t used = (in_len - in_pos) - in_avail;
+                    size_t produced = (block.size() - filled) - out_avail;
+                    in_pos += used;
+                    filled += produced;
+                    if (used > 0 || produced > 0) continue;
+
+                    // No progress: the decoder needs more input
+                    if (input_done) {
+                        if (!decoder_->complete()) {
+                            throw_codec_error("compressed file is truncated");
+                        }
+                        finished = true;
+                        break;
+                    }
+                    in_len = read_some(fd_, input.data(), input.size(), stats_);
+                    in_pos = 0;
+                    input_done = in_len == 0;
+                }
+                block.resize(filled);
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (filled > 0) ready_.push_back(std::move(block));
+                if (finished) done_ = true;
+                cv_.notify_all();
+                if (finished) return;
+            }
+        } catch (const RuntimeError&) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+            done_ = true;
+            cv_.notify_all();
+        }
+    }
+
+    int fd_;
+    std::unique_ptr<Decoder> decoder_;
+    FileStats* stats_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<char>> ready_;
+    std::vector<std::vector<char>> spare_;
+    bool done_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;    // Last: started once the rest is initialised
+};
+
+// ============================================================================
+// CompressThread - compresses and writes output blocks behind the program
+// ============================================================================
+
+class CompressThread {
+public:
+    CompressThread(int fd, std::unique_ptr<Encoder> encoder, FileStats* stats)
+        : fd_(fd), encoder_(std::move(encoder)), stats_(stats), thread_([this] { run(); }) {}
+
+    ~CompressThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // Queue block for compression and hand back an empty one to fill.
+    // FLUSH and FINISH wait until everything queued is on disk.
+    void submit(std::vector<char>& block, EncodeMode mode) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return queue_.size() < COMPRESSED_QUEUE_DEPTH || error_; });
+        check_error();
+        queue_.push_back({std::move(block), mode});
+        block.clear();
+        if (!spare_.empty()) {
+            block = std::move(spare_.back());
+            spare_.pop_back();
+        }
+        cv_.notify_all();
+        if (mode != EncodeMode::CONTINUE) {
+            cv_.wait(lock, [this] { return (queue_.empty() && !busy_) || error_; });
+            check_error();
+        }
+    }
+
+    // Compressed bytes written so far
+    int64_t written() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_;
+    }
+
+private:
+    struct Job {
+        std::vector<char> data;
+        EncodeMode mode;
+    };
+
+    void check_error() {
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            queue_.clear();
+            std::rethrow_exception(error);
+        }
+    }
+
+    void run() {
+        std::vector<char> out;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [this] { return !queue_.empty() || stop_; });
+            if (queue_.empty()) return;
+            Job job = std::move(queue_.front());
+            queue_.pop_front();
+            busy_ = true;
+            lock.unlock();
+
+            size_t size = 0;
+            std::exception_ptr error;
+            try {
+                out.clear();
+                encoder_->encode(job.data.data(), job.data.size(), job.mode, out);
+                write_all(fd_, out.data(), out.size(), stats_);
+                size = out.size();
+            } catch (const RuntimeError&) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            written_ += static_cast<int64_t>(size);
+            if (error && !error_) error_ = error;
+            job.data.clear();
+            spare_.push_back(std::move(job.data));
+            busy_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    int fd_;
+    std::unique_ptr<Encoder> encoder_;
+    FileStats* stats_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    std::vector<std::vector<char>> spare_;
+    bool busy_ = false;
+    bool stop_ = false;
+    int64_t written_ = 0;
+    std::exception_ptr error_;
+    std::thread thread_;    // Last: started once the rest is initialised
+};
+
+} // namespace
+
+// ============================================================================
+// CompressedFileHandle Implementation
+// ============================================================================
+
+struct CompressedFileHandle::Impl {
+    int fd = -1;
+    FileSystem::Mode mode = FileSystem::Mode::INPUT;
+    int record_length = 128;
+    FileOptions options;
+
+    // Input: the decoded block being read. Output: the block being filled.
+    std::vector<char> block;
+    size_t block_pos = 0;
+    bool at_end = false;        // Input exhausted
+    int64_t offset = 0;         // Uncompressed bytes read or written
+    int64_t initial_size = 0;   // File size at open (APPEND adds to it)
+
+    std::unique_ptr<DecompressThread> reader;
+    std::unique_ptr<CompressThread> writer;
+
+    bool writing() const { return mode != FileSystem::Mode::INPUT; }
+
+    // Make unread input available; false at end of file
+    bool fill() {
+        if (block_pos < block.size()) return true;
+        if (at_end) return false;
+        block_pos = 0;
+        if (!reader->next(block)) {
+            block.clear();
+            at_end = true;
+            return false;
+        }
+        return true;
+    }
+
+    void append(const char* data, size_t size) {
+        while (size > 0) {
+            size_t n = std::min(size, COMPRESSED_BLOCK_SIZE - block.size());
+            block.insert(block.end(), data, data + n);
+            data += n;
+            size -= n;
+            offset += static_cast<int64_t>(n);
+            if (block.size() == COMPRESSED_BLOCK_SIZE) {
+                writer->submit(block, EncodeMode::CONTINUE);
+                block.reserve(COMPRESSED_BLOCK_SIZE);
+            }
+        }
+    }
+};
+
+CompressedFileHandle::CompressedFileHandle() : impl_(std::make_unique<Impl>()) {}
+
+CompressedFileHandle::~CompressedFileHandle() {
+    // As for NativeFileHandle, a failure here can only be reported by close()
+    try {
+        close();
+    } catch (const RuntimeError&) {
+    }
+}
+
+bool CompressedFileHandle::compressed_extension(const std::string& filename) {
+#ifdef MBASIC_HAVE_ZLIB
+    if (ends_with(filename, ".gz")) return true;
+#endif
+#ifdef MBASIC_HAVE_ZSTD
+    if (ends_with(filename, ".zst")) return true;
+#endif
+    (void)filename;
+    return false;
+}
+
+bool CompressedFileHandle::open_file(const std::string& filename,
+                                     FileSystem::Mode mode,
+                                     int record_length,
+                                     const FileOptions& options) {
+    if (mode == FileSystem::Mode::RANDOM || !compressed_extension(filename)) {
+        return false;
+    }
+    Codec codec = ends_with(filename, ".zst") ? Codec::ZSTD : Codec::GZIP;
+
+    int flags = O_CLOEXEC;
+    switch (mode) {
+        case FileSystem::Mode::INPUT:
+            flags |= O_RDONLY;
+            break;
+        case FileSystem::Mode::OUTPUT:
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        default:
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+            break;
+    }
+
+    int fd;
+    do {
+        fd = ::open(filename.c_str(), flags, 0666);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    impl_->fd = fd;
+    impl_->mode = mode;
+    impl_->record_length = record_length;
+    impl_->options = options;
+    impl_->initial_size = static_cast<int64_t>(st.st_size);
+    impl_->offset = 0;
+    impl_->block.clear();
+    impl_->block_pos = 0;
+    impl_->at_end = false;
+    try {
+        if (mode == FileSystem::Mode::INPUT) {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            impl_->reader = std::make_unique<DecompressThread>(
+                fd, make_decoder(codec), options.stats.get());
+        } else {
+            impl_->block.reserve(COMPRESSED_BLOCK_SIZE);
+            impl_->writer = std::make_unique<CompressThread>(
+                fd, make_encoder(codec, options.compression_level), options.stats.get());
+        }
+    } catch (const RuntimeError&) {
+        impl_->fd = -1;
+        ::close(fd);
+        return false;
+    }
+    return true;
+}
+
+bool CompressedFileHandle::is_open() const {
+    return impl_->fd >= 0;
+}
+
+void CompressedFileHandle::close() {
+    if (impl_->fd < 0) {
+        return;
+    }
+    int fd = impl_->fd;
+    impl_->fd = -1;
+    try {
+        if (impl_->writer) {
+            impl_->writer->submit(impl_->block, EncodeMode::FINISH);
+            if (impl_->options.durability != FileOptions::Durability::NONE) {
+                if (impl_->options.stats) {
+                    impl_->options.stats->sync_calls.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (::fdatasync(fd) != 0 && errno != EINVAL) {
+                    throw_io_error(errno);
+                }
+            }
+        }
+    } catch (const RuntimeError&) {
+        impl_->writer.reset();
+        ::close(fd);
+        throw;
+    }
+    // Join the codec thread before the fd goes away
+    impl_->reader.reset();
+    impl_->writer.reset();
+    impl_->block.clear();
+    impl_->block.shrink_to_fit();
+    if (::close(fd) != 0 && errno != EINTR) {
+        throw_io_error(errno);
+    }
+}
+
+void CompressedFileHandle::write_line(const std::string& line) {
+    if (!impl_->writing()) throw_bad_mode();
+    impl_->append(line.data(), line.size());
+    impl_->append("\n", 1);
+}
+
+void CompressedFileHandle::write(const std::string& data) {
+    if (!impl_->writing()) throw_bad_mode();
+    impl_->append(data.data(), data.size());
+}
+
+bool CompressedFileHandle::eof() const {
+    // Output files are always positioned at their end
+    if (impl_->writing()) return true;
+    return !impl_->fill();
+}
+
+int64_t CompressedFileHandle::position() const {
+    return (impl_->offset + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+}
+
+int64_t CompressedFileHandle::length() const {
+    if (impl_->writer) {
+        return impl_->initial_size + impl_->writer->written();
+    }
+    return impl_->initial_size;
+}
+
+int CompressedFileHandle::record_length() const {
+    return impl_->record_length;
+}
+
+void CompressedFileHandle::flush() {
+    if (impl_->writer && !impl_->block.empty()) {
+        impl_->writer->submit(impl_->block, EncodeMode::FLUSH);
+        impl_->block.reserve(COMPRESSED_BLOCK_SIZE);
+    }
+}
+
+std::string_view CompressedFileHandle::peek() {
+    if (impl_->writing()) throw_bad_mode();
+    if (!impl_->fill()) {
+        return {};
+    }
+    return {impl_->block.data() + impl_->block_pos, impl_->block.size() - impl_->block_pos};
+}
+
+void CompressedFileHandle::consume(size_t n) {
+    impl_->block_pos += n;
+    impl_->offset += static_cast<int64_t>(n);
+}
+
+} // namespace mbasic
@@ -1,37 +1,181 @@
 // MBASICC - MBASIC 5.21 C++ Interpreter
 // https://github.com/avwohl/mbasicc
 //
-// ConsoleIO Implementation - Standard console I/O using std::cin/std::cout
+// ConsoleIO Implementation - Console I/O on a pair of streams
 
 #include "mbasic/io_handler.hpp"
 #include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 
 namespace mbasic {
 
-void ConsoleIO::print(const std::string& text) {
-    std::cout << text;
-    // Update column position
-    for (char c : text) {
-        if (c == '\n') {
-            column_ = 0;
-        } else if (c == '\t') {
-            column_ = ((column_ / 14) + 1) * 14;  // Tab zones (14 columns)
-        } else {
-            column_++;
+// Last newline in [p, p + n), or nullptr
+static const char* find_last_newline(const char* p, size_t n) {
+#ifdef __GLIBC__
+    return static_cast<const char*>(::memrchr(p, '\n', n));
+#else
+    while (n > 0) {
+        if (p[--n] == '\n') return p + n;
+    }
+    return nullptr;
+#endif
+}
+
+int advance_column(int column, std::string_view text) {
+    const char* p = text.data();
+    size_t n = text.size();
+    if (const char* nl = find_last_newline(p, n)) {
+        column = 0;
+        n -= static_cast<size_t>(nl + 1 - p);
+        p = nl + 1;
+    }
+    // Plain characters count one each; tabs jump to the next zone
+    while (n > 0) {
+        const char* tab = static_cast<const char*>(std::memchr(p, '\t', n));
+        size_t run = tab ? static_cast<size_t>(tab - p) : n;
+        column += static_cast<int>(run);
+        if (!tab) break;
+        column = (column / PRINT_ZONE_WIDTH + 1) * PRINT_ZONE_WIDTH;
+        n -= run + 1;
+        p = tab + 1;
+    }
+    return column;
+}
+
+// ============================================================================
+// ConsoleIO::Timer - flushes output that has waited too long
+// ============================================================================
+// The mutex also serializes print() and flush() with the timer thread, so
+// a flush never lands in the middle of a PRINT.
+
+struct ConsoleIO::Timer {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::ostream& out;
+    bool pending = false;       // Output written to out, not flushed
+    bool stop = false;
+    std::chrono::steady_clock::time_point pending_since;
+    std::chrono::milliseconds interval;
+    std::thread thread;         // Last, so it starts after everything it uses
+
+    Timer(std::ostream& o, int interval_ms)
+        : out(o), interval(interval_ms), thread([this] { run(); }) {}
+
+    ~Timer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
         }
+        cv.notify_all();
+        thread.join();
     }
-    std::cout.flush();
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop) {
+            if (!pending) {
+                cv.wait(lock);
+                continue;
+            }
+            auto due = pending_since + interval;
+            if (std::chrono::steady_clock::now() >= due) {
+                out.flush();
+                pending = false;
+            } else {
+                cv.wait_until(lock, due);
+            }
+        }
+    }
+};
+
+ConsoleIO::ConsoleIO() : ConsoleIO(std::cin, std::cout, ::isatty(STDOUT_FILENO)) {}
+
+ConsoleIO::ConsoleIO(std::istream& in, std::ostream& out, bool terminal)
+    : in_(in), out_(out), tty_(terminal) {}
+
+ConsoleIO::~ConsoleIO() {
+    timer_.reset();
+    out_.flush();
+}
+
+void ConsoleIO::set_flush_interval(int ms) {
+    timer_.reset();
+    flush_interval_ms_ = ms;
+}
+
+void ConsoleIO::print(const std::string& text) {
+    if (text.empty()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock;
+    if (timer_) {
+        lock = std::unique_lock<std::mutex>(timer_->mutex);
+    }
+    out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+    column_ = advance_column(column_, text);
+
+    // A terminal shows each line as it is finished
+    if (tty_ && std::memchr(text.data(), '\n', text.size())) {
+        out_.flush();
+        if (timer_) timer_->pending = false;
+        return;
+    }
+    if (flush_interval_ms_ <= 0) {
+        return;
+    }
+    if (!timer_) {
+        timer_ = std::make_unique<Timer>(out_, flush_interval_ms_);
+        lock = std::unique_lock<std::mutex>(timer_->mutex);
+    }
+    if (!timer_->pending) {
+        timer_->pending = true;
+        timer_->pending_since = std::chrono::steady_clock::now();
+        timer_->cv.notify_one();
+    }
+}
+
+void ConsoleIO::flush() {
+    std::unique_lock<std::mutex> lock;
+    if (timer_) {
+        lock = std::unique_lock<std::mutex>(timer_->mutex);
+        timer_->pending = false;
+    }
+    out_.flush();
 }
 
 std::string ConsoleIO::input(const std::string& prompt) {
-    std::cout << prompt;
-    std::cout.flush();
+    print(prompt);
+    flush();
     std::string line;
-    std::getline(std::cin, line);
+    std::getline(in_, line);
     column_ = 0;
     return line;
 }
 
+std::string ConsoleIO::input_chars(int n) {
+    flush();
+    std::string chars;
+    for (int i = 0; i < n; ++i) {
+        int c = in_.get();
+        if (c == std::char_traits<char>::eof()) break;
+        chars += static_cast<char>(c);
+    }
+    return chars;
+}
+
+std::string ConsoleIO::input_block([[maybe_unused]] size_t max) {
+    flush();
+    std::string line;
+    if (!std::getline(in_, line)) return line;
+    if (!in_.eof()) line += '\n';
+    return line;
+}
+
 std::optional<char> ConsoleIO::inkey() {
     // Non-blocking input is platform-specific
     // On POSIX systems, this would require termios manipulation
@@ -0,0 +1,377 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Device File Handler Implementation - PIPE:, STDIN: and STDOUT: devices
+
+#include "mbasic/file_handler.hpp"
+#include "mbasic/io_handler.hpp"
+#include "mbasic/error.hpp"
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace mbasic {
+
+// Size of the buffer behind every device
+constexpr size_t DEVICE_BUFFER_SIZE = 64 * 1024;
+
+namespace {
+
+[[noreturn]] void throw_io_error(int err) {
+    throw RuntimeError(ErrorCode::DISK_IO_ERROR,
+                       "Disk I/O error: " + system_error_text(err));
+}
+
+// Case-insensitive prefix test for device names
+bool starts_with_nocase(const std::string& s, const char* prefix) {
+    size_t n = std::strlen(prefix);
+    if (s.size() < n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (std::toupper(static_cast<unsigned char>(s[i])) != prefix[i]) return false;
+    }
+    return true;
+}
+
+bool equals_nocase(const std::string& s, const char* name) {
+    return s.size() == std::strlen(name) && starts_with_nocase(s, name);
+}
+
+// Start "/bin/sh -c command" with one end of a pipe as its standard input
+// (writing) or output (reading); returns our end of the pipe, or -1
+int spawn_pipe(const std::string& command, bool writing, pid_t& pid) {
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    int ours = writing ? fds[1] : fds[0];
+    int theirs = writing ? fds[0] : fds[1];
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    // dup2 leaves the child's copy without O_CLOEXEC
+    posix_spawn_file_actions_adddup2(&actions, theirs, writing ? STDIN_FILENO : STDOUT_FILENO);
+
+    const char* argv[] = {"sh", "-c", command.c_str(), nullptr};
+    int err = ::posix_spawn(&pid, "/bin/sh", &actions, nullptr,
+                            const_cast<char* const*>(argv), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(theirs);
+    if (err != 0) {
+        ::close(ours);
+        return -1;
+    }
+    return ours;
+}
+
+} // namespace
+
+// ============================================================================
+// DeviceFileHandle Implementation
+// ============================================================================
+// Input fills the buffer with read(2) and hands it out through peek(); output
+// collects in the buffer and goes out with write(2) when it is full, on
+// flush() and on CLOSE, or after every statement when the device is a
+// terminal or sync_writes is set.
+
+struct DeviceFileHandle::Impl {
+    int fd = -1;
+    pid_t pid = -1;             // PIPE: command, waited for on close
+    FileSystem::Mode mode = FileSystem::Mode::INPUT;
+    FileOptions options;
+    bool line_flush = false;    // Write out after every statement
+
+    std::vector<char> buffer;
+    size_t buffer_pos = 0;      // Input: read cursor
+    size_t buffer_len = 0;      // Input: bytes read; output: bytes pending
+    bool at_end = false;
+    int64_t offset = 0;         // Bytes consumed or written by the program
+    int64_t received = 0;       // Bytes read from the device
+
+    bool writing() const { return mode != FileSystem::Mode::INPUT; }
+
+    // Make unread input available; false at end of file
+    bool fill() {
+        if (buffer_pos < buffer_len) return true;
+        if (at_end) return false;
+        buffer_pos = buffer_len = 0;
+        ssize_t n;
+        do {
+            n = ::read(fd, buffer.data(), buffer.size());
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            throw_io_error(errno);
+        }
+        if (options.stats) {
+            options.stats->read_calls.fetch_add(1, std::memory_order_relaxed);
+            options.stats->bytes_read.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        }
+        if (n == 0) {
+            at_end = true;
+            return false;
+        }
+        buffer_len = static_cast<size_t>(n);
+        received += n;
+        return true;
+    }
+
+    void flush_buffer() {
+        if (buffer_len == 0) return;
+        write_all(fd, buffer.data(), buffer_len, options.stats.get());
+        buffer_len = 0;
+    }
+
+    void append(const char* data, size_t size) {
+        if (!writing()) throw_bad_mode();
+        offset += static_cast<int64_t>(size);
+        if (buffer_len + size > buffer.size()) {
+            flush_buffer();
+            if (size >= buffer.size()) {
+                write_all(fd, data, size, options.stats.get());
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + buffer_len, data, size);
+        buffer_len += size;
+    }
+
+    void write_behind() {
+        if (line_flush || options.sync_writes) flush_buffer();
+    }
+};
+
+DeviceFileHandle::DeviceFileHandle() : impl_(std::make_unique<Impl>()) {}
+
+DeviceFileHandle::~DeviceFileHandle() {
+    // As for NativeFileHandle, a failure here can only be reported by close()
+    try {
+        close();
+    } catch (const RuntimeError&) {
+    }
+}
+
+bool DeviceFileHandle::device_name(const std::string& filename) {
+    return starts_with_nocase(filename, "PIPE:") && filename.size() > 5;
+}
+
+bool DeviceFileHandle::open_device(const std::string& filename,
+                                   FileSystem::Mode mode,
+                                   const FileOptions& options) {
+    if (!device_name(filename)) {
+        return false;
+    }
+    if (mode == FileSystem::Mode::RANDOM) throw_bad_mode();
+    bool writing = mode != FileSystem::Mode::INPUT;
+
+    int fd = spawn_pipe(filename.substr(5), writing, impl_->pid);
+    if (fd < 0) {
+        return false;
+    }
+
+    impl_->fd = fd;
+    impl_->mode = mode;
+    impl_->options = options;
+    impl_->line_flush = writing && ::isatty(fd);
+    impl_->buffer.resize(DEVICE_BUFFER_SIZE);
+    impl_->buffer_pos = impl_->buffer_len = 0;
+    impl_->at_end = false;
+    impl_->offset = impl_->received = 0;
+    return true;
+}
+
+bool DeviceFileHandle::is_open() const {
+    return impl_->fd >= 0;
+}
+
+void DeviceFileHandle::close() {
+    if (impl_->fd < 0) {
+        return;
+    }
+    int fd = impl_->fd;
+    try {
+        if (impl_->writing()) impl_->flush_buffer();
+    } catch (const RuntimeError&) {
+        impl_->buffer_len = 0;
+        close();
+        throw;
+    }
+    impl_->fd = -1;
+    impl_->buffer.clear();
+    impl_->buffer.shrink_to_fit();
+    int err = ::close(fd) != 0 && errno != EINTR ? errno : 0;
+    // Closing our end first lets the command see end of input (or a broken
+    // pipe) and finish; its exit status is not reported
+    if (impl_->pid > 0) {
+        int status;
+        while (::waitpid(impl_->pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        impl_->pid = -1;
+    }
+    if (err != 0) {
+        throw_io_error(err);
+    }
+}
+
+void DeviceFileHandle::write_line(const std::string& line) {
+    impl_->append(line.data(), line.size());
+    impl_->append("\n", 1);
+    impl_->write_behind();
+}
+
+void DeviceFileHandle::write(const std::string& data) {
+    impl_->append(data.data(), data.size());
+    impl_->write_behind();
+}
+
+bool DeviceFileHandle::eof() const {
+    // Output devices are always positioned at their end; input can only
+    // tell by reading, which waits for the writer
+    if (impl_->writing()) return true;
+    return !impl_->fill();
+}
+
+int64_t DeviceFileHandle::position() const {
+    return (impl_->offset + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+}
+
+int64_t DeviceFileHandle::length() const {
+    // A stream has no length; report what has gone through so far
+    return impl_->writing() ? impl_->offset : impl_->received;
+}
+
+int DeviceFileHandle::record_length() const {
+    return 0;
+}
+
+void DeviceFileHandle::flush() {
+    if (impl_->writing()) impl_->flush_buffer();
+}
+
+std::string_view DeviceFileHandle::peek() {
+    if (impl_->writing()) throw_bad_mode();
+    if (!impl_->fill()) {
+        return {};
+    }
+    return {impl_->buffer.data() + impl_->buffer_pos, impl_->buffer_len - impl_->buffer_pos};
+}
+
+void DeviceFileHandle::consume(size_t n) {
+    impl_->buffer_pos += n;
+    impl_->offset += static_cast<int64_t>(n);
+}
+
+// ============================================================================
+// ConsoleFileHandle Implementation
+// ============================================================================
+// Output is handed straight to the IOHandler, which does its own buffering;
+// input is held a block at a time for peek().
+
+struct ConsoleFileHandle::Impl {
+    IOHandler& io;
+    bool writing;
+    bool open = true;
+    bool at_end = false;
+    std::string buffer;
+    size_t buffer_pos = 0;
+    int64_t offset = 0;         // Bytes consumed or written by the program
+
+    Impl(IOHandler& io, bool writing) : io(io), writing(writing) {}
+
+    // Make unread input available; false at end of file
+    bool fill() {
+        if (buffer_pos < buffer.size()) return true;
+        if (at_end) return false;
+        buffer = io.input_block(DEVICE_BUFFER_SIZE);
+        buffer_pos = 0;
+        if (buffer.empty()) {
+            at_end = true;
+            return false;
+        }
+        return true;
+    }
+
+    void append(const std::string& data) {
+        if (!writing) throw_bad_mode();
+        io.print(data);
+        offset += static_cast<int64_t>(data.size());
+    }
+};
+
+bool ConsoleFileHandle::device_name(const std::string& filename) {
+    return equals_nocase(filename, "STDIN:") || equals_nocase(filename, "STDOUT:");
+}
+
+ConsoleFileHandle::ConsoleFileHandle(const std::string& filename,
+                                     FileSystem::Mode mode, IOHandler& io) {
+    bool writing = mode != FileSystem::Mode::INPUT;
+    if (mode == FileSystem::Mode::RANDOM ||
+        equals_nocase(filename, "STDIN:") == writing) {
+        throw_bad_mode();
+    }
+    impl_ = std::make_unique<Impl>(io, writing);
+}
+
+ConsoleFileHandle::~ConsoleFileHandle() = default;
+
+bool ConsoleFileHandle::is_open() const {
+    return impl_->open;
+}
+
+void ConsoleFileHandle::close() {
+    if (!impl_->open) return;
+    flush();
+    impl_->open = false;
+    impl_->buffer.clear();
+}
+
+void ConsoleFileHandle::write_line(const std::string& line) {
+    impl_->append(line);
+    impl_->append("\n");
+}
+
+void ConsoleFileHandle::write(const std::string& data) {
+    impl_->append(data);
+}
+
+bool ConsoleFileHandle::eof() const {
+    if (impl_->writing) return true;
+    return !impl_->fill();
+}
+
+int64_t ConsoleFileHandle::position() const {
+    return (impl_->offset + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+}
+
+int64_t ConsoleFileHandle::length() const {
+    return impl_->offset;
+}
+
+int ConsoleFileHandle::record_length() const {
+    return 0;
+}
+
+void ConsoleFileHandle::flush() {
+    if (impl_->writing) impl_->io.flush();
+}
+
+std::string_view ConsoleFileHandle::peek() {
+    if (impl_->writing) throw_bad_mode();
+    if (!impl_->fill()) {
+        return {};
+    }
+    return std::string_view(impl_->buffer).substr(impl_->buffer_pos);
+}
+
+void ConsoleFileHandle::consume(size_t n) {
+    impl_->buffer_pos += n;
+    impl_->offset += static_cast<int64_t>(n);
+}
+
+} // namespace mbasic
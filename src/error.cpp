@@ -1,4 +1,28 @@
 #include "mbasic/error.hpp"
+#include <cstring>
 
 // Error handling implementation
 // Most error functionality is in the header as inline functions
+
+namespace mbasic {
+
+namespace {
+
+// strerror_r is the XSI one, returning 0 on success, or the GNU one,
+// returning the text, depending on the C library
+[[maybe_unused]] const char* strerror_result(int result, const char* buffer) {
+    return result == 0 ? buffer : "Unknown error";
+}
+
+[[maybe_unused]] const char* strerror_result(const char* result, const char*) {
+    return result;
+}
+
+} // namespace
+
+std::string system_error_text(int err) {
+    char buffer[256] = "";
+    return strerror_result(::strerror_r(err, buffer, sizeof(buffer)), buffer);
+}
+
+} // namespace mbasic
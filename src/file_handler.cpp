@@ -1,196 +1,1731 @@
 // MBASICC - MBASIC 5.21 C++ Interpreter
 // https://github.com/avwohl/mbasicc
 //
-// File Handler Implementation - Native file system using std::fstream
+// File Handler Implementation - Native file system using POSIX file descriptors
 
 #include "mbasic/file_handler.hpp"
-#include <fstream>
+#include "mbasic/error.hpp"
+#include <vector>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstring>
 #include <cstdio>  // for std::remove, std::rename
+#include <cstdlib>  // for realpath
+#include <fcntl.h>
+#include <climits>
+#include <functional>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 namespace mbasic {
 
+// Size of the user-space buffer behind every native file
+constexpr size_t FILE_BUFFER_SIZE = 64 * 1024;
+
+// Smallest read issued for random files; GETs far apart should not pull in
+// a whole sequential-sized buffer for one record
+constexpr size_t RANDOM_READ_SIZE = 4 * 1024;
+
+// PUT records held back before the dirty-record cache is written out
+constexpr size_t RECORD_CACHE_SIZE = 256 * 1024;
+
+// Step by which mapped random files (and their mappings) grow
+constexpr int64_t MMAP_CHUNK = 1024 * 1024;
+
+// Most records handed to a single pwritev(2)
+constexpr size_t MAX_IOVECS = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+// ============================================================================
+// Syscall helpers
+// ============================================================================
+
+[[noreturn]] static void throw_io_error(int err) {
+    if (err == ENOSPC) {
+        throw RuntimeError(ErrorCode::DISK_FULL, "Disk full");
+    }
+    throw RuntimeError(ErrorCode::DISK_IO_ERROR,
+                       "Disk I/O error: " + system_error_text(err));
+}
+
+// Write all bytes at offset, retrying short writes and EINTR
+static void pwrite_all(int fd, const char* data, size_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_io_error(errno);
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+}
+
+// Write an iovec array at offset, retrying short writes and EINTR.
+// The iovecs are consumed.
+static void pwritev_all(int fd, struct iovec* iov, int count, int64_t offset) {
+    while (count > 0) {
+        ssize_t n = ::pwritev(fd, iov, count, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_io_error(errno);
+        }
+        offset += n;
+        size_t done = static_cast<size_t>(n);
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+// Read up to size bytes at offset; returns 0 only at end of file
+static size_t pread_some(int fd, char* data, size_t size, int64_t offset) {
+    for (;;) {
+        ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_io_error(errno);
+        }
+        return static_cast<size_t>(n);
+    }
+}
+
+static inline void count_read(FileStats* stats, size_t n) {
+    if (stats) {
+        stats->read_calls.fetch_add(1, std::memory_order_relaxed);
+        stats->bytes_read.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+static inline void count_write(FileStats* stats, size_t n) {
+    if (stats) {
+        stats->write_calls.fetch_add(1, std::memory_order_relaxed);
+        stats->bytes_written.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+static inline void count_sync(FileStats* stats) {
+    if (stats) {
+        stats->sync_calls.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// LOCK/UNLOCK a range of records (first 0 = the whole file) with an fcntl
+// byte-range lock. Open file description locks belong to the handle rather
+// than the process, so two handles in one process exclude each other too.
+// Returns false if the range is locked elsewhere; never waits.
+static bool set_record_lock(int fd, short type, int64_t first, int64_t last, int record_length) {
+    struct flock fl {};
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    if (first > 0) {
+        fl.l_start = static_cast<off_t>((first - 1) * record_length);
+        fl.l_len = static_cast<off_t>((last - first + 1) * record_length);
+    }
+#ifdef F_OFD_SETLK
+    int cmd = F_OFD_SETLK;
+#else
+    int cmd = F_SETLK;
+#endif
+    while (::fcntl(fd, cmd, &fl) != 0) {
+        if (errno == EINTR) continue;
+        if (errno == EACCES || errno == EAGAIN) return false;
+        throw_io_error(errno);
+    }
+    return true;
+}
+
+void write_all(int fd, const char* data, size_t size, FileStats* stats) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_io_error(errno);
+        }
+        count_write(stats, static_cast<size_t>(n));
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+// ============================================================================
+// FileHandle defaults
+// ============================================================================
+
+bool FileHandle::read_line(std::string& line) {
+    line.clear();
+    std::string_view data = peek();
+    if (data.empty()) {
+        return false;
+    }
+    for (;;) {
+        const char* nl = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+        if (nl) {
+            size_t n = static_cast<size_t>(nl - data.data());
+            line.append(data.data(), n);
+            consume(n + 1);
+            return true;
+        }
+        // The line continues in the next buffer
+        line.append(data.data(), data.size());
+        consume(data.size());
+        data = peek();
+        if (data.empty()) {
+            return true;
+        }
+    }
+}
+
+std::string FileHandle::read_chars(int n) {
+    std::string result;
+    size_t want = static_cast<size_t>(std::max(n, 0));
+    while (result.size() < want) {
+        std::string_view data = peek();
+        if (data.empty()) break;
+        size_t take = std::min(want - result.size(), data.size());
+        result.append(data.data(), take);
+        consume(take);
+    }
+    return result;
+}
+
+void FileHandle::seek_record(int64_t, int) {
+    throw_bad_mode();
+}
+
+int FileHandle::read_raw(char*, int) {
+    throw_bad_mode();
+}
+
+void FileHandle::write_raw(const char*, int) {
+    throw_bad_mode();
+}
+
+void FileHandle::throw_bad_mode() {
+    throw RuntimeError(ErrorCode::BAD_FILE_MODE, "Bad file mode");
+}
+
+// ============================================================================
+// ReadAhead - background reader for sequential input
+// ============================================================================
+// One request at a time: the owner asks for the bytes at an offset, keeps
+// parsing its current buffer, and later takes the filled buffer in
+// exchange for its own. The thread never throws; a failed read is handed
+// back as an errno.
+
+class ReadAhead {
+public:
+    ReadAhead(int fd, size_t size, FileStats* stats)
+        : fd_(fd), buffer_(size), stats_(stats), thread_([this] { run(); }) {}
+
+    ~ReadAhead() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            state_ = State::STOP;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // Start reading at offset; any earlier request is finished first
+    void request(int64_t offset) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return state_ != State::PENDING; });
+        offset_ = offset;
+        state_ = State::PENDING;
+        lock.unlock();
+        cv_.notify_all();
+    }
+
+    // If the last request was for offset, swap its data into buffer and
+    // return the length; otherwise return -1 (the caller reads itself)
+    int64_t take(int64_t offset, std::vector<char>& buffer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (state_ == State::IDLE || offset_ != offset) {
+            cv_.wait(lock, [this] { return state_ != State::PENDING; });
+            state_ = State::IDLE;
+            return -1;
+        }
+        if (state_ == State::PENDING) {
+            if (stats_) stats_->read_ahead_waits.fetch_add(1, std::memory_order_relaxed);
+            cv_.wait(lock, [this] { return state_ != State::PENDING; });
+        } else if (stats_) {
+            stats_->read_ahead_hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        state_ = State::IDLE;
+        if (error_ != 0) {
+            throw_io_error(error_);
+        }
+        buffer_.swap(buffer);
+        return static_cast<int64_t>(length_);
+    }
+
+private:
+    enum class State { IDLE, PENDING, READY, STOP };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [this] { return state_ == State::PENDING || state_ == State::STOP; });
+            if (state_ == State::STOP) return;
+            int64_t offset = offset_;
+            lock.unlock();
+
+            ssize_t n;
+            do {
+                n = ::pread(fd_, buffer_.data(), buffer_.size(), static_cast<off_t>(offset));
+            } while (n < 0 && errno == EINTR);
+            int err = n < 0 ? errno : 0;
+            if (n >= 0) count_read(stats_, static_cast<size_t>(n));
+
+            lock.lock();
+            length_ = n < 0 ? 0 : static_cast<size_t>(n);
+            error_ = err;
+            if (state_ == State::PENDING) state_ = State::READY;
+            cv_.notify_all();
+        }
+    }
+
+    int fd_;
+    std::vector<char> buffer_;
+    FileStats* stats_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    State state_ = State::IDLE;
+    int64_t offset_ = 0;
+    size_t length_ = 0;
+    int error_ = 0;
+    std::thread thread_;  // Last, so it starts after everything it uses
+};
+
+// ============================================================================
+// DescriptorPool - LRU budget of open descriptors
+// ============================================================================
+// Every NativeFileHandle opened through the pool owns a Slot. The slots
+// with an open descriptor that may be closed are kept in LRU order; when
+// more descriptors are open than the budget allows, the least recently used
+// one is closed, and its file reopens it (by path, checking it is still the
+// same file) the next time it needs one. Pinned slots - LOCKed records,
+// pipes and devices, files KILLed or replaced while open - never lose
+// their descriptors.
+
+class DescriptorPool {
+public:
+    struct Slot {
+        std::string path;           // Absolute, for reopening
+        int flags = 0;              // Access mode to reopen with
+        dev_t dev = 0;              // Identity of the file, checked on reopen
+        ino_t ino = 0;
+        int fd = -1;
+        int pins = 0;
+        FileStats* stats = nullptr;
+        std::function<void()> release;  // Called before the descriptor closes
+        std::list<Slot*>::iterator lru_pos;
+    };
+
+    explicit DescriptorPool(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+    // Descriptor budget when FileOptions::max_descriptors is 0
+    static size_t default_capacity() {
+        // Leave room for the console, libraries and unpooled files
+        constexpr rlim_t RESERVE = 32;
+        struct rlimit rl;
+        if (::getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY) {
+            return 65536;
+        }
+        return rl.rlim_cur > RESERVE * 2 ? static_cast<size_t>(rl.rlim_cur - RESERVE)
+                                         : static_cast<size_t>(rl.rlim_cur / 2);
+    }
+
+    // Open a file, closing idle descriptors if the process is out of them
+    int open(const char* path, int flags) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return open_locked(path, flags);
+    }
+
+    // Start tracking a slot whose descriptor was just opened
+    void add(Slot& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.push_back(&slot);
+        ++open_count_;
+        if (slot.pins == 0) {
+            lru_.push_front(&slot);
+            slot.lru_pos = lru_.begin();
+        }
+        trim(&slot);
+    }
+
+    // Stop tracking a slot; returns its descriptor (-1 if it was evicted)
+    // for the caller to close
+    int remove(Slot& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.erase(std::find(slots_.begin(), slots_.end(), &slot));
+        int fd = slot.fd;
+        if (fd >= 0) {
+            if (slot.pins == 0) lru_.erase(slot.lru_pos);
+            --open_count_;
+        }
+        slot.fd = -1;
+        return fd;
+    }
+
+    // The slot's descriptor, reopened if it was evicted
+    int get(Slot& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return get_locked(slot);
+    }
+
+    // Keep the slot's descriptor open until unpin()
+    void pin(Slot& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        get_locked(slot);
+        if (slot.pins++ == 0) lru_.erase(slot.lru_pos);
+    }
+
+    void unpin(Slot& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slot.pins == 0 || --slot.pins > 0) return;
+        lru_.push_front(&slot);
+        slot.lru_pos = lru_.begin();
+        trim(&slot);
+    }
+
+    // filename is about to be removed or replaced: open files on it keep
+    // their descriptors for good, since they couldn't be reopened
+    void unlinking(const std::string& filename) {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Slot* slot : slots_) {
+            if (slot->dev == st.st_dev && slot->ino == st.st_ino) {
+                get_locked(*slot);
+                if (slot->pins++ == 0) lru_.erase(slot->lru_pos);
+            }
+        }
+    }
+
+    // A file was renamed to filename: reopen it under the new name
+    void renamed(const std::string& filename) {
+        struct stat st;
+        std::string path = absolute_path(filename);
+        if (path.empty() || ::stat(path.c_str(), &st) != 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Slot* slot : slots_) {
+            if (slot->dev == st.st_dev && slot->ino == st.st_ino) {
+                slot->path = path;
+            }
+        }
+    }
+
+    static std::string absolute_path(const std::string& filename) {
+        char resolved[PATH_MAX];
+        return ::realpath(filename.c_str(), resolved) ? std::string(resolved) : std::string();
+    }
+
+private:
+    int open_locked(const char* path, int flags) {
+        for (;;) {
+            int fd = ::open(path, flags, 0666);
+            if (fd >= 0) return fd;
+            if (errno == EINTR) continue;
+            if ((errno != EMFILE && errno != ENFILE) || lru_.empty()) return -1;
+            evict(*lru_.back());
+        }
+    }
+
+    int get_locked(Slot& slot) {
+        if (slot.fd >= 0) {
+            if (slot.pins == 0) lru_.splice(lru_.begin(), lru_, slot.lru_pos);
+            return slot.fd;
+        }
+        int fd = open_locked(slot.path.c_str(), slot.flags);
+        if (fd < 0) {
+            throw_io_error(errno);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_dev != slot.dev || st.st_ino != slot.ino) {
+            ::close(fd);
+            throw RuntimeError(ErrorCode::DISK_IO_ERROR,
+                               "Disk I/O error: file replaced while open: " + slot.path);
+        }
+        if (slot.stats) slot.stats->descriptor_reopens.fetch_add(1, std::memory_order_relaxed);
+        slot.fd = fd;
+        ++open_count_;
+        if (slot.pins == 0) {
+            lru_.push_front(&slot);
+            slot.lru_pos = lru_.begin();
+        }
+        trim(&slot);
+        return fd;
+    }
+
+    // Close least recently used descriptors down to the budget, sparing keep
+    void trim(Slot* keep) {
+        while (open_count_ > capacity_ && !lru_.empty() && lru_.back() != keep) {
+            evict(*lru_.back());
+        }
+    }
+
+    void evict(Slot& slot) {
+        if (slot.release) slot.release();
+        ::close(slot.fd);
+        slot.fd = -1;
+        lru_.erase(slot.lru_pos);
+        --open_count_;
+    }
+
+    std::mutex mutex_;
+    size_t capacity_;
+    size_t open_count_ = 0;
+    std::vector<Slot*> slots_;
+    std::list<Slot*> lru_;          // Evictable open slots, most recent first
+};
+
 // ============================================================================
 // NativeFileHandle Implementation
 // ============================================================================
+// The buffer is either a read window or a pending write:
+//   - read:  buffer[0, buffer_len) mirrors the file at buffer_start,
+//            buffer_pos is the read cursor
+//   - dirty: buffer[0, buffer_len) must be written at buffer_start,
+//            the cursor is at its end
+// Switching between the two flushes the pending write first.
+//
+// PUT records bypass the buffer and go to the dirty-record cache, keyed by
+// record index and written in index order by flush_records(). Reads overlay
+// any cached records, so GET always sees the latest PUT. The buffer and the
+// record cache never both hold pending data: each flushes the other first.
+
+struct CachedRecord {
+    int64_t index = 0;
+    bool dirty = false;
+    std::vector<char> data;
+};
 
 struct NativeFileHandle::Impl {
-    std::fstream file;
-    FileSystem::Mode mode;
-    int record_length;
-    mutable int64_t cached_length = -1;  // Cached file length
+    bool open = false;
+    DescriptorPool::Slot slot;              // slot.fd is -1 while evicted
+    std::shared_ptr<DescriptorPool> pool;   // nullptr: slot.fd stays open
+    FileSystem::Mode mode = FileSystem::Mode::INPUT;
+    int record_length = 128;
+    FileOptions options;
+    FileStats* stats = nullptr;
+
+    std::vector<char> buffer;
+    int64_t buffer_start = 0;   // File offset of buffer[0]
+    size_t buffer_len = 0;      // Valid (read) or pending (dirty) bytes
+    size_t buffer_pos = 0;      // Read cursor within buffer
+    bool dirty = false;
+
+    int64_t size = 0;           // File length, including pending writes
+    bool regular = false;       // Regular file: nobody else changes its length
+
+    // LRU record cache (FileOptions::record_cache_records); in write-back
+    // mode dirty entries are handed to the dirty-record cache on eviction
+    std::list<CachedRecord> lru;    // Most recently used first
+    std::unordered_map<int64_t, std::list<CachedRecord>::iterator> lru_index;
+    size_t lru_record_size = 0;
+    size_t lru_dirty = 0;
+
+    // Dirty-record cache: record index -> offset of its bytes in record_arena
+    std::map<int64_t, size_t> dirty_records;
+    std::vector<char> record_arena;
+    size_t dirty_record_size = 0;
+    int records_since_sync = 0;
+    bool written = false;       // Anything written since open (Durability::CLOSE)
+
+    // When the buffer last went from clean to dirty (for flush_interval_ms)
+    std::chrono::steady_clock::time_point dirty_since;
+
+    // Started once an INPUT file turns out to be bigger than one buffer
+    std::unique_ptr<ReadAhead> read_ahead;
+
+    // The file's descriptor, reopening it if the pool closed it
+    int descriptor() {
+        return pool ? pool->get(slot) : slot.fd;
+    }
+
+    int64_t offset() const {
+        return buffer_start + static_cast<int64_t>(dirty ? buffer_len : buffer_pos);
+    }
+
+    // Forget the read window, so the next read goes to the file
+    void drop_window() {
+        if (!dirty) {
+            buffer_start = offset();
+            buffer_len = buffer_pos = 0;
+        }
+    }
+
+    // Pick up changes other processes made to the file length
+    void refresh_size() {
+        struct stat st;
+        if (::fstat(descriptor(), &st) == 0) {
+            size = std::max(size, static_cast<int64_t>(st.st_size));
+        }
+    }
+
+    // Write out pending data; the buffer becomes an empty read window
+    void flush_buffer() {
+        if (dirty) {
+            written = true;
+            pwrite_all(descriptor(), buffer.data(), buffer_len, buffer_start);
+            count_write(stats, buffer_len);
+            buffer_start += static_cast<int64_t>(buffer_len);
+            buffer_len = buffer_pos = 0;
+            dirty = false;
+        }
+    }
+
+    // Write the dirty-record cache in index order, one pwritev per run of
+    // contiguous records
+    void flush_records() {
+        if (dirty_records.empty()) return;
+        written = true;
+        std::vector<struct iovec> iov;
+        iov.reserve(std::min(dirty_records.size(), MAX_IOVECS));
+        auto it = dirty_records.begin();
+        while (it != dirty_records.end()) {
+            int64_t first = it->first;
+            int64_t next = first;
+            iov.clear();
+            while (it != dirty_records.end() && it->first == next && iov.size() < MAX_IOVECS) {
+                iov.push_back({record_arena.data() + it->second, dirty_record_size});
+                ++next;
+                ++it;
+            }
+            int64_t pos = first * static_cast<int64_t>(dirty_record_size);
+            count_write(stats, iov.size() * dirty_record_size);
+            if (iov.size() == 1) {
+                pwrite_all(descriptor(), static_cast<const char*>(iov[0].iov_base), dirty_record_size, pos);
+            } else {
+                pwritev_all(descriptor(), iov.data(), static_cast<int>(iov.size()), pos);
+            }
+        }
+        dirty_records.clear();
+        record_arena.clear();
+    }
+
+    void flush_all() {
+        spill_cache();
+        flush_records();
+        flush_buffer();
+    }
+
+    void sync_data() {
+        flush_all();
+        records_since_sync = 0;
+        count_sync(stats);
+        // EINVAL: the file doesn't support syncing (pipes, some devices)
+        if (::fdatasync(descriptor()) != 0 && errno != EINVAL) {
+            throw_io_error(errno);
+        }
+    }
+
+    // Copy cached records over data just read from the file at pos.
+    // Cached records may lie past the end of the file on disk; the short
+    // read is extended up to cap bytes (zero-filled like a file hole) so
+    // they are visible. Returns the new length.
+    size_t overlay_records(int64_t pos, char* data, size_t n, size_t cap) {
+        if (dirty_records.empty()) return n;
+        if (pos + static_cast<int64_t>(n) < size && n < cap) {
+            size_t extended = static_cast<size_t>(std::min<int64_t>(cap, size - pos));
+            std::memset(data + n, 0, extended - n);
+            n = extended;
+        }
+        int64_t rec_size = static_cast<int64_t>(dirty_record_size);
+        int64_t end = pos + static_cast<int64_t>(n);
+        for (auto it = dirty_records.lower_bound(pos / rec_size);
+             it != dirty_records.end() && it->first * rec_size < end; ++it) {
+            int64_t rec_start = it->first * rec_size;
+            int64_t from = std::max(rec_start, pos);
+            int64_t to = std::min(rec_start + rec_size, end);
+            if (from < to) {
+                std::memcpy(data + (from - pos),
+                            record_arena.data() + it->second + (from - rec_start),
+                            static_cast<size_t>(to - from));
+            }
+        }
+        return n;
+    }
+
+    // Move the cursor, keeping the read window when the target is inside it
+    void seek(int64_t pos) {
+        if (dirty) {
+            if (pos == offset()) return;
+            flush_buffer();
+        }
+        if (pos >= buffer_start && pos <= buffer_start + static_cast<int64_t>(buffer_len)) {
+            buffer_pos = static_cast<size_t>(pos - buffer_start);
+        } else {
+            buffer_start = pos;
+            buffer_len = buffer_pos = 0;
+        }
+    }
+
+    // Refill the read window at the cursor; returns bytes available
+    size_t fill() {
+        flush_buffer();
+        if (buffer_pos < buffer_len) return buffer_len - buffer_pos;
+        buffer_start += static_cast<int64_t>(buffer_pos);
+        buffer_len = buffer_pos = 0;
+        size_t want = buffer.size();
+        if (mode == FileSystem::Mode::RANDOM) {
+            want = std::max(RANDOM_READ_SIZE, static_cast<size_t>(record_length));
+            want = std::min(want, buffer.size());
+        }
+        if (read_ahead) {
+            int64_t got = read_ahead->take(buffer_start, buffer);
+            if (got >= 0) {
+                buffer_len = static_cast<size_t>(got);
+                if (buffer_len > 0) read_ahead->request(buffer_start + got);
+                return buffer_len;
+            }
+        }
+        buffer_len = pread_some(descriptor(), buffer.data(), want, buffer_start);
+        count_read(stats, buffer_len);
+        buffer_len = overlay_records(buffer_start, buffer.data(), buffer_len, want);
+        if (mode == FileSystem::Mode::INPUT && options.read_ahead && buffer_len == want) {
+            // Big enough to be worth a reader thread
+            if (!read_ahead) {
+                read_ahead = std::make_unique<ReadAhead>(descriptor(), buffer.size(), stats);
+            }
+            read_ahead->request(buffer_start + static_cast<int64_t>(buffer_len));
+        }
+        return buffer_len;
+    }
+
+    size_t read(char* dst, size_t n) {
+        size_t total = 0;
+        while (total < n) {
+            if (buffer_pos == buffer_len || dirty) {
+                // Large reads bypass the buffer entirely
+                if (!dirty && n - total >= buffer.size()) {
+                    int64_t pos = offset();
+                    size_t got = pread_some(descriptor(), dst + total, n - total, pos);
+                    count_read(stats, got);
+                    got = overlay_records(pos, dst + total, got, n - total);
+                    buffer_start = pos + static_cast<int64_t>(got);
+                    buffer_len = buffer_pos = 0;
+                    total += got;
+                    if (got == 0) break;
+                    continue;
+                }
+                if (fill() == 0) break;
+            }
+            size_t chunk = std::min(n - total, buffer_len - buffer_pos);
+            std::memcpy(dst + total, buffer.data() + buffer_pos, chunk);
+            buffer_pos += chunk;
+            total += chunk;
+        }
+        return total;
+    }
+
+    void write(const char* src, size_t n) {
+        // Raw writes may overlap cached records
+        if (!lru.empty()) cache_clear();
+        flush_records();
+        if (!dirty) {
+            // Drop the read window; pending data starts at the cursor
+            buffer_start = offset();
+            buffer_len = buffer_pos = 0;
+            dirty = true;
+            if (options.flush_interval_ms > 0) {
+                dirty_since = std::chrono::steady_clock::now();
+            }
+        }
+        if (buffer_len + n > buffer.size()) {
+            flush_buffer();
+            if (n >= buffer.size()) {
+                pwrite_all(descriptor(), src, n, buffer_start);
+                buffer_start += static_cast<int64_t>(n);
+                size = std::max(size, buffer_start);
+                return;
+            }
+            dirty = true;
+        }
+        std::memcpy(buffer.data() + buffer_len, src, n);
+        buffer_len += n;
+        size = std::max(size, offset());
+    }
+
+    // PUT: keep the record in the dirty-record cache
+    void batch_record(int64_t index, const char* src, size_t n) {
+        flush_buffer();
+        if (n != dirty_record_size) {
+            // FIELD changed the record size; write out the old-sized records
+            flush_records();
+            dirty_record_size = n;
+        }
+        auto [it, inserted] = dirty_records.try_emplace(index, record_arena.size());
+        if (inserted) {
+            record_arena.insert(record_arena.end(), src, src + n);
+        } else {
+            std::memcpy(record_arena.data() + it->second, src, n);
+        }
+
+        // Keep the read window coherent with the new record
+        int64_t pos = index * static_cast<int64_t>(n);
+        int64_t end = pos + static_cast<int64_t>(n);
+        int64_t win_end = buffer_start + static_cast<int64_t>(buffer_len);
+        if (pos < win_end && end > buffer_start) {
+            int64_t from = std::max(pos, buffer_start);
+            int64_t to = std::min(end, win_end);
+            std::memcpy(buffer.data() + (from - buffer_start), src + (from - pos),
+                        static_cast<size_t>(to - from));
+        }
+        size = std::max(size, end);
+
+        if (options.sync_writes || record_arena.size() >= RECORD_CACHE_SIZE) {
+            flush_records();
+        }
+    }
+
+    // Find a record in the LRU cache, making it the most recently used
+    CachedRecord* cache_find(int64_t index, size_t n) {
+        if (n != lru_record_size) return nullptr;
+        auto it = lru_index.find(index);
+        if (it == lru_index.end()) return nullptr;
+        lru.splice(lru.begin(), lru, it->second);
+        return &lru.front();
+    }
+
+    // Add a record to the LRU cache, evicting the least recently used
+    CachedRecord& cache_insert(int64_t index, size_t n) {
+        if (n != lru_record_size) {
+            cache_clear();
+            lru_record_size = n;
+        }
+        if (lru.size() >= static_cast<size_t>(options.record_cache_records)) {
+            // Reuse the victim's storage
+            CachedRecord& victim = lru.back();
+            if (victim.dirty) {
+                batch_record(victim.index, victim.data.data(), n);
+                victim.dirty = false;
+                --lru_dirty;
+            }
+            lru_index.erase(victim.index);
+            lru.splice(lru.begin(), lru, std::prev(lru.end()));
+        } else {
+            lru.emplace_front();
+            lru.front().data.resize(n);
+        }
+        CachedRecord& entry = lru.front();
+        entry.index = index;
+        entry.dirty = false;
+        lru_index[index] = lru.begin();
+        return entry;
+    }
+
+    // Hand write-back records to the dirty-record cache, so raw reads and
+    // flushes see them
+    void spill_cache() {
+        if (lru_dirty == 0) return;
+        for (auto& entry : lru) {
+            if (entry.dirty) {
+                batch_record(entry.index, entry.data.data(), lru_record_size);
+                entry.dirty = false;
+            }
+        }
+        lru_dirty = 0;
+    }
+
+    void cache_clear() {
+        spill_cache();
+        lru.clear();
+        lru_index.clear();
+    }
+
+    // PUT: through the LRU cache if enabled, then the dirty-record cache
+    void put_record(int64_t index, const char* src, size_t n) {
+        if (n == 0) return;
+        if (options.record_cache_records > 0) {
+            CachedRecord* entry = cache_find(index, n);
+            if (!entry) entry = &cache_insert(index, n);
+            std::memcpy(entry->data.data(), src, n);
+            if (options.record_cache_write_back) {
+                if (!entry->dirty) ++lru_dirty;
+                entry->dirty = true;
+                size = std::max(size, (index + 1) * static_cast<int64_t>(n));
+            } else {
+                batch_record(index, src, n);
+            }
+        } else {
+            batch_record(index, src, n);
+        }
+        seek((index + 1) * static_cast<int64_t>(n));
+
+        if (options.durability == FileOptions::Durability::RECORDS &&
+            options.sync_every_records > 0 &&
+            ++records_since_sync >= options.sync_every_records) {
+            sync_data();
+        }
+    }
+
+    // GET: serve the record from the LRU cache, the dirty-record cache or
+    // the file
+    size_t get_record(int64_t index, char* dst, size_t n) {
+        int64_t pos = index * static_cast<int64_t>(n);
+        if (options.record_cache_records > 0 && n > 0) {
+            if (CachedRecord* entry = cache_find(index, n)) {
+                if (stats) stats->record_cache_hits.fetch_add(1, std::memory_order_relaxed);
+                std::memcpy(dst, entry->data.data(), n);
+                seek(pos + static_cast<int64_t>(n));
+                return n;
+            }
+            if (stats) stats->record_cache_misses.fetch_add(1, std::memory_order_relaxed);
+            size_t got = read_record_bytes(index, dst, n);
+            // Records past the end of file aren't cached, so EOF and LOF
+            // never see a record that doesn't exist
+            if (got == n) {
+                std::memcpy(cache_insert(index, n).data.data(), dst, n);
+            }
+            return got;
+        }
+        return read_record_bytes(index, dst, n);
+    }
+
+    size_t read_record_bytes(int64_t index, char* dst, size_t n) {
+        int64_t pos = index * static_cast<int64_t>(n);
+        if (options.shared) {
+            // Another process may have rewritten the buffered bytes
+            drop_window();
+        }
+        if (n == dirty_record_size) {
+            auto it = dirty_records.find(index);
+            if (it != dirty_records.end()) {
+                std::memcpy(dst, record_arena.data() + it->second, n);
+                seek(pos + static_cast<int64_t>(n));
+                return n;
+            }
+        }
+        seek(pos);
+        return read(dst, n);
+    }
+
+    // Called after each sequential write statement: honour sync_writes and
+    // the flush interval, otherwise leave the data buffered
+    void write_behind() {
+        if (options.sync_writes) {
+            flush_buffer();
+        } else {
+            flush_due(false);
+        }
+    }
+
+    void flush_due(bool waiting) {
+        if (options.flush_interval_ms > 0 && dirty &&
+            (waiting || std::chrono::steady_clock::now() - dirty_since >=
+                            std::chrono::milliseconds(options.flush_interval_ms))) {
+            flush_buffer();
+        }
+    }
 };
 
 NativeFileHandle::NativeFileHandle() : impl_(std::make_unique<Impl>()) {}
 
 NativeFileHandle::~NativeFileHandle() {
-    if (impl_ && impl_->file.is_open()) {
-        impl_->file.close();
+    // Destructors must not throw; a failed final flush is lost here, which
+    // is why CLOSE goes through close() and reports the error
+    try {
+        close();
+    } catch (const RuntimeError&) {
     }
 }
 
 bool NativeFileHandle::open_file(const std::string& filename,
                                   FileSystem::Mode mode,
-                                  int record_length) {
+                                  int record_length,
+                                  const FileOptions& options,
+                                  std::shared_ptr<DescriptorPool> pool) {
     impl_->mode = mode;
     impl_->record_length = record_length;
-    impl_->cached_length = -1;
-
-    std::ios_base::openmode open_mode{};
+    impl_->options = options;
+    impl_->stats = options.stats.get();
 
+    int flags = O_CLOEXEC;
     switch (mode) {
         case FileSystem::Mode::INPUT:
-            open_mode = std::ios::in;
+            flags |= O_RDONLY;
             break;
         case FileSystem::Mode::OUTPUT:
-            open_mode = std::ios::out | std::ios::trunc;
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
             break;
         case FileSystem::Mode::APPEND:
-            open_mode = std::ios::out | std::ios::app;
+            flags |= O_WRONLY | O_CREAT;
             break;
         case FileSystem::Mode::RANDOM:
-            open_mode = std::ios::in | std::ios::out | std::ios::binary;
+            // Random files are created if they don't exist
+            flags |= O_RDWR | O_CREAT;
             break;
     }
 
-    impl_->file.open(filename, open_mode);
+    int fd;
+    if (pool) {
+        fd = pool->open(filename.c_str(), flags);
+    } else {
+        do {
+            fd = ::open(filename.c_str(), flags, 0666);
+        } while (fd < 0 && errno == EINTR);
+    }
+    if (fd < 0) {
+        return false;
+    }
 
-    // For random access, try to create file if it doesn't exist
-    if (!impl_->file && mode == FileSystem::Mode::RANDOM) {
-        impl_->file.clear();
-        impl_->file.open(filename, std::ios::out | std::ios::binary);
-        impl_->file.close();
-        impl_->file.open(filename, open_mode);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    impl_->open = true;
+    impl_->slot.fd = fd;
+    impl_->size = static_cast<int64_t>(st.st_size);
+    impl_->regular = S_ISREG(st.st_mode);
+    impl_->buffer.resize(FILE_BUFFER_SIZE);
+    impl_->buffer_start = (mode == FileSystem::Mode::APPEND) ? impl_->size : 0;
+    impl_->buffer_len = impl_->buffer_pos = 0;
+    impl_->dirty = false;
+    if (mode == FileSystem::Mode::INPUT && options.read_ahead) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (options.shared && mode == FileSystem::Mode::RANDOM) {
+        // PUT goes straight to the file; GET bypasses the record cache
+        impl_->options.record_cache_records = 0;
+        impl_->options.sync_writes = true;
     }
 
-    return impl_->file.is_open();
+    if (pool) {
+        DescriptorPool::Slot& slot = impl_->slot;
+        // Reopening must not truncate or create the file again
+        slot.flags = O_CLOEXEC | (flags & O_ACCMODE);
+        slot.dev = st.st_dev;
+        slot.ino = st.st_ino;
+        slot.stats = impl_->stats;
+        slot.path = DescriptorPool::absolute_path(filename);
+        if (!impl_->regular || slot.path.empty()) {
+            slot.pins = 1;  // Can't be reopened
+        }
+        Impl* impl = impl_.get();
+        slot.release = [impl] { impl->read_ahead.reset(); };
+        impl_->pool = std::move(pool);
+        impl_->pool->add(slot);
+    }
+    return true;
 }
 
 bool NativeFileHandle::is_open() const {
-    return impl_->file.is_open();
+    return impl_->open;
 }
 
 void NativeFileHandle::close() {
-    if (impl_->file.is_open()) {
-        impl_->file.close();
+    if (!impl_->open) {
+        return;
+    }
+    impl_->read_ahead.reset();  // Joins the thread before the fd goes away
+    // Gives the descriptor back to the caller, out of the pool
+    auto take_descriptor = [this] {
+        impl_->open = false;
+        if (impl_->pool) {
+            int fd = impl_->pool->remove(impl_->slot);
+            impl_->pool.reset();
+            return fd;
+        }
+        int fd = impl_->slot.fd;
+        impl_->slot.fd = -1;
+        return fd;
+    };
+    try {
+        impl_->flush_all();
+        if (impl_->written && impl_->options.durability != FileOptions::Durability::NONE) {
+            impl_->sync_data();
+        }
+    } catch (const RuntimeError&) {
+        impl_->dirty = false;
+        impl_->dirty_records.clear();
+        int fd = take_descriptor();
+        if (fd >= 0) ::close(fd);
+        throw;
+    }
+    int fd = take_descriptor();
+    impl_->buffer.clear();
+    impl_->buffer.shrink_to_fit();
+    impl_->record_arena.clear();
+    impl_->record_arena.shrink_to_fit();
+    if (fd >= 0 && ::close(fd) != 0 && errno != EINTR) {
+        throw_io_error(errno);
     }
 }
 
 bool NativeFileHandle::read_line(std::string& line) {
-    if (!impl_->file || impl_->file.eof()) {
-        return false;
+    impl_->spill_cache();
+    line.clear();
+    bool got_any = false;
+    for (;;) {
+        if (impl_->dirty || impl_->buffer_pos == impl_->buffer_len) {
+            if (impl_->fill() == 0) {
+                return got_any;
+            }
+        }
+        const char* start = impl_->buffer.data() + impl_->buffer_pos;
+        size_t avail = impl_->buffer_len - impl_->buffer_pos;
+        const char* nl = static_cast<const char*>(std::memchr(start, '\n', avail));
+        if (nl) {
+            line.append(start, nl);
+            impl_->buffer_pos += static_cast<size_t>(nl - start) + 1;
+            return true;
+        }
+        line.append(start, avail);
+        impl_->buffer_pos = impl_->buffer_len;
+        got_any = true;
+    }
+}
+
+std::string_view NativeFileHandle::peek() {
+    impl_->spill_cache();
+    if (impl_->dirty || impl_->buffer_pos == impl_->buffer_len) {
+        impl_->fill();
     }
-    return static_cast<bool>(std::getline(impl_->file, line));
+    return {impl_->buffer.data() + impl_->buffer_pos, impl_->buffer_len - impl_->buffer_pos};
+}
+
+void NativeFileHandle::consume(size_t n) {
+    impl_->buffer_pos += n;
 }
 
 void NativeFileHandle::write_line(const std::string& line) {
-    impl_->file << line << '\n';
+    impl_->write(line.data(), line.size());
+    impl_->write("\n", 1);
+    impl_->write_behind();
 }
 
 void NativeFileHandle::write(const std::string& data) {
-    impl_->file << data;
+    impl_->write(data.data(), data.size());
+    impl_->write_behind();
 }
 
 std::string NativeFileHandle::read_chars(int n) {
-    std::string result(n, '\0');
-    impl_->file.read(&result[0], n);
-    result.resize(static_cast<size_t>(impl_->file.gcount()));
+    impl_->spill_cache();
+    std::string result(static_cast<size_t>(std::max(n, 0)), '\0');
+    result.resize(impl_->read(&result[0], result.size()));
     return result;
 }
 
 bool NativeFileHandle::eof() const {
-    return impl_->file.eof() || impl_->file.peek() == std::char_traits<char>::eof();
+    // Output files are always positioned at their end
+    if (impl_->mode == FileSystem::Mode::OUTPUT || impl_->mode == FileSystem::Mode::APPEND) {
+        return true;
+    }
+    // The tracked length covers pending writes, so no read is needed
+    if (impl_->regular) {
+        return impl_->offset() >= impl_->size;
+    }
+    impl_->spill_cache();
+    if (!impl_->dirty && impl_->buffer_pos < impl_->buffer_len) {
+        return false;
+    }
+    return impl_->fill() == 0;
 }
 
 int64_t NativeFileHandle::position() const {
-    auto pos = impl_->file.tellg();
-    if (pos == std::streampos(-1)) {
-        return 0;
-    }
-
-    // For random files, return record number
+    int64_t pos = impl_->offset();
     if (impl_->mode == FileSystem::Mode::RANDOM && impl_->record_length > 0) {
-        return static_cast<int64_t>(pos) / impl_->record_length + 1;
+        return pos / impl_->record_length;
     }
+    return (pos + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+}
 
-    // For sequential files, return byte position
-    return static_cast<int64_t>(pos);
+int NativeFileHandle::record_length() const {
+    return impl_->record_length;
 }
 
 int64_t NativeFileHandle::length() const {
-    // Cache the length to avoid seeking on every call
-    if (impl_->cached_length >= 0) {
-        return impl_->cached_length;
+    // Tracked across writes, so no seeking or fstat is needed unless
+    // other processes write the file too
+    if (impl_->options.shared) {
+        impl_->refresh_size();
     }
+    return impl_->size;
+}
+
+void NativeFileHandle::seek_record(int64_t record, int record_length) {
+    // Records are 1-based in BASIC
+    impl_->seek((record - 1) * record_length);
+}
 
-    // Save current position
-    auto current_pos = impl_->file.tellg();
+int NativeFileHandle::read_raw(char* buffer, int size) {
+    impl_->spill_cache();
+    return static_cast<int>(impl_->read(buffer, static_cast<size_t>(std::max(size, 0))));
+}
 
-    // Seek to end
-    impl_->file.seekg(0, std::ios::end);
-    auto end_pos = impl_->file.tellg();
+void NativeFileHandle::write_raw(const char* buffer, int size) {
+    impl_->write(buffer, static_cast<size_t>(std::max(size, 0)));
+}
 
-    // Restore position
-    impl_->file.seekg(current_pos);
+void NativeFileHandle::flush() {
+    impl_->flush_all();
+}
 
-    impl_->cached_length = static_cast<int64_t>(end_pos);
-    return impl_->cached_length;
+void NativeFileHandle::flush_due(bool waiting) {
+    impl_->flush_due(waiting);
 }
 
-void NativeFileHandle::seek_record(int record, int record_length) {
+int NativeFileHandle::read_record(int64_t record, char* buffer, int size) {
     // Records are 1-based in BASIC
-    int64_t offset = static_cast<int64_t>(record - 1) * record_length;
-    impl_->file.seekg(offset);
-    impl_->file.seekp(offset);
+    return static_cast<int>(impl_->get_record(record - 1, buffer, static_cast<size_t>(std::max(size, 0))));
 }
 
-void NativeFileHandle::read_raw(char* buffer, int size) {
-    impl_->file.read(buffer, size);
+void NativeFileHandle::write_record(int64_t record, const char* buffer, int size) {
+    impl_->put_record(record - 1, buffer, static_cast<size_t>(std::max(size, 0)));
 }
 
-void NativeFileHandle::write_raw(const char* buffer, int size) {
-    impl_->file.write(buffer, size);
-    impl_->cached_length = -1;  // Invalidate cached length
+bool NativeFileHandle::lock_records(int64_t first, int64_t last) {
+    short type = impl_->mode == FileSystem::Mode::INPUT ? F_RDLCK : F_WRLCK;
+    // Closing the descriptor would drop the lock, so it stays open until
+    // the matching UNLOCK
+    if (impl_->pool) impl_->pool->pin(impl_->slot);
+    if (!set_record_lock(impl_->descriptor(), type, first, last, impl_->record_length)) {
+        if (impl_->pool) impl_->pool->unpin(impl_->slot);
+        return false;
+    }
+    // Anything read before the lock was taken may be out of date
+    impl_->flush_all();
+    impl_->cache_clear();
+    impl_->drop_window();
+    impl_->refresh_size();
+    return true;
 }
 
-void NativeFileHandle::flush() {
-    impl_->file.flush();
+void NativeFileHandle::unlock_records(int64_t first, int64_t last) {
+    // Other processes must see the writes made under the lock
+    impl_->flush_all();
+    set_record_lock(impl_->descriptor(), F_UNLCK, first, last, impl_->record_length);
+    if (impl_->pool) impl_->pool->unpin(impl_->slot);
+}
+
+// ============================================================================
+// MappedFileHandle Implementation
+// ============================================================================
+// The file is mapped MAP_SHARED. Only [0, file_size) may be touched; past
+// that the pages have no backing and access would fault. file_size runs
+// ahead of size (the length BASIC sees) while records are appended.
+
+struct MappedFileHandle::Impl {
+    int fd = -1;
+    int record_length = 128;
+    FileOptions options;
+
+    char* data = nullptr;
+    size_t map_len = 0;
+    int64_t file_size = 0;      // Length on disk, including preallocated tail
+    int64_t size = 0;           // Logical file length (LOF)
+    int64_t cursor = 0;
+    bool written = false;
+    int records_since_sync = 0;
+
+    void map(size_t len) {
+        unmap();
+        void* p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            throw_io_error(errno);
+        }
+        data = static_cast<char*>(p);
+        map_len = len;
+    }
+
+    void unmap() {
+        if (data) {
+            ::munmap(data, map_len);
+            data = nullptr;
+            map_len = 0;
+        }
+    }
+
+    // Make [0, end) writable for a write starting at start, growing the
+    // mapping and the file in chunks
+    void reserve(int64_t start, int64_t end) {
+        if (end <= file_size) return;
+        if (end > static_cast<int64_t>(map_len)) {
+            int64_t want = std::max(end, static_cast<int64_t>(map_len) * 2);
+            map(static_cast<size_t>((want + MMAP_CHUNK - 1) / MMAP_CHUNK * MMAP_CHUNK));
+        }
+        // A record far past the end leaves a hole before its chunk, so the
+        // file stays sparse like it would with pwrite
+        int64_t alloc_start = std::max(file_size, start / MMAP_CHUNK * MMAP_CHUNK);
+        if (alloc_start > file_size) {
+            int rc;
+            do {
+                rc = ::ftruncate(fd, static_cast<off_t>(alloc_start));
+            } while (rc != 0 && errno == EINTR);
+            if (rc != 0) {
+                throw_io_error(errno);
+            }
+        }
+        // Allocate rather than ftruncate, so a full disk is reported here
+        // instead of as SIGBUS on a later store into the mapping
+        int err = ::posix_fallocate(fd, static_cast<off_t>(alloc_start),
+                                    static_cast<off_t>(map_len) - alloc_start);
+        if (err != 0) {
+            throw_io_error(err);
+        }
+        file_size = static_cast<int64_t>(map_len);
+    }
+
+    // Give back the preallocated tail
+    void trim() {
+        if (file_size > size) {
+            int rc;
+            do {
+                rc = ::ftruncate(fd, static_cast<off_t>(size));
+            } while (rc != 0 && errno == EINTR);
+            if (rc != 0) {
+                throw_io_error(errno);
+            }
+            file_size = size;
+        }
+    }
+
+    void sync_data() {
+        records_since_sync = 0;
+        count_sync(options.stats.get());
+        if (data && file_size > 0 &&
+            ::msync(data, static_cast<size_t>(file_size), MS_SYNC) != 0) {
+            throw_io_error(errno);
+        }
+    }
+
+    size_t read(char* dst, size_t n) {
+        size_t avail = cursor < size ? static_cast<size_t>(size - cursor) : 0;
+        n = std::min(n, avail);
+        if (n == 0) return 0;
+        std::memcpy(dst, data + cursor, n);
+        cursor += static_cast<int64_t>(n);
+        return n;
+    }
+
+    void write(const char* src, size_t n) {
+        if (n == 0) return;
+        reserve(cursor, cursor + static_cast<int64_t>(n));
+        std::memcpy(data + cursor, src, n);
+        cursor += static_cast<int64_t>(n);
+        size = std::max(size, cursor);
+        written = true;
+    }
+};
+
+MappedFileHandle::MappedFileHandle() : impl_(std::make_unique<Impl>()) {}
+
+MappedFileHandle::~MappedFileHandle() {
+    try {
+        close();
+    } catch (const RuntimeError&) {
+    }
+}
+
+bool MappedFileHandle::open_file(const std::string& filename,
+                                  int record_length,
+                                  const FileOptions& options) {
+    impl_->record_length = record_length;
+    impl_->options = options;
+
+    int fd;
+    do {
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    impl_->fd = fd;
+    impl_->size = impl_->file_size = static_cast<int64_t>(st.st_size);
+    impl_->cursor = 0;
+    if (impl_->size > 0) {
+        try {
+            impl_->map(static_cast<size_t>((impl_->size + MMAP_CHUNK - 1) / MMAP_CHUNK * MMAP_CHUNK));
+        } catch (const RuntimeError&) {
+            impl_->fd = -1;
+            ::close(fd);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MappedFileHandle::is_open() const {
+    return impl_->fd >= 0;
+}
+
+void MappedFileHandle::close() {
+    if (impl_->fd < 0) {
+        return;
+    }
+    int fd = impl_->fd;
+    try {
+        if (impl_->written && impl_->options.durability != FileOptions::Durability::NONE) {
+            impl_->sync_data();
+        }
+        impl_->trim();
+    } catch (const RuntimeError&) {
+        impl_->unmap();
+        impl_->fd = -1;
+        ::close(fd);
+        throw;
+    }
+    impl_->unmap();
+    impl_->fd = -1;
+    if (::close(fd) != 0 && errno != EINTR) {
+        throw_io_error(errno);
+    }
+}
+
+bool MappedFileHandle::read_line(std::string& line) {
+    line.clear();
+    if (impl_->cursor >= impl_->size) {
+        return false;
+    }
+    const char* start = impl_->data + impl_->cursor;
+    size_t avail = static_cast<size_t>(impl_->size - impl_->cursor);
+    const char* nl = static_cast<const char*>(std::memchr(start, '\n', avail));
+    if (nl) {
+        line.assign(start, nl);
+        impl_->cursor += (nl - start) + 1;
+    } else {
+        line.assign(start, avail);
+        impl_->cursor = impl_->size;
+    }
+    return true;
+}
+
+std::string_view MappedFileHandle::peek() {
+    // The whole rest of the file is already in memory
+    if (impl_->cursor >= impl_->size) {
+        return {};
+    }
+    return {impl_->data + impl_->cursor, static_cast<size_t>(impl_->size - impl_->cursor)};
+}
+
+void MappedFileHandle::consume(size_t n) {
+    impl_->cursor += static_cast<int64_t>(n);
+}
+
+void MappedFileHandle::write_line(const std::string& line) {
+    impl_->write(line.data(), line.size());
+    impl_->write("\n", 1);
+}
+
+void MappedFileHandle::write(const std::string& data) {
+    impl_->write(data.data(), data.size());
+}
+
+std::string MappedFileHandle::read_chars(int n) {
+    std::string result(static_cast<size_t>(std::max(n, 0)), '\0');
+    result.resize(impl_->read(&result[0], result.size()));
+    return result;
+}
+
+bool MappedFileHandle::eof() const {
+    return impl_->cursor >= impl_->size;
+}
+
+int64_t MappedFileHandle::position() const {
+    if (impl_->record_length > 0) {
+        return impl_->cursor / impl_->record_length;
+    }
+    return (impl_->cursor + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+}
+
+int MappedFileHandle::record_length() const {
+    return impl_->record_length;
+}
+
+int64_t MappedFileHandle::length() const {
+    return impl_->size;
+}
+
+void MappedFileHandle::seek_record(int64_t record, int record_length) {
+    impl_->cursor = (record - 1) * record_length;
+}
+
+int MappedFileHandle::read_raw(char* buffer, int size) {
+    return static_cast<int>(impl_->read(buffer, static_cast<size_t>(std::max(size, 0))));
+}
+
+void MappedFileHandle::write_raw(const char* buffer, int size) {
+    impl_->write(buffer, static_cast<size_t>(std::max(size, 0)));
+}
+
+void MappedFileHandle::flush() {
+    // Stores are already in the page cache; only the file length lags
+    impl_->trim();
+}
+
+int MappedFileHandle::read_record(int64_t record, char* buffer, int size) {
+    seek_record(record, size);
+    return read_raw(buffer, size);
+}
+
+void MappedFileHandle::write_record(int64_t record, const char* buffer, int size) {
+    seek_record(record, size);
+    write_raw(buffer, size);
+    if (impl_->options.durability == FileOptions::Durability::RECORDS &&
+        impl_->options.sync_every_records > 0 &&
+        ++impl_->records_since_sync >= impl_->options.sync_every_records) {
+        impl_->sync_data();
+    }
+}
+
+bool MappedFileHandle::lock_records(int64_t first, int64_t last) {
+    // The mapping shares the page cache with other processes' writes, so
+    // there is nothing to refresh
+    return set_record_lock(impl_->fd, F_WRLCK, first, last, impl_->record_length);
+}
+
+void MappedFileHandle::unlock_records(int64_t first, int64_t last) {
+    set_record_lock(impl_->fd, F_UNLCK, first, last, impl_->record_length);
 }
 
 // ============================================================================
 // NativeFileSystem Implementation
 // ============================================================================
 
+NativeFileSystem::NativeFileSystem(const FileOptions& options)
+    : options_(options),
+      pool_(std::make_shared<DescriptorPool>(
+          options.max_descriptors > 0 ? static_cast<size_t>(options.max_descriptors)
+                                      : DescriptorPool::default_capacity())) {}
+
 std::unique_ptr<FileHandle> NativeFileSystem::open(
     const std::string& filename,
     Mode mode,
-    int record_length) {
+    int record_length,
+    bool shared) {
+
+    FileOptions options = options_;
+    options.shared = shared;
+
+    if (DeviceFileHandle::device_name(filename)) {
+        auto device = std::make_unique<DeviceFileHandle>();
+        if (device->open_device(filename, mode, options)) {
+            return device;
+        }
+        return nullptr;
+    }
+
+    // A shared file's length changes under the mapping, so it isn't mapped
+    if (mode == Mode::RANDOM && options.mmap_random && !shared) {
+        auto mapped = std::make_unique<MappedFileHandle>();
+        if (mapped->open_file(filename, record_length, options)) {
+            return mapped;
+        }
+        // Not a mappable regular file; fall back to buffered I/O
+    }
+
+    if (mode != Mode::RANDOM && options.compressed_files &&
+        CompressedFileHandle::compressed_extension(filename)) {
+        auto compressed = std::make_unique<CompressedFileHandle>();
+        if (compressed->open_file(filename, mode, record_length, options)) {
+            return compressed;
+        }
+        return nullptr;
+    }
 
     auto handle = std::make_unique<NativeFileHandle>();
-    if (handle->open_file(filename, mode, record_length)) {
+    if (handle->open_file(filename, mode, record_length, options, pool_)) {
         return handle;
     }
     return nullptr;
 }
 
 bool NativeFileSystem::exists(const std::string& filename) {
-    std::ifstream f(filename);
-    return f.good();
+    struct stat st;
+    return ::stat(filename.c_str(), &st) == 0;
 }
 
 bool NativeFileSystem::remove(const std::string& filename) {
+    pool_->unlinking(filename);
     return std::remove(filename.c_str()) == 0;
 }
 
 bool NativeFileSystem::rename(const std::string& old_name, const std::string& new_name) {
-    return std::rename(old_name.c_str(), new_name.c_str()) == 0;
+    pool_->unlinking(new_name);
+    if (std::rename(old_name.c_str(), new_name.c_str()) != 0) {
+        return false;
+    }
+    pool_->renamed(new_name);
+    return true;
+}
+
+// ============================================================================
+// INPUT# item reader
+// ============================================================================
+
+// Longest unquoted string item
+constexpr size_t MAX_UNQUOTED_ITEM = 255;
+
+static inline bool is_input_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Bytes searched at a time for the end of an unquoted item
+constexpr size_t INPUT_SCAN_WINDOW = 64;
+
+// Offset of the first byte that ends an unquoted item (data.size() if none):
+// a comma or line end, or a blank after a number. Each delimiter is looked
+// for with memchr a window at a time, so a short item doesn't pay for
+// scanning to the end of a long line.
+static size_t find_item_end(std::string_view data, bool string_item) {
+    static constexpr char ENDS[] = {',', '\n', '\r', ' ', '\t'};
+    const size_t count = string_item ? 3 : 5;
+    for (size_t start = 0; start < data.size(); start += INPUT_SCAN_WINDOW) {
+        size_t end = std::min(data.size(), start + INPUT_SCAN_WINDOW);
+        bool found = false;
+        for (size_t i = 0; i < count; ++i) {
+            const void* p = std::memchr(data.data() + start, ENDS[i], end - start);
+            if (p) {
+                end = static_cast<size_t>(static_cast<const char*>(p) - data.data());
+                found = true;
+            }
+        }
+        if (found) {
+            return end;
+        }
+    }
+    return data.size();
+}
+
+bool read_input_item(FileHandle& file, bool string_item, std::string& scratch,
+                     std::string_view& item) {
+    // Skip leading blanks, over as many lines as it takes
+    std::string_view data = file.peek();
+    for (;;) {
+        if (data.empty()) {
+            return false;
+        }
+        size_t i = 0;
+        while (i < data.size() && is_input_blank(data[i])) ++i;
+        file.consume(i);
+        if (i < data.size()) {
+            data.remove_prefix(i);
+            break;
+        }
+        data = file.peek();
+    }
+
+    bool quoted = string_item && data[0] == '"';
+    if (quoted) {
+        file.consume(1);
+        data.remove_prefix(1);
+    }
+
+    // Collect the item: a view into the buffer when it ends inside the
+    // buffer, otherwise accumulated in scratch across refills
+    bool spilled = false;
+    scratch.clear();
+    for (;;) {
+        size_t end;
+        bool complete;
+        if (quoted) {
+            const char* q = static_cast<const char*>(std::memchr(data.data(), '"', data.size()));
+            end = q ? static_cast<size_t>(q - data.data()) : data.size();
+            complete = q != nullptr;
+        } else {
+            end = find_item_end(data, string_item);
+            complete = end < data.size();
+            if (string_item && scratch.size() + end >= MAX_UNQUOTED_ITEM) {
+                end = MAX_UNQUOTED_ITEM - scratch.size();
+                complete = true;
+            }
+        }
+        if (complete && !spilled) {
+            item = data.substr(0, end);
+        } else {
+            scratch.append(data.data(), end);
+            spilled = true;
+            item = scratch;
+        }
+        file.consume(end);
+        data.remove_prefix(end);
+        if (complete) break;
+        data = file.peek();
+        if (data.empty()) break;  // End of file ends the item
+    }
+
+    // Refilling the buffer would invalidate a view into it
+    auto refill = [&]() {
+        if (!spilled) {
+            scratch.assign(item.data(), item.size());
+            item = scratch;
+            spilled = true;
+        }
+        data = file.peek();
+    };
+
+    if (quoted && !data.empty()) {
+        file.consume(1);  // Closing quote
+        data.remove_prefix(1);
+    }
+
+    // Move past the delimiter: blanks (anything, after a quoted string),
+    // then one comma or line end
+    for (;;) {
+        if (data.empty()) {
+            refill();
+            if (data.empty()) break;
+        }
+        char c = data[0];
+        if (c == ',' || c == '\n') {
+            file.consume(1);
+            break;
+        }
+        if (c == '\r') {
+            file.consume(1);
+            data.remove_prefix(1);
+            if (data.empty()) refill();
+            if (!data.empty() && data[0] == '\n') file.consume(1);
+            break;
+        }
+        if (c != ' ' && c != '\t' && !quoted) break;  // Next item starts here
+        file.consume(1);
+        data.remove_prefix(1);
+    }
+
+    if (string_item && !quoted) {
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+            item.remove_suffix(1);
+        }
+    }
+    return true;
 }
 
 // ============================================================================
 // Factory function
 // ============================================================================
 
-std::unique_ptr<FileSystem> FileSystem::create_native() {
-    return std::make_unique<NativeFileSystem>();
+std::unique_ptr<FileSystem> FileSystem::create_native(const FileOptions& options) {
+    return std::make_unique<NativeFileSystem>(options);
 }
 
 } // namespace mbasic
@@ -0,0 +1,381 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Session Host Implementation - worker pool with work-stealing queues
+
+#include "mbasic/host.hpp"
+#include "mbasic/parser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mbasic {
+
+namespace {
+
+struct Session;
+
+// ============================================================================
+// SessionIO - a session's console
+// ============================================================================
+// Output collects until the host delivers it. The interpreter never asks
+// it for input: INPUT stops the session instead (see run_slice).
+
+class SessionIO : public IOHandler {
+public:
+    explicit SessionIO(Session& session) : session_(session) {}
+
+    void print(const std::string& text) override {
+        output_ += text;
+        column_ = advance_column(column_, text);
+    }
+
+    void flush() override;
+    std::string input(const std::string&) override { return {}; }
+    std::optional<char> inkey() override { return std::nullopt; }
+    int get_column() const override { return column_; }
+    void set_column(int col) override { column_ = col; }
+    int get_width() const override { return width_; }
+    void set_width(int w) override { width_ = w; }
+
+private:
+    Session& session_;
+    std::string output_;
+    int column_ = 0;
+    int width_ = 80;
+};
+
+struct Session {
+    SessionHost::SessionId id;
+    SessionHost::OutputCallback on_output;
+    SessionHost::ExitCallback on_exit;
+
+    Runtime runtime;
+    SessionIO io{*this};
+    Interpreter interp{runtime, &io};   // After everything it uses
+
+    std::atomic<bool> cancelled{false};
+
+    // Guards the input queue and parking
+    std::mutex mutex;
+    std::deque<std::string> input;
+    bool parked = false;
+
+    explicit Session(SessionHost::SessionId i) : id(i) {}
+};
+
+void SessionIO::flush() {
+    if (output_.empty()) return;
+    if (session_.on_output) {
+        session_.on_output(session_.id, output_);
+    }
+    output_.clear();
+}
+
+} // namespace
+
+// ============================================================================
+// SessionHost::Impl
+// ============================================================================
+// Every live session is in sessions and, at any moment, in exactly one of:
+// a worker's queue, running on a worker, or parked. Each worker's queue has
+// its own mutex: the owner takes sessions from the front and puts them back
+// at the end (round robin), thieves take from the end.
+
+struct SessionHost::Impl {
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Session*> queue;
+        std::thread thread;
+    };
+
+    HostOptions options;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    mutable std::mutex mutex;           // Guards sessions and live
+    std::condition_variable all_done;
+    std::unordered_map<SessionId, std::unique_ptr<Session>> sessions;
+    size_t live = 0;                    // Sessions not yet through finish()
+    SessionId next_id = 1;
+
+    // Idle workers sleep until a session is queued
+    std::mutex idle_mutex;
+    std::condition_variable work_ready;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+
+    std::atomic<size_t> next_worker{0}; // Round robin for sessions from outside
+
+    std::atomic<uint64_t> sessions_started{0};
+    std::atomic<uint64_t> sessions_finished{0};
+    std::atomic<uint64_t> slices{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> parks{0};
+
+    explicit Impl(HostOptions opts) : options(std::move(opts)) {
+        if (options.slice_statements == 0) {
+            options.slice_statements = 1;
+        }
+        int count = options.workers;
+        if (count <= 0) {
+            count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        }
+        for (int i = 0; i < count; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i]->thread = std::thread([this, i] { run_worker(i); });
+        }
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    // Queue a runnable session on a worker
+    void schedule(Session* session, size_t worker) {
+        {
+            std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+            workers[worker]->queue.push_back(session);
+        }
+        queued.fetch_add(1);
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        work_ready.notify_one();
+    }
+
+    void schedule(Session* session) {
+        schedule(session, next_worker.fetch_add(1) % workers.size());
+    }
+
+    Session* take(size_t self) {
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.queue.empty()) {
+                Session* session = own.queue.front();
+                own.queue.pop_front();
+                return session;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.queue.empty()) {
+                Session* session = victim.queue.back();
+                victim.queue.pop_back();
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return session;
+            }
+        }
+        return nullptr;
+    }
+
+    void run_worker(size_t self) {
+        for (;;) {
+            Session* session = take(self);
+            if (!session) {
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                work_ready.wait(lock, [&] { return queued.load() > 0 || stopping; });
+                if (stopping && queued.load() == 0) return;
+                continue;
+            }
+            queued.fetch_sub(1);
+            run_slice(*session, self);
+        }
+    }
+
+    void run_slice(Session& session, size_t self) {
+        slices.fetch_add(1, std::memory_order_relaxed);
+        bool running = true;
+        for (size_t n = 0; n < options.slice_statements && running; ++n) {
+            if (session.cancelled.load()) {
+                session.runtime.pc = PC::halted(StopReason::BREAK);
+                running = false;
+                break;
+            }
+            running = session.interp.tick();
+        }
+        if (running) {
+            session.io.flush();
+            schedule(&session, self);
+            return;
+        }
+
+        if (session.runtime.pc.reason == StopReason::INPUT && !session.cancelled.load()) {
+            session.io.flush();
+            std::unique_lock<std::mutex> lock(session.mutex);
+            // cancel() may have come after the prompt went out; checked
+            // under the lock so it either sees the session parked or is
+            // seen here
+            if (session.cancelled.load()) {
+                lock.unlock();
+                finish(session);
+                return;
+            }
+            if (session.input.empty()) {
+                session.parked = true;
+                parks.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            lock.unlock();
+            resume(session);
+            schedule(&session, self);
+            return;
+        }
+        finish(session);
+    }
+
+    // Hand queued input to a session stopped for INPUT
+    void resume(Session& session) {
+        std::string line;
+        {
+            std::lock_guard<std::mutex> lock(session.mutex);
+            line = std::move(session.input.front());
+            session.input.pop_front();
+        }
+        session.interp.provide_input(line);
+    }
+
+    void finish(Session& session) {
+        session.interp.finish();
+        SessionResult result;
+        result.reason = session.cancelled.load() ? StopReason::BREAK : session.runtime.pc.reason;
+        result.error = session.interp.state().error;
+
+        // provide_input() and cancel() no longer find it once it has exited
+        std::unique_ptr<Session> owned;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = sessions.find(session.id);
+            owned = std::move(it->second);
+            sessions.erase(it);
+        }
+        if (owned->on_exit) {
+            owned->on_exit(owned->id, result);
+        }
+        owned.reset();
+        sessions_finished.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--live == 0) {
+            all_done.notify_all();
+        }
+    }
+
+    // Make a parked session runnable; call with mutex held
+    void unpark(Session& session) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(session.mutex);
+            wake = session.parked;
+            session.parked = false;
+        }
+        if (wake) {
+            if (!session.cancelled.load()) {
+                resume(session);
+            }
+            schedule(&session);
+        }
+    }
+};
+
+SessionHost::SessionHost(HostOptions options)
+    : impl_(std::make_unique<Impl>(std::move(options))) {}
+
+SessionHost::~SessionHost() {
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        for (auto& [id, session] : impl_->sessions) {
+            session->cancelled.store(true);
+            impl_->unpark(*session);
+        }
+    }
+    wait_idle();
+}
+
+SessionHost::SessionId SessionHost::start(const std::string& source, OutputCallback on_output,
+                                          ExitCallback on_exit) {
+    return start(CompiledProgram::compile(parse(source)), std::move(on_output), std::move(on_exit));
+}
+
+SessionHost::SessionId SessionHost::start(std::shared_ptr<const CompiledProgram> program,
+                                          OutputCallback on_output, ExitCallback on_exit) {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    SessionId id = impl_->next_id++;
+    auto session = std::make_unique<Session>(id);
+    session->on_output = std::move(on_output);
+    session->on_exit = std::move(on_exit);
+    if (impl_->options.filesystem) {
+        session->runtime.filesystem = impl_->options.filesystem;
+    }
+    session->runtime.max_files = impl_->options.max_files;
+    session->runtime.load(std::move(program));
+
+    Session* runnable = session.get();
+    impl_->sessions.emplace(id, std::move(session));
+    impl_->live++;
+    impl_->sessions_started.fetch_add(1, std::memory_order_relaxed);
+    impl_->schedule(runnable);
+    return id;
+}
+
+bool SessionHost::provide_input(SessionId id, std::string line) {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    auto it = impl_->sessions.find(id);
+    if (it == impl_->sessions.end()) {
+        return false;
+    }
+    Session& session = *it->second;
+    {
+        std::lock_guard<std::mutex> input_lock(session.mutex);
+        session.input.push_back(std::move(line));
+    }
+    impl_->unpark(session);
+    return true;
+}
+
+bool SessionHost::cancel(SessionId id) {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    auto it = impl_->sessions.find(id);
+    if (it == impl_->sessions.end()) {
+        return false;
+    }
+    Session& session = *it->second;
+    session.cancelled.store(true);
+    impl_->unpark(session);
+    return true;
+}
+
+void SessionHost::wait_idle() {
+    std::unique_lock<std::mutex> lock(impl_->mutex);
+    impl_->all_done.wait(lock, [&] { return impl_->live == 0; });
+}
+
+size_t SessionHost::session_count() const {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    return impl_->live;
+}
+
+HostStats SessionHost::stats() const {
+    HostStats stats;
+    stats.sessions_started = impl_->sessions_started.load();
+    stats.sessions_finished = impl_->sessions_finished.load();
+    stats.slices = impl_->slices.load();
+    stats.steals = impl_->steals.load();
+    stats.parks = impl_->parks.load();
+    return stats;
+}
+
+} // namespace mbasic
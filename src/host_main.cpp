@@ -0,0 +1,248 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// mbasic-host - serve one BASIC program to many clients from one process.
+// Every TCP connection to the port runs the program as a new session of a
+// SessionHost; lines the client sends are the program's INPUT, and the
+// connection closes when the program ends.
+
+#include "mbasic/host.hpp"
+#include "mbasic/error.hpp"
+#include "mbasic/parser.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <csignal>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Bytes read from a client at a time
+constexpr size_t READ_CHUNK = 4096;
+
+// Write end of the pipe that wakes the poll loop (output, exits, signals)
+int g_wake_fd = -1;
+volatile std::sig_atomic_t g_stop = 0;
+
+struct Client {
+    int fd = -1;
+    mbasic::SessionHost::SessionId id = 0;
+    std::string inbox;          // Partial input line
+    bool peer_closed = false;
+
+    // Written by the session's callbacks on worker threads
+    std::mutex mutex;
+    std::string outbox;
+    bool done = false;
+};
+
+void wake() {
+    char c = 0;
+    [[maybe_unused]] ssize_t n = ::write(g_wake_fd, &c, 1);
+}
+
+void on_signal(int) {
+    g_stop = 1;
+    wake();
+}
+
+int listen_on(int port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void usage() {
+    std::cout << "Usage: mbasic-host [OPTIONS] program.bas\n\n";
+    std::cout << "Run program.bas once for every connection to 127.0.0.1:PORT.\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --port=N        Port to listen on (default 6502)\n";
+    std::cout << "  --workers=N     Worker threads (default one per CPU)\n";
+    std::cout << "  --slice=N       Statements a session runs before others get a turn\n";
+    std::cout << "                  (default 10000)\n";
+    std::cout << "  --files=N       Allow file numbers 1 to N in each session (default 15)\n";
+    std::cout << "  --help, -h      Show this help\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int port = 6502;
+    mbasic::HostOptions options;
+
+    int file_arg = 1;
+    while (file_arg < argc && argv[file_arg][0] == '-') {
+        std::string flag = argv[file_arg];
+        if (flag.rfind("--port=", 0) == 0) {
+            port = std::atoi(flag.c_str() + 7);
+        } else if (flag.rfind("--workers=", 0) == 0) {
+            options.workers = std::atoi(flag.c_str() + 10);
+        } else if (flag.rfind("--slice=", 0) == 0) {
+            options.slice_statements = static_cast<size_t>(std::atol(flag.c_str() + 8));
+        } else if (flag.rfind("--files=", 0) == 0) {
+            options.max_files = std::atoi(flag.c_str() + 8);
+        } else if (flag == "--help" || flag == "-h") {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            return 1;
+        }
+        file_arg++;
+    }
+    if (file_arg >= argc) {
+        usage();
+        return 1;
+    }
+
+    std::string filename = argv[file_arg];
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Error: Could not open file: " << filename << "\n";
+        return 1;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::shared_ptr<const mbasic::CompiledProgram> program;
+    try {
+        // Parsed once; every session runs the same copy
+        program = mbasic::CompiledProgram::compile(mbasic::parse(buffer.str()));
+    } catch (const mbasic::MBasicError& e) {
+        std::cerr << "?" << e.what() << "\n";
+        return 1;
+    }
+
+    int wake_pipe[2];
+    if (::pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        std::cerr << "Error: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    g_wake_fd = wake_pipe[1];
+    int listener = listen_on(port);
+    if (listener < 0) {
+        std::cerr << "Error: Could not listen on port " << port << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    mbasic::SessionHost host(options);
+    std::vector<std::shared_ptr<Client>> clients;
+
+    while (!g_stop) {
+        std::vector<pollfd> fds;
+        fds.push_back({wake_pipe[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        for (auto& client : clients) {
+            short events = client->peer_closed ? 0 : POLLIN;
+            std::lock_guard<std::mutex> lock(client->mutex);
+            if (!client->outbox.empty()) events |= POLLOUT;
+            fds.push_back({client->fd, events, 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: poll: " << std::strerror(errno) << "\n";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drain[256];
+            while (::read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        for (size_t i = 0; i < clients.size(); ++i) {
+            Client& client = *clients[i];
+            short revents = fds[i + 2].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char data[READ_CHUNK];
+                ssize_t n = ::read(client.fd, data, sizeof(data));
+                if (n > 0) {
+                    client.inbox.append(data, static_cast<size_t>(n));
+                    size_t nl;
+                    while ((nl = client.inbox.find('\n')) != std::string::npos) {
+                        std::string line = client.inbox.substr(0, nl);
+                        if (!line.empty() && line.back() == '\r') line.pop_back();
+                        client.inbox.erase(0, nl + 1);
+                        host.provide_input(client.id, std::move(line));
+                    }
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    client.peer_closed = true;
+                    host.cancel(client.id);
+                }
+            }
+            if (revents & POLLOUT) {
+                std::lock_guard<std::mutex> lock(client.mutex);
+                ssize_t n = ::send(client.fd, client.outbox.data(), client.outbox.size(), MSG_NOSIGNAL);
+                if (n > 0) {
+                    client.outbox.erase(0, static_cast<size_t>(n));
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    client.outbox.clear();
+                    client.peer_closed = true;
+                }
+            }
+        }
+
+        // Close connections whose program has ended and whose output is out
+        for (size_t i = clients.size(); i-- > 0;) {
+            Client& client = *clients[i];
+            std::lock_guard<std::mutex> lock(client.mutex);
+            if (client.done && (client.outbox.empty() || client.peer_closed)) {
+                ::close(client.fd);
+                clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            for (;;) {
+                int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) break;
+                auto client = std::make_shared<Client>();
+                client->fd = fd;
+                auto on_output = [client](mbasic::SessionHost::SessionId, std::string_view text) {
+                    std::lock_guard<std::mutex> lock(client->mutex);
+                    client->outbox += text;
+                    wake();
+                };
+                auto on_exit = [client](mbasic::SessionHost::SessionId,
+                                        const mbasic::SessionResult& result) {
+                    std::lock_guard<std::mutex> lock(client->mutex);
+                    if (result.error) {
+                        client->outbox += "?" + result.error->message + " in " +
+                                          std::to_string(result.error->pc.line) + "\n";
+                    }
+                    client->done = true;
+                    wake();
+                };
+                client->id = host.start(program, on_output, on_exit);
+                clients.push_back(std::move(client));
+            }
+        }
+    }
+
+    // The host cancels the sessions still running as it goes
+    return 0;
+}
@@ -14,6 +14,15 @@
 
 namespace mbasic {
 
+// Thrown by console input with nothing to read; tick() stops for input and
+// runs the statement again when input comes, carrying on inside an inline
+// IF where it stopped (see exec_if)
+struct InputPending {};
+
+// Statements between checks for file output whose flush interval has
+// passed (a power of two)
+constexpr size_t FLUSH_CHECK_STATEMENTS = 1024;
+
 // Helper for floating-point comparison with tolerance
 // Uses relative epsilon for large values, absolute epsilon for small values
 static bool float_equal(double a, double b) {
@@ -44,13 +53,37 @@ Interpreter::Interpreter(Runtime& runtime, IOHandler* io)
         io_ = io_owned_.get();
     }
 
-    // Seed random number generator
-    std::srand(static_cast<unsigned>(std::time(nullptr)));
 }
 
 void Interpreter::run() {
-    while (tick()) {
-        // Continue execution
+    for (;;) {
+        while (tick()) {
+            // Continue execution
+        }
+        // With no host to provide input, read it from the console
+        if (runtime_.pc.reason != StopReason::INPUT) {
+            break;
+        }
+        if (state_.input_chars > 0) {
+            provide_input(io_->input_chars(state_.input_chars));
+        } else {
+            provide_input(io_->input(""));
+        }
+    }
+    finish();
+}
+
+void Interpreter::finish() {
+    // Console, printer and file output are buffered; don't leave them
+    // buffered once the program stops, whatever the reason
+    io_->flush();
+    try {
+        printer().flush();
+        runtime_.flush_files();
+    } catch (const RuntimeError& e) {
+        if (!state_.error) {
+            state_.error = {e.error_code, runtime_.pc, e.what()};
+        }
     }
 }
 
@@ -82,22 +115,42 @@ bool Interpreter::tick() {
     state_.skip_next_breakpoint = false;
 
     // Get current statement
-    Stmt* stmt = runtime_.statements.get(runtime_.pc);
+    replaced_program_.reset();
+    const Stmt* stmt = runtime_.program->get(runtime_.pc);
     if (!stmt) {
         runtime_.pc = PC::halted();
         return false;
     }
 
-    // Trace output
-    if (runtime_.trace_on) {
+    // Trace output, once for a statement that stopped for input
+    if (runtime_.trace_on && !state_.input_prompt) {
         io_->print("[" + std::to_string(runtime_.pc.line) + "]\n");
     }
 
     // Execute statement
     try {
-        execute(*stmt);
+        try {
+            execute(*stmt);
+        } catch (const InputPending&) {
+            // Nothing buffered waits on the user (errors are this statement's)
+            runtime_.flush_due_files(true);
+            throw;
+        }
         state_.statements_executed++;
+        end_input();
+        if ((state_.statements_executed & (FLUSH_CHECK_STATEMENTS - 1)) == 0) {
+            runtime_.flush_due_files(false);
+        }
+    } catch (const InputPending&) {
+        // Run the statement again when input comes, without stopping at
+        // its breakpoint a second time
+        runtime_.pc.reason = StopReason::INPUT;
+        state_.skip_next_breakpoint = true;
+        input_replay_pos_ = 0;
+        input_resume_pos_ = 0;
+        return false;
     } catch (const RuntimeError& e) {
+        end_input();
         // Handle error
         if (runtime_.error_handler_line) {
             // Set ERR and ERL
@@ -111,10 +164,10 @@ bool Interpreter::tick() {
             if (runtime_.error_handler_is_gosub) {
                 StackEntry entry;
                 entry.type = StackEntry::Type::GOSUB;
-                entry.return_pc = runtime_.statements.next(runtime_.pc);
+                entry.return_pc = runtime_.program->next(runtime_.pc);
                 runtime_.exec_stack.push_back(entry);
             }
-            runtime_.next_pc = runtime_.statements.find_line(*runtime_.error_handler_line);
+            runtime_.next_pc = runtime_.program->find_line(*runtime_.error_handler_line);
         } else {
             state_.error = {e.error_code, runtime_.pc, e.what()};
             runtime_.pc.reason = StopReason::ERROR;
@@ -133,18 +186,26 @@ void Interpreter::advance_pc() {
         runtime_.pc = *runtime_.next_pc;
         runtime_.next_pc = std::nullopt;
     } else if (runtime_.pc.is_running()) {
-        runtime_.pc = runtime_.statements.next(runtime_.pc);
+        runtime_.pc = runtime_.program->next(runtime_.pc);
     }
 }
 
 void Interpreter::jump_to(int line) {
-    PC target = runtime_.statements.find_line(line);
-    if (!runtime_.statements.valid(target)) {
+    PC target = runtime_.program->find_line(line);
+    if (!runtime_.program->valid(target)) {
         raise_error(ErrorCode::UNDEFINED_LINE, "Undefined line number: " + std::to_string(line));
     }
     runtime_.next_pc = target;
 }
 
+FileHandle& Interpreter::get_file(int filenum) {
+    auto it = runtime_.files.find(filenum);
+    if (it == runtime_.files.end() || !it->second->is_open()) {
+        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
+    }
+    return *it->second;
+}
+
 void Interpreter::stop() {
     runtime_.pc = PC::halted();
 }
@@ -160,7 +221,7 @@ void Interpreter::raise_error(int code, const std::string& msg) {
 // Statement Execution
 // ============================================================================
 
-void Interpreter::execute(Stmt& stmt) {
+void Interpreter::execute(const Stmt& stmt) {
     std::visit([this](auto& s) {
         using T = std::decay_t<decltype(s)>;
         if constexpr (std::is_same_v<T, std::unique_ptr<PrintStmt>>) exec_print(*s);
@@ -209,6 +270,8 @@ void Interpreter::execute(Stmt& stmt) {
         else if constexpr (std::is_same_v<T, std::unique_ptr<PutStmt>>) exec_put(*s);
         else if constexpr (std::is_same_v<T, std::unique_ptr<LsetStmt>>) exec_lset(*s);
         else if constexpr (std::is_same_v<T, std::unique_ptr<RsetStmt>>) exec_rset(*s);
+        else if constexpr (std::is_same_v<T, std::unique_ptr<LockStmt>>) exec_lock(*s);
+        else if constexpr (std::is_same_v<T, std::unique_ptr<UnlockStmt>>) exec_unlock(*s);
         else if constexpr (std::is_same_v<T, std::unique_ptr<WriteStmt>>) exec_write(*s);
         else if constexpr (std::is_same_v<T, std::unique_ptr<ChainStmt>>) exec_chain(*s);
         else if constexpr (std::is_same_v<T, std::unique_ptr<CommonStmt>>) exec_common(*s);
@@ -223,66 +286,68 @@ void Interpreter::execute(Stmt& stmt) {
     }, stmt);
 }
 
-void Interpreter::exec_print(PrintStmt& s) {
-    std::string output;
-
-    for (size_t i = 0; i < s.expressions.size(); ++i) {
-        Value val = eval(s.expressions[i]);
-
-        // Check for TAB/SPC markers
-        if (is_numeric(val)) {
-            // Could be TAB or SPC result
-            output += to_string(val);
-        } else {
-            output += std::get<std::string>(val);
-        }
+void Interpreter::format_print_list(const std::vector<Expr>& expressions,
+                                    const std::vector<char>& separators, int column,
+                                    PrintTarget target) {
+    std::string& out = print_buffer_;
+    out.clear();
+    print_column_ = column;
+    print_target_ = target;
+    struct Reset {
+        int& column;
+        ~Reset() { column = -1; }
+    } reset{print_column_};
+
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        // TAB() in the item sees the column reached so far
+        size_t start = out.size();
+        append_value(out, eval(expressions[i]));
+        print_column_ = advance_column(print_column_, std::string_view(out).substr(start));
 
         // Handle separator
-        if (i < s.separators.size()) {
-            char sep = s.separators[i];
+        if (i < separators.size()) {
+            char sep = separators[i];
             if (sep == ',') {
                 // Tab to next zone (14 columns)
-                int col = io_->get_column() + static_cast<int>(output.length());
-                int next_zone = ((col / 14) + 1) * 14;
-                while (col < next_zone) {
-                    output += ' ';
-                    col++;
-                }
+                int next_zone = (print_column_ / PRINT_ZONE_WIDTH + 1) * PRINT_ZONE_WIDTH;
+                out.append(static_cast<size_t>(next_zone - print_column_), ' ');
+                print_column_ = next_zone;
             } else if (sep == ';') {
                 // No spacing
             } else if (sep == ' ') {
                 // Implicit separator - add a space
-                output += ' ';
+                out += ' ';
+                ++print_column_;
             } else if (sep == '\0') {
                 // Newline
-                output += '\n';
+                out += '\n';
+                print_column_ = 0;
             }
         }
     }
 
     // If no expressions or last separator indicates newline
-    if (s.expressions.empty() ||
-        (s.separators.size() == s.expressions.size() && s.separators.back() == '\0')) {
-        if (output.empty() || output.back() != '\n') {
-            output += '\n';
+    if (expressions.empty() ||
+        (separators.size() == expressions.size() && separators.back() == '\0')) {
+        if (out.empty() || out.back() != '\n') {
+            out += '\n';
         }
     }
+}
+
+void Interpreter::exec_print(const PrintStmt& s) {
+    format_print_list(s.expressions, s.separators, io_->get_column(),
+                      s.file_number ? PrintTarget::FILE : PrintTarget::CONSOLE);
 
     // Output to file or console
     if (s.file_number) {
-        int filenum = static_cast<int>(to_number(eval(*s.file_number)));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        it->second << output;
-        it->second.flush();
+        get_file(static_cast<int>(to_number(eval(*s.file_number)))).write(print_buffer_);
     } else {
-        io_->print(output);
+        io_->print(print_buffer_);
     }
 }
 
-void Interpreter::exec_print_using(PrintUsingStmt& s) {
+void Interpreter::exec_print_using(const PrintUsingStmt& s) {
     std::string format = std::get<std::string>(eval(s.format_string));
     std::string output;
 
@@ -488,31 +553,31 @@ void Interpreter::exec_print_using(PrintUsingStmt& s) {
 
     // Output to file or console
     if (s.file_number) {
-        int filenum = static_cast<int>(to_number(eval(*s.file_number)));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        it->second << output;
-        it->second.flush();
+        get_file(static_cast<int>(to_number(eval(*s.file_number)))).write(output);
     } else {
         io_->print(output);
     }
 }
 
-void Interpreter::exec_lprint(LprintStmt& s) {
-    // Same as PRINT for now
-    for (size_t i = 0; i < s.expressions.size(); ++i) {
-        io_->print(to_string(eval(s.expressions[i])));
-        if (i < s.separators.size() && s.separators[i] == ',') {
-            io_->print("\t");
-        }
+Printer& Interpreter::printer() {
+    if (runtime_.printer) {
+        return *runtime_.printer;
     }
-    io_->print("\n");
+    if (!console_printer_) {
+        console_printer_ = std::make_unique<ConsolePrinter>(*io_);
+    }
+    return *console_printer_;
+}
+
+void Interpreter::exec_lprint(const LprintStmt& s) {
+    // Same as PRINT, from the printer's own column
+    Printer& lpt = printer();
+    format_print_list(s.expressions, s.separators, lpt.get_column(), PrintTarget::PRINTER);
+    lpt.print(print_buffer_);
 }
 
-void Interpreter::exec_lprint_using(LprintUsingStmt& s) {
-    // Same formatting as PRINT USING, output to printer (console for now)
+void Interpreter::exec_lprint_using(const LprintUsingStmt& s) {
+    // Same formatting as PRINT USING, output to the printer
     std::string format = std::get<std::string>(eval(s.format_string));
     std::string output;
 
@@ -694,33 +759,62 @@ void Interpreter::exec_lprint_using(LprintUsingStmt& s) {
     }
 
     output += '\n';
-    io_->print(output);
+    printer().print(output);
 }
 
-void Interpreter::exec_input(InputStmt& s) {
+// Numeric INPUT# item; text that isn't a number reads as 0
+static double parse_input_number(std::string_view text) {
+    char buf[64];
+    if (text.empty() || text.size() >= sizeof(buf)) {
+        return 0.0;
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        // Double precision exponent: 1.5D3
+        buf[i] = (text[i] == 'D' || text[i] == 'd') ? 'E' : text[i];
+    }
+    buf[text.size()] = '\0';
+    return std::strtod(buf, nullptr);
+}
+
+void Interpreter::exec_input(const InputStmt& s) {
     std::string line;
 
     // Check if reading from file
     if (s.file_number) {
-        int filenum = static_cast<int>(to_number(eval(*s.file_number)));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        if (!std::getline(it->second, line)) {
-            raise_error(ErrorCode::INPUT_PAST_END, "Input past end of file");
+        FileHandle& file = get_file(static_cast<int>(to_number(eval(*s.file_number))));
+        for (const auto& var : s.variables) {
+            VarType type = std::visit([](const auto& v) {
+                return v.type;
+            }, var);
+
+            std::string_view item;
+            if (!read_input_item(file, type == VarType::STRING, input_scratch_, item)) {
+                raise_error(ErrorCode::INPUT_PAST_END, "Input past end of file");
+            }
+            if (type == VarType::STRING) {
+                set_lvalue(var, std::string(item));
+            } else {
+                set_lvalue(var, coerce_to(parse_input_number(item), type));
+            }
         }
-    } else {
-        // Console input
-        std::string prompt;
+        return;
+    }
+
+    // Console input; the prompt is only shown the first time through
+    std::string prompt;
+    if (!state_.input_prompt) {
         if (s.prompt) {
             prompt = std::get<std::string>(eval(*s.prompt));
         }
         if (!s.suppress_question) {
             prompt += "? ";
         }
-        line = io_->input(prompt);
+        state_.pending_vars.clear();
+        for (const auto& var : s.variables) {
+            state_.pending_vars.push_back(std::visit([](const auto& v) { return v.name; }, var));
+        }
     }
+    line = take_input_line(prompt);
 
     // Parse input values
     std::vector<std::string> values;
@@ -761,64 +855,78 @@ void Interpreter::exec_input(InputStmt& s) {
     }
 }
 
-void Interpreter::exec_line_input(LineInputStmt& s) {
+void Interpreter::exec_line_input(const LineInputStmt& s) {
     std::string line;
 
     // Check if reading from file
     if (s.file_number) {
-        int filenum = static_cast<int>(to_number(eval(*s.file_number)));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        if (!std::getline(it->second, line)) {
+        FileHandle& file = get_file(static_cast<int>(to_number(eval(*s.file_number))));
+        if (!file.read_line(line)) {
             raise_error(ErrorCode::INPUT_PAST_END, "Input past end of file");
         }
     } else {
         // Console input
         std::string prompt;
-        if (s.prompt) {
-            prompt = std::get<std::string>(eval(*s.prompt));
+        if (!state_.input_prompt) {
+            if (s.prompt) {
+                prompt = std::get<std::string>(eval(*s.prompt));
+            }
+            state_.pending_vars = {s.variable.name};
         }
-        line = io_->input(prompt);
+        line = take_input_line(prompt);
     }
 
     runtime_.set_variable(s.variable.name, line);
 }
 
-void Interpreter::exec_let(LetStmt& s) {
+void Interpreter::exec_let(const LetStmt& s) {
     Value val = eval(s.expression);
     set_lvalue(s.target, val);
 }
 
-void Interpreter::exec_if(IfStmt& s) {
-    Value cond = eval(s.condition);
-
-    if (to_bool(cond)) {
-        // THEN branch
-        if (s.then_line) {
-            jump_to(*s.then_line);
-        } else if (!s.then_stmts.empty()) {
-            // Execute inline statements
-            for (auto& stmt : s.then_stmts) {
-                execute(stmt);
-                if (!runtime_.pc.is_running()) return;
-            }
+void Interpreter::exec_if(const IfStmt& s) {
+    // Run again after stopping for input inside the branch: carry on at the
+    // inline statement that stopped, without testing the condition again
+    bool then_branch;
+    size_t first = 0;
+    if (input_resume_pos_ < input_resume_.size()) {
+        then_branch = input_resume_[input_resume_pos_].then_branch;
+        first = input_resume_[input_resume_pos_].index;
+        if (++input_resume_pos_ == input_resume_.size()) {
+            input_resume_.clear();
+            input_resume_pos_ = 0;
         }
     } else {
-        // ELSE branch
-        if (s.else_line) {
-            jump_to(*s.else_line);
-        } else if (!s.else_stmts.empty()) {
-            for (auto& stmt : s.else_stmts) {
-                execute(stmt);
-                if (!runtime_.pc.is_running()) return;
+        then_branch = to_bool(eval(s.condition));
+    }
+
+    const std::optional<int>& target = then_branch ? s.then_line : s.else_line;
+    if (target) {
+        jump_to(*target);
+        return;
+    }
+
+    // Execute inline statements
+    const std::vector<Stmt>& stmts = then_branch ? s.then_stmts : s.else_stmts;
+    for (size_t i = first; i < stmts.size(); ++i) {
+        size_t replay_mark = input_replay_pos_;
+        try {
+            execute(stmts[i]);
+        } catch (const InputPending&) {
+            // Innermost IF: call results from before this statement
+            // belong to what won't run again
+            if (input_resume_.empty()) {
+                input_replay_.erase(input_replay_.begin(),
+                                    input_replay_.begin() + static_cast<std::ptrdiff_t>(replay_mark));
             }
+            input_resume_.insert(input_resume_.begin(), {then_branch, i});
+            throw;
         }
+        if (!runtime_.pc.is_running()) return;
     }
 }
 
-void Interpreter::exec_for(ForStmt& s) {
+void Interpreter::exec_for(const ForStmt& s) {
     // Evaluate start, end, step
     double start_val = to_number(eval(s.start_expr));
     double end_val = to_number(eval(s.end_expr));
@@ -842,11 +950,11 @@ void Interpreter::exec_for(ForStmt& s) {
         int depth = 1;
         std::string for_var_name = s.variable.name;
         while (depth > 0) {
-            scan = runtime_.statements.next(scan);
-            if (!runtime_.statements.valid(scan)) {
+            scan = runtime_.program->next(scan);
+            if (!runtime_.program->valid(scan)) {
                 raise_error(ErrorCode::FOR_WITHOUT_NEXT, "FOR without NEXT");
             }
-            Stmt* stmt = runtime_.statements.get(scan);
+            const Stmt* stmt = runtime_.program->get(scan);
             std::visit([&](auto& ptr) {
                 using T = std::decay_t<decltype(ptr)>;
                 if constexpr (std::is_same_v<T, std::unique_ptr<ForStmt>>) {
@@ -867,13 +975,13 @@ void Interpreter::exec_for(ForStmt& s) {
             }, *stmt);
         }
         // Jump past the NEXT
-        runtime_.next_pc = runtime_.statements.next(scan);
+        runtime_.next_pc = runtime_.program->next(scan);
         // Remove the FOR state since we never entered
         runtime_.for_states.erase(s.variable.name);
     }
 }
 
-void Interpreter::exec_next(NextStmt& s) {
+void Interpreter::exec_next(const NextStmt& s) {
     // Get variable name(s)
     std::vector<std::string> var_names;
     if (s.variables.empty()) {
@@ -915,12 +1023,12 @@ void Interpreter::exec_next(NextStmt& s) {
             runtime_.for_states.erase(it);
         } else {
             // Continue loop - jump back to statement after FOR
-            runtime_.next_pc = runtime_.statements.next(state.resume_pc);
+            runtime_.next_pc = runtime_.program->next(state.resume_pc);
         }
     }
 }
 
-void Interpreter::exec_while(WhileStmt& s) {
+void Interpreter::exec_while(const WhileStmt& s) {
     Value cond = eval(s.condition);
 
     if (to_bool(cond)) {
@@ -936,22 +1044,22 @@ void Interpreter::exec_while(WhileStmt& s) {
         PC scan = runtime_.pc;
         int depth = 1;
         while (depth > 0) {
-            scan = runtime_.statements.next(scan);
-            if (!runtime_.statements.valid(scan)) {
+            scan = runtime_.program->next(scan);
+            if (!runtime_.program->valid(scan)) {
                 raise_error(ErrorCode::WHILE_WITHOUT_WEND, "WHILE without WEND");
             }
-            Stmt* stmt = runtime_.statements.get(scan);
+            const Stmt* stmt = runtime_.program->get(scan);
             if (std::get_if<std::unique_ptr<WhileStmt>>(stmt)) {
                 depth++;
             } else if (std::get_if<std::unique_ptr<WendStmt>>(stmt)) {
                 depth--;
             }
         }
-        runtime_.next_pc = runtime_.statements.next(scan);
+        runtime_.next_pc = runtime_.program->next(scan);
     }
 }
 
-void Interpreter::exec_wend([[maybe_unused]] WendStmt& s) {
+void Interpreter::exec_wend([[maybe_unused]] const WendStmt& s) {
     // Find matching WHILE on stack
     for (auto it = runtime_.exec_stack.rbegin(); it != runtime_.exec_stack.rend(); ++it) {
         if (it->type == StackEntry::Type::WHILE) {
@@ -965,25 +1073,25 @@ void Interpreter::exec_wend([[maybe_unused]] WendStmt& s) {
     raise_error(ErrorCode::WEND_WITHOUT_WHILE, "WEND without WHILE");
 }
 
-void Interpreter::exec_goto(GotoStmt& s) {
+void Interpreter::exec_goto(const GotoStmt& s) {
     jump_to(s.target_line);
 }
 
-void Interpreter::exec_gosub(GosubStmt& s) {
+void Interpreter::exec_gosub(const GosubStmt& s) {
     StackEntry entry;
     entry.type = StackEntry::Type::GOSUB;
-    entry.return_pc = runtime_.statements.next(runtime_.pc);
+    entry.return_pc = runtime_.program->next(runtime_.pc);
     runtime_.exec_stack.push_back(entry);
 
     jump_to(s.target_line);
 }
 
-void Interpreter::exec_return(ReturnStmt& s) {
+void Interpreter::exec_return(const ReturnStmt& s) {
     // Find GOSUB on stack
     for (auto it = runtime_.exec_stack.rbegin(); it != runtime_.exec_stack.rend(); ++it) {
         if (it->type == StackEntry::Type::GOSUB) {
             if (s.target_line) {
-                runtime_.next_pc = runtime_.statements.find_line(*s.target_line);
+                runtime_.next_pc = runtime_.program->find_line(*s.target_line);
             } else {
                 runtime_.next_pc = it->return_pc;
             }
@@ -995,7 +1103,7 @@ void Interpreter::exec_return(ReturnStmt& s) {
     raise_error(ErrorCode::RETURN_WITHOUT_GOSUB, "RETURN without GOSUB");
 }
 
-void Interpreter::exec_on_goto(OnGotoStmt& s) {
+void Interpreter::exec_on_goto(const OnGotoStmt& s) {
     int idx = static_cast<int>(to_number(eval(s.selector)));
     if (idx >= 1 && idx <= static_cast<int>(s.targets.size())) {
         jump_to(s.targets[idx - 1]);
@@ -1003,18 +1111,18 @@ void Interpreter::exec_on_goto(OnGotoStmt& s) {
     // If out of range, continue to next statement
 }
 
-void Interpreter::exec_on_gosub(OnGosubStmt& s) {
+void Interpreter::exec_on_gosub(const OnGosubStmt& s) {
     int idx = static_cast<int>(to_number(eval(s.selector)));
     if (idx >= 1 && idx <= static_cast<int>(s.targets.size())) {
         StackEntry entry;
         entry.type = StackEntry::Type::GOSUB;
-        entry.return_pc = runtime_.statements.next(runtime_.pc);
+        entry.return_pc = runtime_.program->next(runtime_.pc);
         runtime_.exec_stack.push_back(entry);
         jump_to(s.targets[idx - 1]);
     }
 }
 
-void Interpreter::exec_data([[maybe_unused]] DataStmt& s) {
+void Interpreter::exec_data([[maybe_unused]] const DataStmt& s) {
     // DATA is not allowed in direct mode
     if (runtime_.direct_mode) {
         raise_error(ErrorCode::ILLEGAL_DIRECT, "Illegal direct");
@@ -1022,18 +1130,18 @@ void Interpreter::exec_data([[maybe_unused]] DataStmt& s) {
     // DATA statements are processed at load time
 }
 
-void Interpreter::exec_read(ReadStmt& s) {
+void Interpreter::exec_read(const ReadStmt& s) {
     for (const auto& var : s.variables) {
         Value val = runtime_.read_data();
         set_lvalue(var, val);
     }
 }
 
-void Interpreter::exec_restore(RestoreStmt& s) {
+void Interpreter::exec_restore(const RestoreStmt& s) {
     runtime_.restore_data(s.target_line);
 }
 
-void Interpreter::exec_dim(DimStmt& s) {
+void Interpreter::exec_dim(const DimStmt& s) {
     for (const auto& decl : s.arrays) {
         std::vector<int> dims;
         for (const auto& dim_expr : decl.dimensions) {
@@ -1043,7 +1151,7 @@ void Interpreter::exec_dim(DimStmt& s) {
     }
 }
 
-void Interpreter::exec_def_fn([[maybe_unused]] DefFnStmt& s) {
+void Interpreter::exec_def_fn([[maybe_unused]] const DefFnStmt& s) {
     // DEF FN is not allowed in direct mode
     if (runtime_.direct_mode) {
         raise_error(ErrorCode::ILLEGAL_DIRECT, "Illegal direct");
@@ -1051,89 +1159,94 @@ void Interpreter::exec_def_fn([[maybe_unused]] DefFnStmt& s) {
     // DEF FN statements are processed at load time
 }
 
-void Interpreter::exec_def_type([[maybe_unused]] DefTypeStmt& s) {
+void Interpreter::exec_def_type([[maybe_unused]] const DefTypeStmt& s) {
     // DEF type statements are processed at parse time
 }
 
-void Interpreter::exec_end([[maybe_unused]] EndStmt& s) {
+void Interpreter::exec_end([[maybe_unused]] const EndStmt& s) {
     // Check if we're in an error handler without RESUME
     if (runtime_.error_pc) {
         raise_error(ErrorCode::NO_RESUME, "No RESUME");
     }
+    runtime_.flush_files();
     runtime_.pc = PC::halted(StopReason::END);
 }
 
-void Interpreter::exec_cls([[maybe_unused]] ClsStmt& s) {
+void Interpreter::exec_cls([[maybe_unused]] const ClsStmt& s) {
     // Clear screen using ANSI escape sequence
     io_->print("\033[2J\033[H");
 }
 
-void Interpreter::exec_stop([[maybe_unused]] StopStmt& s) {
+void Interpreter::exec_stop([[maybe_unused]] const StopStmt& s) {
     runtime_.pc.reason = StopReason::STOP;
 }
 
-void Interpreter::exec_rem([[maybe_unused]] RemStmt& s) {
+void Interpreter::exec_rem([[maybe_unused]] const RemStmt& s) {
     // Comments - nothing to do
 }
 
-void Interpreter::exec_swap(SwapStmt& s) {
+void Interpreter::exec_swap(const SwapStmt& s) {
     Value v1 = get_lvalue(s.var1);
     Value v2 = get_lvalue(s.var2);
     set_lvalue(s.var1, v2);
     set_lvalue(s.var2, v1);
 }
 
-void Interpreter::exec_erase(EraseStmt& s) {
+void Interpreter::exec_erase(const EraseStmt& s) {
     for (const auto& name : s.arrays) {
         runtime_.erase_array(name);
     }
 }
 
-void Interpreter::exec_clear([[maybe_unused]] ClearStmt& s) {
+void Interpreter::exec_clear([[maybe_unused]] const ClearStmt& s) {
     runtime_.reset();
 }
 
-void Interpreter::exec_option_base(OptionBaseStmt& s) {
+void Interpreter::exec_option_base(const OptionBaseStmt& s) {
     runtime_.array_base = s.base;
 }
 
-void Interpreter::exec_randomize(RandomizeStmt& s) {
+void Interpreter::exec_randomize(const RandomizeStmt& s) {
     if (s.seed) {
         int seed = static_cast<int>(to_number(eval(*s.seed)));
-        std::srand(seed);
+        runtime_.rnd_engine.seed(static_cast<uint32_t>(seed));
     } else {
-        std::srand(static_cast<unsigned>(std::time(nullptr)));
+        runtime_.rnd_engine.seed(std::random_device{}());
     }
 }
 
-void Interpreter::exec_tron([[maybe_unused]] TronStmt& s) {
+void Interpreter::exec_tron([[maybe_unused]] const TronStmt& s) {
     runtime_.trace_on = true;
 }
 
-void Interpreter::exec_troff([[maybe_unused]] TroffStmt& s) {
+void Interpreter::exec_troff([[maybe_unused]] const TroffStmt& s) {
     runtime_.trace_on = false;
 }
 
-void Interpreter::exec_width(WidthStmt& s) {
+void Interpreter::exec_width(const WidthStmt& s) {
     int w = static_cast<int>(to_number(eval(s.width)));
+    if (s.printer) {
+        printer().set_width(w);
+        return;
+    }
     io_->set_width(w);
 }
 
-void Interpreter::exec_poke([[maybe_unused]] PokeStmt& s) {
+void Interpreter::exec_poke([[maybe_unused]] const PokeStmt& s) {
     // POKE is not supported in this implementation
 }
 
-void Interpreter::exec_error(ErrorStmt& s) {
+void Interpreter::exec_error(const ErrorStmt& s) {
     int code = static_cast<int>(to_number(eval(s.error_code)));
     raise_error(code, error_message(code));
 }
 
-void Interpreter::exec_on_error(OnErrorStmt& s) {
+void Interpreter::exec_on_error(const OnErrorStmt& s) {
     runtime_.error_handler_line = s.target_line;
     runtime_.error_handler_is_gosub = s.is_gosub;
 }
 
-void Interpreter::exec_resume(ResumeStmt& s) {
+void Interpreter::exec_resume(const ResumeStmt& s) {
     // RESUME after error
     runtime_.set_variable("err%", int16_t(0));
 
@@ -1143,7 +1256,7 @@ void Interpreter::exec_resume(ResumeStmt& s) {
 
     if (s.resume_type == ResumeStmt::Type::NEXT) {
         // Continue to next statement after the one that caused the error
-        runtime_.next_pc = runtime_.statements.next(*runtime_.error_pc);
+        runtime_.next_pc = runtime_.program->next(*runtime_.error_pc);
     } else if (s.target_line) {
         // RESUME line_number - go to specific line
         jump_to(*s.target_line);
@@ -1156,8 +1269,8 @@ void Interpreter::exec_resume(ResumeStmt& s) {
     runtime_.error_pc = std::nullopt;
 }
 
-void Interpreter::exec_open(OpenStmt& s) {
-    // File I/O - simplified implementation
+void Interpreter::exec_open(const OpenStmt& s) {
+    // OPEN goes through the runtime's FileSystem so backends are pluggable
     std::string filename = std::get<std::string>(eval(s.filename));
     int filenum = static_cast<int>(to_number(eval(s.file_number)));
 
@@ -1166,105 +1279,134 @@ void Interpreter::exec_open(OpenStmt& s) {
         raise_error(ErrorCode::BAD_FILE_NAME, "Bad file name");
     }
 
-    // Validate file number (MBASIC allows 1-15)
-    if (filenum < 1 || filenum > 15) {
+    // Validate file number (1 to the /F: limit)
+    if (filenum < 1 || filenum > runtime_.max_files) {
         raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
     }
 
-    // Check if too many files are open
-    int open_count = 0;
-    for (const auto& [num, file] : runtime_.files) {
-        if (file.is_open()) open_count++;
+    // A file number can only be opened once
+    if (runtime_.files.count(filenum)) {
+        raise_error(ErrorCode::FILE_ALREADY_OPEN, "File already open");
     }
-    if (open_count >= 15 && !runtime_.files[filenum].is_open()) {
+
+    // Check if too many files are open
+    if (runtime_.files.size() >= static_cast<size_t>(runtime_.max_files)) {
         raise_error(ErrorCode::TOO_MANY_FILES, "Too many files");
     }
 
-    std::ios_base::openmode mode = std::ios::in;  // Default
+    FileSystem::Mode mode = FileSystem::Mode::INPUT;
     switch (s.mode) {
         case FileMode::INPUT:
-            mode = std::ios::in;
+            mode = FileSystem::Mode::INPUT;
             break;
         case FileMode::OUTPUT:
-            mode = std::ios::out | std::ios::trunc;
+            mode = FileSystem::Mode::OUTPUT;
             break;
         case FileMode::APPEND:
-            mode = std::ios::out | std::ios::app;
+            mode = FileSystem::Mode::APPEND;
             break;
         case FileMode::RANDOM:
-            mode = std::ios::in | std::ios::out | std::ios::binary;
+            mode = FileSystem::Mode::RANDOM;
             break;
     }
 
-    runtime_.files[filenum].open(filename, mode);
-    if (!runtime_.files[filenum]) {
-        // For random mode, try creating the file if it doesn't exist
-        if (s.mode == FileMode::RANDOM) {
-            runtime_.files[filenum].clear();
-            runtime_.files[filenum].open(filename, std::ios::out | std::ios::binary);
-            runtime_.files[filenum].close();
-            runtime_.files[filenum].open(filename, mode);
-        }
-        if (!runtime_.files[filenum]) {
-            raise_error(ErrorCode::FILE_NOT_FOUND, "Cannot open file: " + filename);
+    // Record length for random files (default 128)
+    int record_length = 128;
+    if (s.record_length) {
+        record_length = static_cast<int>(to_number(eval(*s.record_length)));
+        if (record_length < 1 || record_length > 32767) {
+            raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "Illegal function call");
         }
     }
+
+    // The console devices belong to this interpreter's IOHandler, not to
+    // the FileSystem, so they stay in step with PRINT and INPUT
+    std::unique_ptr<FileHandle> handle;
+    if (ConsoleFileHandle::device_name(filename)) {
+        handle = std::make_unique<ConsoleFileHandle>(filename, mode, *io_);
+    } else {
+        // Console output so far goes ahead of anything a PIPE: command prints
+        if (DeviceFileHandle::device_name(filename)) io_->flush();
+        handle = runtime_.filesystem->open(filename, mode, record_length, s.shared);
+    }
+    if (!handle) {
+        raise_error(ErrorCode::FILE_NOT_FOUND, "Cannot open file: " + filename);
+    }
+    runtime_.files[filenum] = std::move(handle);
 }
 
-void Interpreter::exec_close(CloseStmt& s) {
+void Interpreter::exec_close(const CloseStmt& s) {
     if (s.file_numbers.empty()) {
         // Close all files
-        for (auto& [num, file] : runtime_.files) {
-            if (file.is_open()) file.close();
-        }
-        runtime_.files.clear();
+        runtime_.close_files();
     } else {
         for (const auto& expr : s.file_numbers) {
             int num = static_cast<int>(to_number(eval(expr)));
-            if (runtime_.files.count(num) && runtime_.files[num].is_open()) {
-                runtime_.files[num].close();
+            auto it = runtime_.files.find(num);
+            if (it != runtime_.files.end()) {
+                // Remove before closing so a failed flush doesn't leave it open
+                auto handle = std::move(it->second);
+                runtime_.files.erase(it);
+                runtime_.drop_fields(num);
+                handle->close();
             }
-            runtime_.files.erase(num);
         }
     }
 }
 
-void Interpreter::exec_field(FieldStmt& s) {
+void Interpreter::exec_field(const FieldStmt& s) {
     // FIELD for random access files
     int filenum = static_cast<int>(to_number(eval(s.file_number)));
 
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
+    int record_length = get_file(filenum).record_length();
 
-    // Create/reset field buffer for this file
+    // Replace any previous FIELD for this file
+    runtime_.drop_fields(filenum);
     auto& buf = runtime_.field_buffers[filenum];
-    buf.fields.clear();
 
     int offset = 0;
     for (const auto& fld : s.fields) {
         int width = static_cast<int>(to_number(eval(fld.width)));
         std::string var_name = fld.variable.name;
 
-        // Store field mapping
-        buf.fields[var_name] = {offset, width};
+        if (runtime_.resolve_type(var_name) != VarType::STRING) {
+            runtime_.drop_fields(filenum);
+            raise_error(ErrorCode::TYPE_MISMATCH, "Type mismatch");
+        }
+
+        if (offset + width > record_length) {
+            runtime_.drop_fields(filenum);
+            raise_error(ErrorCode::FIELD_OVERFLOW, "Field overflow");
+        }
+
+        // Bind the variable's storage for GET and index it for LSET/RSET
+        runtime_.field_index[var_name] = {&buf, buf.bindings.size()};
+        buf.bindings.push_back({var_name, &runtime_.variable_storage(var_name), offset, width});
         offset += width;
     }
 
-    // Initialize buffer to appropriate size (filled with spaces)
-    buf.buffer.assign(offset, ' ');
+    // The buffer holds the whole record, as OPEN sized it (filled with spaces)
+    buf.buffer.assign(record_length, ' ');
     buf.current_record = 0;
 }
 
-void Interpreter::exec_get(GetStmt& s) {
+// GET/PUT record number. MBASIC takes it as a single-precision value, not
+// an integer, so numbers past 32767 are fine; the only limit is that the
+// record's offset fits in a 64-bit file position. Returns 0 if out of range.
+static int64_t record_number(double value, size_t record_length) {
+    double max_record = static_cast<double>(std::numeric_limits<int64_t>::max() /
+                                            static_cast<int64_t>(record_length));
+    if (!(value >= 1.0) || value >= max_record) {
+        return 0;
+    }
+    return static_cast<int64_t>(value);
+}
+
+void Interpreter::exec_get(const GetStmt& s) {
     // GET for random access files
     int filenum = static_cast<int>(to_number(eval(s.file_number)));
 
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
+    FileHandle& file = get_file(filenum);
 
     auto buf_it = runtime_.field_buffers.find(filenum);
     if (buf_it == runtime_.field_buffers.end() || buf_it->second.buffer.empty()) {
@@ -1275,29 +1417,16 @@ void Interpreter::exec_get(GetStmt& s) {
     size_t rec_len = buf.buffer.size();
 
     // Determine record number
-    int rec;
+    int64_t rec;
     if (s.record_number) {
-        rec = static_cast<int>(to_number(eval(*s.record_number)));
+        rec = record_number(to_number(eval(*s.record_number)), rec_len);
         if (rec < 1) raise_error(ErrorCode::BAD_RECORD_NUMBER, "Bad record number");
     } else {
         rec = buf.current_record + 1;
     }
 
-    // Seek to record position (records are 1-based)
-    it->second.seekg((rec - 1) * rec_len, std::ios::beg);
-    if (it->second.fail() && !it->second.eof()) {
-        it->second.clear();
-        raise_error(ErrorCode::DISK_IO_ERROR, "Disk I/O error");
-    }
-
     // Read the record into field buffer
-    it->second.read(buf.buffer.data(), rec_len);
-    if (it->second.bad()) {
-        it->second.clear();
-        raise_error(ErrorCode::DISK_IO_ERROR, "Disk I/O error");
-    }
-    size_t bytes_read = it->second.gcount();
-    it->second.clear();  // Clear EOF flag if set
+    size_t bytes_read = static_cast<size_t>(file.read_record(rec, buf.buffer.data(), static_cast<int>(rec_len)));
 
     // Pad with spaces if we read past EOF
     for (size_t i = bytes_read; i < rec_len; ++i) {
@@ -1306,22 +1435,19 @@ void Interpreter::exec_get(GetStmt& s) {
 
     buf.current_record = rec;
 
-    // Update field variables from buffer
-    for (const auto& [var_name, pos] : buf.fields) {
-        auto [offset, width] = pos;
-        std::string value(buf.buffer.begin() + offset, buf.buffer.begin() + offset + width);
-        runtime_.set_variable(var_name, value);
+    // Update field variables from buffer; assigning in place reuses each
+    // string's capacity, so repeated GETs don't allocate
+    for (const auto& field : buf.bindings) {
+        std::get<std::string>(*field.value).assign(buf.buffer.data() + field.offset,
+                                                   static_cast<size_t>(field.width));
     }
 }
 
-void Interpreter::exec_put(PutStmt& s) {
+void Interpreter::exec_put(const PutStmt& s) {
     // PUT for random access files
     int filenum = static_cast<int>(to_number(eval(s.file_number)));
 
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
+    FileHandle& file = get_file(filenum);
 
     auto buf_it = runtime_.field_buffers.find(filenum);
     if (buf_it == runtime_.field_buffers.end() || buf_it->second.buffer.empty()) {
@@ -1332,125 +1458,126 @@ void Interpreter::exec_put(PutStmt& s) {
     size_t rec_len = buf.buffer.size();
 
     // Determine record number
-    int rec;
+    int64_t rec;
     if (s.record_number) {
-        rec = static_cast<int>(to_number(eval(*s.record_number)));
+        rec = record_number(to_number(eval(*s.record_number)), rec_len);
         if (rec < 1) raise_error(ErrorCode::BAD_RECORD_NUMBER, "Bad record number");
     } else {
         rec = buf.current_record + 1;
     }
 
-    // Seek to record position (records are 1-based)
-    it->second.seekp((rec - 1) * rec_len, std::ios::beg);
-    if (it->second.fail()) {
-        it->second.clear();
-        raise_error(ErrorCode::DISK_IO_ERROR, "Disk I/O error");
-    }
-
-    // Write the record
-    it->second.write(buf.buffer.data(), rec_len);
-    it->second.flush();
-    if (it->second.fail()) {
-        it->second.clear();
-        raise_error(ErrorCode::DISK_IO_ERROR, "Disk I/O error");
-    }
+    // Write the record; the handle may batch it until CLOSE/END
+    file.write_record(rec, buf.buffer.data(), static_cast<int>(rec_len));
 
     buf.current_record = rec;
 }
 
-void Interpreter::exec_lset(LsetStmt& s) {
-    std::string val = std::get<std::string>(eval(s.value));
-    std::string var_name = s.variable.name;
+void Interpreter::exec_lset(const LsetStmt& s) {
+    Value value = eval(s.value);
+    const std::string& val = std::get<std::string>(value);
 
-    // Find which file buffer this variable belongs to
-    for (auto& [filenum, buf] : runtime_.field_buffers) {
-        auto field_it = buf.fields.find(var_name);
-        if (field_it != buf.fields.end()) {
-            auto [offset, width] = field_it->second;
-
-            // Left-justify: pad on right if too short, truncate if too long
-            if (static_cast<int>(val.size()) < width) {
-                val += std::string(width - val.size(), ' ');
-            } else if (static_cast<int>(val.size()) > width) {
-                val = val.substr(0, width);
-            }
-
-            // Update buffer
-            for (int i = 0; i < width; ++i) {
-                buf.buffer[offset + i] = val[i];
-            }
-
-            // Also update variable with padded value
-            runtime_.set_variable(var_name, val);
-            return;
-        }
+    auto ref = runtime_.field_index.find(s.variable.name);
+    if (ref == runtime_.field_index.end()) {
+        // Not a field variable - just do normal assignment
+        runtime_.set_variable(s.variable.name, value);
+        return;
     }
 
-    // Not a field variable - just do normal assignment
-    runtime_.set_variable(var_name, val);
+    // Left-justify in the record buffer: pad on right, truncate if too long
+    auto& buf = *ref->second.buffer;
+    auto& field = buf.bindings[ref->second.binding];
+    char* dst = buf.buffer.data() + field.offset;
+    size_t width = static_cast<size_t>(field.width);
+    size_t n = std::min(val.size(), width);
+    std::memcpy(dst, val.data(), n);
+    std::memset(dst + n, ' ', width - n);
+
+    // Also update variable with padded value
+    std::get<std::string>(*field.value).assign(dst, width);
 }
 
-void Interpreter::exec_rset(RsetStmt& s) {
-    std::string val = std::get<std::string>(eval(s.value));
-    std::string var_name = s.variable.name;
+void Interpreter::exec_rset(const RsetStmt& s) {
+    Value value = eval(s.value);
+    const std::string& val = std::get<std::string>(value);
 
-    // Find which file buffer this variable belongs to
-    for (auto& [filenum, buf] : runtime_.field_buffers) {
-        auto field_it = buf.fields.find(var_name);
-        if (field_it != buf.fields.end()) {
-            auto [offset, width] = field_it->second;
+    auto ref = runtime_.field_index.find(s.variable.name);
+    if (ref == runtime_.field_index.end()) {
+        // Not a field variable - just do normal assignment
+        runtime_.set_variable(s.variable.name, value);
+        return;
+    }
 
-            // Right-justify: pad on left if too short, truncate from left if too long
-            if (static_cast<int>(val.size()) < width) {
-                val = std::string(width - val.size(), ' ') + val;
-            } else if (static_cast<int>(val.size()) > width) {
-                val = val.substr(val.size() - width);
-            }
+    // Right-justify in the record buffer: pad on left, truncate from left
+    // if too long
+    auto& buf = *ref->second.buffer;
+    auto& field = buf.bindings[ref->second.binding];
+    char* dst = buf.buffer.data() + field.offset;
+    size_t width = static_cast<size_t>(field.width);
+    size_t n = std::min(val.size(), width);
+    std::memset(dst, ' ', width - n);
+    std::memcpy(dst + (width - n), val.data() + (val.size() - n), n);
 
-            // Update buffer
-            for (int i = 0; i < width; ++i) {
-                buf.buffer[offset + i] = val[i];
-            }
+    // Also update variable with padded value
+    std::get<std::string>(*field.value).assign(dst, width);
+}
 
-            // Also update variable with padded value
-            runtime_.set_variable(var_name, val);
-            return;
-        }
+void Interpreter::lock_range(const std::optional<Expr>& first_expr, const std::optional<Expr>& last_expr,
+                             const FileHandle& file, int64_t& first, int64_t& last) {
+    // No records: the whole file. "TO n" alone starts at record 1.
+    first = last = 0;
+    if (!first_expr && !last_expr) return;
+    size_t record_length = static_cast<size_t>(file.record_length());
+    first = first_expr ? record_number(to_number(eval(*first_expr)), record_length) : 1;
+    last = last_expr ? record_number(to_number(eval(*last_expr)), record_length) : first;
+    if (first < 1 || last < first) {
+        raise_error(ErrorCode::BAD_RECORD_NUMBER, "Bad record number");
+    }
+}
+
+void Interpreter::exec_lock(const LockStmt& s) {
+    FileHandle& file = get_file(static_cast<int>(to_number(eval(s.file_number))));
+    int64_t first, last;
+    lock_range(s.first_record, s.last_record, file, first, last);
+    // Like GW-BASIC, a record locked elsewhere is an error, not a wait;
+    // programs retry from an ON ERROR handler
+    if (!file.lock_records(first, last)) {
+        raise_error(ErrorCode::PERMISSION_DENIED, "Permission denied");
     }
+}
 
-    // Not a field variable - just do normal assignment
-    runtime_.set_variable(var_name, val);
+void Interpreter::exec_unlock(const UnlockStmt& s) {
+    FileHandle& file = get_file(static_cast<int>(to_number(eval(s.file_number))));
+    int64_t first, last;
+    lock_range(s.first_record, s.last_record, file, first, last);
+    file.unlock_records(first, last);
 }
 
-void Interpreter::exec_write(WriteStmt& s) {
+void Interpreter::exec_write(const WriteStmt& s) {
     // WRITE with proper formatting
-    std::string output;
+    std::string& output = print_buffer_;
+    output.clear();
     for (size_t i = 0; i < s.expressions.size(); ++i) {
-        if (i > 0) output += ",";
+        if (i > 0) output += ',';
         Value val = eval(s.expressions[i]);
         if (is_string(val)) {
-            output += "\"" + std::get<std::string>(val) + "\"";
+            output += '"';
+            output += std::get<std::string>(val);
+            output += '"';
         } else {
-            output += to_string(val);
+            append_value(output, val, false);
         }
     }
-    output += "\n";
+    output += '\n';
 
     // Output to file or console
     if (s.file_number) {
-        int filenum = static_cast<int>(to_number(eval(*s.file_number)));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        it->second << output;
-        it->second.flush();
+        get_file(static_cast<int>(to_number(eval(*s.file_number)))).write(output);
     } else {
         io_->print(output);
     }
 }
 
-void Interpreter::exec_chain(ChainStmt& s) {
+void Interpreter::exec_chain(const ChainStmt& s) {
     // CHAIN - load and run another program
     InterpreterState::ChainRequest req;
     req.filename = std::get<std::string>(eval(s.filename));
@@ -1467,7 +1594,7 @@ void Interpreter::exec_chain(ChainStmt& s) {
     runtime_.pc.reason = StopReason::END;
 }
 
-void Interpreter::exec_common(CommonStmt& s) {
+void Interpreter::exec_common(const CommonStmt& s) {
     // COMMON - declare shared variables for CHAIN
     // Add variable names to common_vars list (order matters)
     for (const auto& var_name : s.variables) {
@@ -1479,7 +1606,7 @@ void Interpreter::exec_common(CommonStmt& s) {
     }
 }
 
-void Interpreter::exec_mid_assign(MidAssignStmt& s) {
+void Interpreter::exec_mid_assign(const MidAssignStmt& s) {
     std::string current = std::get<std::string>(runtime_.get_variable(s.variable.name));
     std::string replacement = std::get<std::string>(eval(s.replacement));
 
@@ -1496,36 +1623,36 @@ void Interpreter::exec_mid_assign(MidAssignStmt& s) {
     runtime_.set_variable(s.variable.name, current);
 }
 
-void Interpreter::exec_call([[maybe_unused]] CallStmt& s) {
+void Interpreter::exec_call([[maybe_unused]] const CallStmt& s) {
     // CALL - not implemented
 }
 
-void Interpreter::exec_out([[maybe_unused]] OutStmt& s) {
+void Interpreter::exec_out([[maybe_unused]] const OutStmt& s) {
     // OUT - hardware I/O, not implemented
 }
 
-void Interpreter::exec_wait([[maybe_unused]] WaitStmt& s) {
+void Interpreter::exec_wait([[maybe_unused]] const WaitStmt& s) {
     // WAIT - hardware I/O, not implemented
 }
 
-void Interpreter::exec_kill(KillStmt& s) {
+void Interpreter::exec_kill(const KillStmt& s) {
     // KILL - delete a file
     std::string filename = std::get<std::string>(eval(s.filename));
-    if (std::remove(filename.c_str()) != 0) {
+    if (!runtime_.filesystem->remove(filename)) {
         raise_error(ErrorCode::FILE_NOT_FOUND, "Cannot delete file: " + filename);
     }
 }
 
-void Interpreter::exec_name(NameStmt& s) {
+void Interpreter::exec_name(const NameStmt& s) {
     // NAME old AS new - rename a file
     std::string old_name = std::get<std::string>(eval(s.old_name));
     std::string new_name = std::get<std::string>(eval(s.new_name));
-    if (std::rename(old_name.c_str(), new_name.c_str()) != 0) {
+    if (!runtime_.filesystem->rename(old_name, new_name)) {
         raise_error(ErrorCode::FILE_NOT_FOUND, "Cannot rename file: " + old_name);
     }
 }
 
-void Interpreter::exec_merge(MergeStmt& s) {
+void Interpreter::exec_merge(const MergeStmt& s) {
     // MERGE - load and merge a program file at runtime
     std::string filename = std::get<std::string>(eval(s.filename));
 
@@ -1548,8 +1675,11 @@ void Interpreter::exec_merge(MergeStmt& s) {
         Parser parser(tokens);
         Program merged_program = parser.parse();
 
-        // Merge the program into the statement table
-        runtime_.statements.merge(merged_program);
+        // Copy on write: other runtimes sharing the program keep running the
+        // old version. This line is part of it, so it is kept until the
+        // next statement.
+        replaced_program_ = runtime_.program;
+        runtime_.program = replaced_program_->merge(std::move(merged_program));
 
     } catch (const LexerError& e) {
         raise_error(ErrorCode::SYNTAX_ERROR, e.what());
@@ -1558,7 +1688,7 @@ void Interpreter::exec_merge(MergeStmt& s) {
     }
 }
 
-void Interpreter::exec_run(RunStmt& s) {
+void Interpreter::exec_run(const RunStmt& s) {
     // RUN - load and run a program or restart current program
 
     if (s.filename.has_value()) {
@@ -1572,8 +1702,8 @@ void Interpreter::exec_run(RunStmt& s) {
         runtime_.pc.reason = StopReason::END;
     } else if (s.start_line.has_value()) {
         // RUN line_number - restart at specific line (keep program)
-        PC start = runtime_.statements.find_line(*s.start_line);
-        if (!runtime_.statements.valid(start)) {
+        PC start = runtime_.program->find_line(*s.start_line);
+        if (!runtime_.program->valid(start)) {
             raise_error(ErrorCode::UNDEFINED_LINE, "Undefined line number: " + std::to_string(*s.start_line));
             return;
         }
@@ -1582,7 +1712,7 @@ void Interpreter::exec_run(RunStmt& s) {
     } else {
         // RUN with no arguments - restart from beginning
         runtime_.reset();
-        runtime_.next_pc = runtime_.statements.first();
+        runtime_.next_pc = runtime_.program->first();
     }
 }
 
@@ -1659,24 +1789,26 @@ Value Interpreter::eval(const Expr& expr) {
 }
 
 Value Interpreter::eval_binary(const BinaryExpr& e) {
+    // Each operand is evaluated once, as INPUT$, INKEY$ and RND in it
+    // read or draw again
+    Value lhs = eval(e.left);
+    Value rhs = eval(e.right);
+
     // String concatenation
-    if (e.op == TokenType::PLUS || e.op == TokenType::AMPERSAND) {
-        Value left = eval(e.left);
-        Value right = eval(e.right);
-        if (is_string(left) || is_string(right)) {
-            std::string l = is_string(left) ? std::get<std::string>(left) : "";
-            std::string r = is_string(right) ? std::get<std::string>(right) : "";
-            std::string result = l + r;
-            if (result.size() > 255) {
-                raise_error(ErrorCode::STRING_TOO_LONG, "String too long");
-            }
-            return result;
+    if ((e.op == TokenType::PLUS || e.op == TokenType::AMPERSAND) &&
+        (is_string(lhs) || is_string(rhs))) {
+        std::string l = is_string(lhs) ? std::get<std::string>(lhs) : "";
+        std::string r = is_string(rhs) ? std::get<std::string>(rhs) : "";
+        std::string result = l + r;
+        if (result.size() > 255) {
+            raise_error(ErrorCode::STRING_TOO_LONG, "String too long");
         }
+        return result;
     }
 
     // Numeric operations
-    double left = to_number(eval(e.left));
-    double right = to_number(eval(e.right));
+    double left = to_number(lhs);
+    double right = to_number(rhs);
 
     switch (e.op) {
         case TokenType::PLUS: return left + right;
@@ -1697,8 +1829,8 @@ Value Interpreter::eval_binary(const BinaryExpr& e) {
 
         // Comparison - use float_equal for numeric equality to handle float/double precision
         case TokenType::EQUAL:
-            if (is_string(eval(e.left))) {
-                return (std::get<std::string>(eval(e.left)) == std::get<std::string>(eval(e.right))) ? -1.0 : 0.0;
+            if (is_string(lhs)) {
+                return (std::get<std::string>(lhs) == std::get<std::string>(rhs)) ? -1.0 : 0.0;
             }
             return float_equal(left, right) ? -1.0 : 0.0;
         case TokenType::NOT_EQUAL:
@@ -1820,13 +1952,11 @@ Value Interpreter::eval_function(const FunctionCallExpr& e) {
 }
 
 Value Interpreter::eval_user_function(const std::string& name, const std::vector<Value>& args) {
-    auto it = runtime_.user_functions.find(name);
-    if (it == runtime_.user_functions.end()) {
+    const DefFnStmt* fn = runtime_.program->user_function(name);
+    if (!fn) {
         raise_error(ErrorCode::UNDEFINED_USER_FUNCTION, "Undefined function: " + name);
     }
 
-    DefFnStmt* fn = it->second;
-
     // Check argument count
     if (args.size() != fn->params.size()) {
         raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "Wrong number of arguments");
@@ -1902,11 +2032,19 @@ Value Interpreter::builtin_rnd(const std::vector<Value>& args) {
     int arg = args.empty() ? 1 : static_cast<int>(to_number(args[0]));
     if (arg == 0) {
         return runtime_.rnd_last;
-    } else if (arg < 0) {
-        std::srand(static_cast<unsigned>(arg));
     }
-    runtime_.rnd_last = static_cast<double>(std::rand()) / RAND_MAX;
-    return runtime_.rnd_last;
+    // Drawn before the statement last stopped for input
+    if (const Value* done = replayed_call()) {
+        runtime_.rnd_last = std::get<double>(*done);
+        return *done;
+    }
+    if (arg < 0) {
+        runtime_.rnd_engine.seed(static_cast<uint32_t>(arg));
+    }
+    // In [0, 1)
+    runtime_.rnd_last = static_cast<double>(runtime_.rnd_engine() - std::mt19937::min()) /
+                        (static_cast<double>(std::mt19937::max() - std::mt19937::min()) + 1.0);
+    return record_call(runtime_.rnd_last);
 }
 
 Value Interpreter::builtin_sgn(const std::vector<Value>& args) {
@@ -2078,7 +2216,8 @@ Value Interpreter::builtin_instr(const std::vector<Value>& args) {
 Value Interpreter::builtin_tab(const std::vector<Value>& args) {
     if (args.empty()) raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "TAB requires argument");
     int col = static_cast<int>(to_number(args[0])) - 1;  // 1-based
-    int current = io_->get_column();
+    // Inside PRINT, count what the statement has formatted so far
+    int current = print_column_ >= 0 ? print_column_ : io_->get_column();
     if (col > current) {
         return std::string(col - current, ' ');
     }
@@ -2098,6 +2237,10 @@ Value Interpreter::builtin_fre([[maybe_unused]] const std::vector<Value>& args)
 }
 
 Value Interpreter::builtin_pos([[maybe_unused]] const std::vector<Value>& args) {
+    // Inside PRINT, count what the statement has formatted so far
+    if (print_column_ >= 0 && print_target_ == PrintTarget::CONSOLE) {
+        return static_cast<double>(print_column_ + 1);
+    }
     return static_cast<double>(io_->get_column() + 1);  // 1-based
 }
 
@@ -2113,43 +2256,21 @@ Value Interpreter::builtin_inp([[maybe_unused]] const std::vector<Value>& args)
 
 Value Interpreter::builtin_eof(const std::vector<Value>& args) {
     if (args.empty()) raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "EOF requires argument");
-    int filenum = static_cast<int>(to_number(args[0]));
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
-    // Check if at end of file
-    if (it->second.eof()) return -1.0;  // True in BASIC
-    // Peek to check
-    int c = it->second.peek();
-    return (c == EOF) ? -1.0 : 0.0;
+    FileHandle& file = get_file(static_cast<int>(to_number(args[0])));
+    return file.eof() ? -1.0 : 0.0;  // -1 is true in BASIC
 }
 
 Value Interpreter::builtin_lof(const std::vector<Value>& args) {
     if (args.empty()) raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "LOF requires argument");
-    int filenum = static_cast<int>(to_number(args[0]));
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
-    // Get file size
-    auto cur = it->second.tellg();
-    it->second.seekg(0, std::ios::end);
-    auto size = it->second.tellg();
-    it->second.seekg(cur);
-    return static_cast<double>(size);
+    FileHandle& file = get_file(static_cast<int>(to_number(args[0])));
+    return static_cast<double>(file.length());
 }
 
 Value Interpreter::builtin_loc(const std::vector<Value>& args) {
     if (args.empty()) raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "LOC requires argument");
-    int filenum = static_cast<int>(to_number(args[0]));
-    auto it = runtime_.files.find(filenum);
-    if (it == runtime_.files.end() || !it->second.is_open()) {
-        raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-    }
-    // Return current position (1-based record number for random, byte/128 for sequential)
-    auto pos = it->second.tellg();
-    return static_cast<double>(pos / 128 + 1);
+    FileHandle& file = get_file(static_cast<int>(to_number(args[0])));
+    // Current position (record number for random, byte offset for sequential)
+    return static_cast<double>(file.position());
 }
 
 Value Interpreter::builtin_cvi(const std::vector<Value>& args) {
@@ -2211,11 +2332,12 @@ Value Interpreter::builtin_mkd(const std::vector<Value>& args) {
 
 Value Interpreter::builtin_inkey([[maybe_unused]] const std::vector<Value>& args) {
     // Non-blocking keyboard input
+    if (const Value* done = replayed_call()) return *done;
     auto key = io_->inkey();
     if (key) {
-        return std::string(1, *key);
+        return record_call(std::string(1, *key));
     }
-    return std::string{};
+    return record_call(std::string{});
 }
 
 Value Interpreter::builtin_input_func(const std::vector<Value>& args) {
@@ -2224,31 +2346,27 @@ Value Interpreter::builtin_input_func(const std::vector<Value>& args) {
     int n = static_cast<int>(to_number(args[0]));
     if (n < 0) raise_error(ErrorCode::ILLEGAL_FUNCTION_CALL, "INPUT$ negative count");
 
+    // Read before the statement last stopped for console input: the same
+    // characters again, whether they came from the console or a file
+    if (const Value* done = replayed_call()) return *done;
+
     std::string result;
     if (args.size() > 1) {
         // Read from file
-        int filenum = static_cast<int>(to_number(args[1]));
-        auto it = runtime_.files.find(filenum);
-        if (it == runtime_.files.end() || !it->second.is_open()) {
-            raise_error(ErrorCode::BAD_FILE_NUMBER, "Bad file number");
-        }
-        result.resize(n);
-        it->second.read(&result[0], n);
-        result.resize(it->second.gcount());
+        FileHandle& file = get_file(static_cast<int>(to_number(args[1])));
+        result = file.read_chars(n);
     } else {
-        // Read from console - blocking
-        for (int i = 0; i < n; ++i) {
-            char c = std::cin.get();
-            if (std::cin.eof()) break;
-            result += c;
-        }
+        result = take_input_chars(n);
     }
-    return result;
+    return record_call(std::move(result));
 }
 
 Value Interpreter::builtin_lpos([[maybe_unused]] const std::vector<Value>& args) {
-    // Line printer position - just return 0 (no printer support)
-    return 0.0;
+    // Inside LPRINT, count what the statement has formatted so far
+    if (print_column_ >= 0 && print_target_ == PrintTarget::PRINTER) {
+        return static_cast<double>(print_column_ + 1);
+    }
+    return static_cast<double>(printer().get_column() + 1);  // 1-based
 }
 
 Value Interpreter::builtin_erl([[maybe_unused]] const std::vector<Value>& args) {
@@ -2264,14 +2382,16 @@ Value Interpreter::builtin_err([[maybe_unused]] const std::vector<Value>& args)
 Value Interpreter::builtin_timer([[maybe_unused]] const std::vector<Value>& args) {
     // TIMER - return seconds since midnight
     std::time_t now = std::time(nullptr);
-    std::tm* tm = std::localtime(&now);
+    std::tm local{};
+    const std::tm* tm = ::localtime_r(&now, &local);
     return static_cast<double>(tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
 }
 
 Value Interpreter::builtin_date([[maybe_unused]] const std::vector<Value>& args) {
     // DATE$ - return current date as string MM-DD-YYYY
     std::time_t now = std::time(nullptr);
-    std::tm* tm = std::localtime(&now);
+    std::tm local{};
+    const std::tm* tm = ::localtime_r(&now, &local);
     char buf[32];  // Extra space to avoid truncation warnings
     std::snprintf(buf, sizeof(buf), "%02d-%02d-%04d",
                   tm->tm_mon + 1, tm->tm_mday, tm->tm_year + 1900);
@@ -2281,7 +2401,8 @@ Value Interpreter::builtin_date([[maybe_unused]] const std::vector<Value>& args)
 Value Interpreter::builtin_time([[maybe_unused]] const std::vector<Value>& args) {
     // TIME$ - return current time as string HH:MM:SS
     std::time_t now = std::time(nullptr);
-    std::tm* tm = std::localtime(&now);
+    std::tm local{};
+    const std::tm* tm = ::localtime_r(&now, &local);
     char buf[16];
     std::snprintf(buf, sizeof(buf), "%02d:%02d:%02d",
                   tm->tm_hour, tm->tm_min, tm->tm_sec);
@@ -2309,6 +2430,78 @@ Value Interpreter::builtin_error_str(const std::vector<Value>& args) {
 
 void Interpreter::provide_input(const std::string& input) {
     state_.input_buffer.push_back(input);
+    if (runtime_.pc.reason == StopReason::INPUT) {
+        runtime_.pc.reason = StopReason::RUNNING;
+    }
+}
+
+std::string Interpreter::take_input_line(const std::string& prompt) {
+    if (state_.input_buffer.empty()) {
+        if (!state_.input_prompt) {
+            io_->print(prompt);
+            state_.input_prompt = prompt;
+        }
+        state_.input_chars = 0;
+        throw InputPending{};
+    }
+    std::string line = std::move(state_.input_buffer.front());
+    state_.input_buffer.erase(state_.input_buffer.begin());
+    // The line was ended with Enter
+    io_->set_column(0);
+    return line;
+}
+
+std::string Interpreter::take_input_chars(int n) {
+    size_t want = static_cast<size_t>(n);
+    std::string result = std::move(input_partial_);
+    input_partial_.clear();
+    while (result.size() < want) {
+        if (state_.input_buffer.empty()) {
+            if (!state_.input_prompt) {
+                state_.input_prompt = std::string();
+            }
+            state_.input_chars = static_cast<int>(want - result.size());
+            input_partial_ = std::move(result);
+            throw InputPending{};
+        }
+        std::string& line = state_.input_buffer.front();
+        if (line.empty()) {
+            // An empty line (or the end of console input) ends INPUT$ early
+            state_.input_buffer.erase(state_.input_buffer.begin());
+            break;
+        }
+        size_t take = std::min(want - result.size(), line.size());
+        result.append(line, 0, take);
+        line.erase(0, take);
+        if (line.empty()) {
+            state_.input_buffer.erase(state_.input_buffer.begin());
+        }
+    }
+    return result;
+}
+
+const Value* Interpreter::replayed_call() {
+    if (input_replay_pos_ < input_replay_.size()) {
+        return &input_replay_[input_replay_pos_++];
+    }
+    return nullptr;
+}
+
+const Value& Interpreter::record_call(Value result) {
+    input_replay_.push_back(std::move(result));
+    input_replay_pos_++;
+    return input_replay_.back();
+}
+
+void Interpreter::end_input() {
+    state_.input_prompt.reset();
+    state_.pending_vars.clear();
+    state_.input_chars = 0;
+    input_replay_.clear();
+    input_replay_pos_ = 0;
+    input_partial_.clear();
+    input_resume_.clear();
+    input_resume_pos_ = 0;
 }
 
 } // namespace mbasic
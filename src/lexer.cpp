@@ -206,7 +206,8 @@ Token Lexer::read_identifier() {
         if (without_hash == "print" || without_hash == "lprint" ||
             without_hash == "input" || without_hash == "write" ||
             without_hash == "field" || without_hash == "get" ||
-            without_hash == "put" || without_hash == "close") {
+            without_hash == "put" || without_hash == "close" ||
+            without_hash == "lock" || without_hash == "unlock") {
             // Put the # back to be tokenized separately
             pos_--;
             column_--;
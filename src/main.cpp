@@ -4,18 +4,96 @@
 #include <map>
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "mbasic/readline.hpp"
 #include "mbasic/lexer.hpp"
 #include "mbasic/parser.hpp"
 #include "mbasic/runtime.hpp"
 #include "mbasic/interpreter.hpp"
+#include "mbasic/memory_fs.hpp"
+#include "mbasic/printer.hpp"
 #include "mbasic/error.hpp"
+#include "mbasic/zygote.hpp"
 
 // Maximum line length (MBASIC limit)
 constexpr size_t MAX_LINE_LENGTH = 255;
 
+// stdout buffer when it isn't a terminal
+constexpr size_t CONSOLE_BUFFER_SIZE = 64 * 1024;
+
+// File settings from the command line, applied to every runtime we create
+mbasic::FileOptions g_file_options;
+
+// File system shared by every runtime we create (set up after the flags),
+// so --memfs files survive from one RUN to the next
+std::shared_ptr<mbasic::FileSystem> g_filesystem;
+
+// Directory the --memfs files are written to at exit
+std::string g_memfs_dump;
+
+// LPRINT spool file or pipe from --lpt, shared like g_filesystem
+std::shared_ptr<mbasic::Printer> g_printer;
+
+// File number limit from --files (MBASIC's /F: switch)
+constexpr int MAX_FILES_LIMIT = 32767;
+int g_max_files = 15;
+
+// Programs the zygote keeps parsed (--zygote-cache), by file identity;
+// a file whose size or times have changed is parsed again. program is
+// null for a file that doesn't parse
+struct CachedProgram {
+    off_t size = 0;
+    timespec mtime{};
+    timespec ctime{};
+    uint64_t last_used = 0;
+    std::shared_ptr<const mbasic::CompiledProgram> program;
+};
+std::map<std::pair<dev_t, ino_t>, CachedProgram> g_program_cache;
+size_t g_program_cache_limit = 0;
+uint64_t g_program_cache_clock = 0;
+
+// Program the zygote parsed for the job it is forking, run instead of
+// reading the file again
+std::shared_ptr<const mbasic::CompiledProgram> g_preloaded_program;
+
+// Print the --io-stats counters; registered with atexit
+void print_io_stats() {
+    const mbasic::FileStats& stats = *g_file_options.stats;
+    std::cerr << "I/O statistics:\n"
+              << "  read calls:          " << stats.read_calls << "\n"
+              << "  bytes read:          " << stats.bytes_read << "\n"
+              << "  write calls:         " << stats.write_calls << "\n"
+              << "  bytes written:       " << stats.bytes_written << "\n"
+              << "  sync calls:          " << stats.sync_calls << "\n"
+              << "  read-ahead hits:     " << stats.read_ahead_hits << "\n"
+              << "  read-ahead waits:    " << stats.read_ahead_waits << "\n"
+              << "  record cache hits:   " << stats.record_cache_hits << "\n"
+              << "  record cache misses: " << stats.record_cache_misses << "\n"
+              << "  descriptor reopens:  " << stats.descriptor_reopens << "\n";
+}
+
+// Write the --memfs files to the --memfs-dump directory; registered with atexit
+void dump_memfs() {
+    auto& memfs = static_cast<mbasic::MemoryFileSystem&>(*g_filesystem);
+    if (!memfs.dump_to(g_memfs_dump)) {
+        std::cerr << "?Could not write files to: " << g_memfs_dump << "\n";
+    }
+}
+
+// Create a runtime whose file statements use the configured file system
+std::unique_ptr<mbasic::Runtime> make_runtime() {
+    auto runtime = std::make_unique<mbasic::Runtime>();
+    runtime->filesystem = g_filesystem;
+    runtime->max_files = g_max_files;
+    runtime->printer = g_printer;
+    return runtime;
+}
+
 // Read a line with optional pre-filled text for editing
 std::string read_line_prefilled(const char* prompt, const std::string& prefill) {
     return mbasic::readline_getline_prefilled(prompt, prefill);
@@ -63,11 +141,9 @@ void print_program(const mbasic::Program& program) {
     }
 }
 
-void run_program(const std::string& source) {
-    auto program = mbasic::parse(source);
-
-    auto runtime = std::make_unique<mbasic::Runtime>();
-    runtime->load(program);
+void run_program(std::shared_ptr<const mbasic::CompiledProgram> compiled) {
+    auto runtime = make_runtime();
+    runtime->load(std::move(compiled));
 
     auto interp = std::make_unique<mbasic::Interpreter>(*runtime);
     interp->run();
@@ -100,15 +176,15 @@ void run_program(const std::string& source) {
         buffer << file.rdbuf();
         std::string new_source = buffer.str();
 
-        program = mbasic::parse(new_source);
-        runtime = std::make_unique<mbasic::Runtime>();
-        runtime->load(program);
+        auto program = mbasic::parse(new_source);
+        runtime = make_runtime();
+        runtime->load(std::move(program));
 
         interp = std::make_unique<mbasic::Interpreter>(*runtime);
 
         // If a start line was specified, jump to it
         if (run_req.start_line) {
-            mbasic::PC target = runtime->statements.find_line(*run_req.start_line);
+            mbasic::PC target = runtime->program->find_line(*run_req.start_line);
             if (target.line != 0) {
                 runtime->pc = target;
             }
@@ -162,8 +238,8 @@ public:
             }
 
             auto program = mbasic::parse(source);
-            runtime = std::make_unique<mbasic::Runtime>();
-            runtime->load(program);
+            runtime = make_runtime();
+            runtime->load(std::move(program));
 
             interpreter = std::make_unique<mbasic::Interpreter>(*runtime);
             interpreter->run();
@@ -238,8 +314,8 @@ public:
                 }
 
                 program = mbasic::parse(source);
-                runtime = std::make_unique<mbasic::Runtime>();
-                runtime->load(program);
+                runtime = make_runtime();
+                runtime->load(std::move(program));
 
                 // Restore saved variables
                 for (const auto& [name, value] : saved_vars) {
@@ -251,7 +327,7 @@ public:
                 // If a start line was specified, jump to it
                 if (chain_req.line_number) {
                     // Find the PC for that line
-                    mbasic::PC target = runtime->statements.find_line(*chain_req.line_number);
+                    mbasic::PC target = runtime->program->find_line(*chain_req.line_number);
                     if (target.line != 0) {
                         runtime->pc = target;
                     }
@@ -289,14 +365,14 @@ public:
                 }
 
                 program = mbasic::parse(source);
-                runtime = std::make_unique<mbasic::Runtime>();
-                runtime->load(program);
+                runtime = make_runtime();
+                runtime->load(std::move(program));
 
                 interpreter = std::make_unique<mbasic::Interpreter>(*runtime);
 
                 // If a start line was specified, jump to it
                 if (run_req.start_line) {
-                    mbasic::PC target = runtime->statements.find_line(*run_req.start_line);
+                    mbasic::PC target = runtime->program->find_line(*run_req.start_line);
                     if (target.line != 0) {
                         runtime->pc = target;
                     }
@@ -813,13 +889,11 @@ void run_repl() {
         } else if (first_word == "RESET") {
             // RESET - close all open files
             if (session.runtime) {
-                for (auto& [num, file] : session.runtime->files) {
-                    if (file.is_open()) {
-                        file.close();
-                    }
+                try {
+                    session.runtime->close_files();
+                } catch (const mbasic::RuntimeError& e) {
+                    std::cerr << "?" << e.what() << "\n";
                 }
-                session.runtime->files.clear();
-                session.runtime->field_buffers.clear();
             }
         } else if (first_word == "MERGE") {
             // MERGE filename - merge program from file
@@ -894,10 +968,10 @@ void run_repl() {
                 // Wrap in a temporary program
                 std::string temp = "1 " + line + "\n2 END\n";
                 auto program = mbasic::parse(temp);
-                mbasic::Runtime runtime;
-                runtime.load(program);
-                runtime.direct_mode = true;  // Mark as direct/immediate mode
-                mbasic::Interpreter interp(runtime);
+                auto runtime = make_runtime();
+                runtime->load(std::move(program));
+                runtime->direct_mode = true;  // Mark as direct/immediate mode
+                mbasic::Interpreter interp(*runtime);
                 interp.run();
             } catch (const mbasic::ParseError& e) {
                 std::cerr << "?" << e.what() << "\n";
@@ -910,11 +984,21 @@ void run_repl() {
     }
 }
 
-int main(int argc, char* argv[]) {
+// Run the interpreter with a command line: in this process, or in a job
+// forked by the zygote
+int run_command(int argc, char* argv[]) {
+    // ConsoleIO flushes when output has to be seen; redirected output can
+    // then go out in large writes
+    if (!::isatty(STDOUT_FILENO)) {
+        std::setvbuf(stdout, nullptr, _IOFBF, CONSOLE_BUFFER_SIZE);
+    }
+
     enum class Mode { TOKENIZE, PARSE, RUN };
     Mode mode = Mode::RUN;  // Default to run
 
     int file_arg = 1;
+    bool use_memfs = false;
+    std::string memfs_seed;
 
     // Parse flags
     while (file_arg < argc && argv[file_arg][0] == '-') {
@@ -925,6 +1009,63 @@ int main(int argc, char* argv[]) {
             mode = Mode::TOKENIZE;
         } else if (flag == "--run" || flag == "-r") {
             mode = Mode::RUN;
+        } else if (flag == "--sync-writes") {
+            g_file_options.sync_writes = true;
+        } else if (flag.rfind("--flush-interval=", 0) == 0) {
+            g_file_options.flush_interval_ms = std::atoi(flag.c_str() + 17);
+        } else if (flag == "--read-ahead") {
+            g_file_options.read_ahead = true;
+        } else if (flag == "--io-stats") {
+            if (!g_file_options.stats) {
+                g_file_options.stats = std::make_shared<mbasic::FileStats>();
+                std::atexit(print_io_stats);
+            }
+        } else if (flag.rfind("--record-cache=", 0) == 0) {
+            g_file_options.record_cache_records = std::atoi(flag.c_str() + 15);
+        } else if (flag == "--write-back") {
+            g_file_options.record_cache_write_back = true;
+        } else if (flag == "--memfs") {
+            use_memfs = true;
+        } else if (flag.rfind("--memfs-seed=", 0) == 0) {
+            use_memfs = true;
+            memfs_seed = flag.substr(13);
+        } else if (flag.rfind("--memfs-dump=", 0) == 0) {
+            use_memfs = true;
+            g_memfs_dump = flag.substr(13);
+        } else if (flag.rfind("--files=", 0) == 0) {
+            g_max_files = std::atoi(flag.c_str() + 8);
+            if (g_max_files < 1 || g_max_files > MAX_FILES_LIMIT) {
+                std::cerr << "Invalid file limit: " << flag.substr(8) << " (use 1 to "
+                          << MAX_FILES_LIMIT << ")\n";
+                return 1;
+            }
+        } else if (flag.rfind("--max-fds=", 0) == 0) {
+            g_file_options.max_descriptors = std::atoi(flag.c_str() + 10);
+        } else if (flag.rfind("--lpt=", 0) == 0) {
+            if (flag.size() == 6) {
+                std::cerr << "Missing printer path: " << flag << "\n";
+                return 1;
+            }
+            g_printer = std::make_shared<mbasic::SpoolPrinter>(flag.substr(6));
+        } else if (flag == "--mmap") {
+            g_file_options.mmap_random = true;
+        } else if (flag == "--no-compression") {
+            g_file_options.compressed_files = false;
+        } else if (flag.rfind("--compress-level=", 0) == 0) {
+            g_file_options.compression_level = std::atoi(flag.c_str() + 17);
+        } else if (flag.rfind("--durability=", 0) == 0) {
+            std::string value = flag.substr(13);
+            if (value == "none") {
+                g_file_options.durability = mbasic::FileOptions::Durability::NONE;
+            } else if (value == "close") {
+                g_file_options.durability = mbasic::FileOptions::Durability::CLOSE;
+            } else if (std::atoi(value.c_str()) > 0) {
+                g_file_options.durability = mbasic::FileOptions::Durability::RECORDS;
+                g_file_options.sync_every_records = std::atoi(value.c_str());
+            } else {
+                std::cerr << "Invalid durability: " << value << " (use none, close or a record count)\n";
+                return 1;
+            }
         } else if (flag == "--help" || flag == "-h") {
             std::cout << "MBASIC 5.21 Interpreter (C++ Edition)\n\n";
             std::cout << "Usage: mbasicc [OPTIONS] [filename.bas]\n\n";
@@ -932,8 +1073,34 @@ int main(int argc, char* argv[]) {
             std::cout << "  --run, -r       Run the program (default)\n";
             std::cout << "  --parse         Parse and show AST structure\n";
             std::cout << "  --tokenize, -t  Tokenize and show tokens\n";
+            std::cout << "  --sync-writes   Flush file output after every PRINT#/WRITE#\n";
+            std::cout << "  --flush-interval=MS\n";
+            std::cout << "                  Flush buffered file output older than MS ms\n";
+            std::cout << "  --read-ahead    Read input files ahead on a background thread\n";
+            std::cout << "  --io-stats      Print file I/O statistics on exit\n";
+            std::cout << "  --record-cache=N\n";
+            std::cout << "                  Cache the N most recently used records of random files\n";
+            std::cout << "  --write-back    Write cached records only when evicted or closed\n";
+            std::cout << "  --files=N       Allow file numbers 1 to N (MBASIC's /F:N, default 15)\n";
+            std::cout << "  --max-fds=N     Keep at most N files' descriptors open, reopening on demand\n";
+            std::cout << "  --lpt=PATH      Append LPRINT output to PATH (a spool file or named pipe)\n";
+            std::cout << "  --mmap          Memory-map random access files\n";
+            std::cout << "  --no-compression\n";
+            std::cout << "                  Open .gz/.zst files as plain files\n";
+            std::cout << "  --compress-level=N\n";
+            std::cout << "                  Compression level for .gz/.zst output files\n";
+            std::cout << "  --memfs         Keep files in memory instead of on disk\n";
+            std::cout << "  --memfs-seed=DIR\n";
+            std::cout << "                  Load the files of DIR into memory first (implies --memfs)\n";
+            std::cout << "  --memfs-dump=DIR\n";
+            std::cout << "                  Write the in-memory files to DIR at exit (implies --memfs)\n";
+            std::cout << "  --durability=none|close|N\n";
+            std::cout << "                  fdatasync written files never, on CLOSE, or every N PUTs\n";
             std::cout << "  --help, -h      Show this help\n\n";
             std::cout << "If no file is specified, enters interactive REPL mode.\n";
+            std::cout << "\nZygote mode: mbasicc --zygote[=SOCKET] [--zygote-cache=N]\n";
+            std::cout << "  Stay resident and fork a ready interpreter for each mbasic-run command,\n";
+            std::cout << "  keeping up to N parsed programs (default socket " << mbasic::default_zygote_socket() << ")\n";
             std::cout << "\nInteractive commands:\n";
             std::cout << "  NEW             Clear program\n";
             std::cout << "  RUN             Run program\n";
@@ -951,7 +1118,24 @@ int main(int argc, char* argv[]) {
         file_arg++;
     }
 
-    if (file_arg < argc) {
+    if (use_memfs) {
+        auto memfs = std::make_shared<mbasic::MemoryFileSystem>();
+        if (!memfs_seed.empty() && !memfs->seed_from(memfs_seed)) {
+            std::cerr << "Error: Could not read directory: " << memfs_seed << "\n";
+            return 1;
+        }
+        g_filesystem = memfs;
+        if (!g_memfs_dump.empty()) {
+            std::atexit(dump_memfs);
+        }
+    } else {
+        g_filesystem = mbasic::FileSystem::create_native(g_file_options);
+    }
+
+    if (file_arg < argc && mode == Mode::RUN && g_preloaded_program) {
+        // Parsed by the zygote before it forked this job
+        run_program(g_preloaded_program);
+    } else if (file_arg < argc) {
         // Load file
         std::string filename = argv[file_arg];
         std::ifstream file(filename);
@@ -977,7 +1161,7 @@ int main(int argc, char* argv[]) {
                     break;
                 }
                 case Mode::RUN: {
-                    run_program(source);
+                    run_program(mbasic::CompiledProgram::compile(mbasic::parse(source)));
                     break;
                 }
             }
@@ -998,3 +1182,117 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+
+// Zygote: parse the job's program in the zygote, so that it is parsed once
+// for as many jobs as run it while it stays in the cache
+void prepare_zygote_job(const mbasic::ZygoteJob& job) {
+    g_preloaded_program.reset();
+    if (g_program_cache_limit == 0) return;
+
+    // The program file is the first argument that isn't an option, as in
+    // run_command
+    size_t file_arg = 1;
+    while (file_arg < job.args.size() && !job.args[file_arg].empty() && job.args[file_arg][0] == '-') {
+        file_arg++;
+    }
+    if (file_arg >= job.args.size()) return;
+
+    int fd = ::openat(job.cwd_fd, job.args[file_arg].c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return;
+    }
+    auto same_time = [](const timespec& a, const timespec& b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    };
+    auto key = std::make_pair(st.st_dev, st.st_ino);
+    auto it = g_program_cache.find(key);
+    if (it != g_program_cache.end() && it->second.size == st.st_size &&
+        same_time(it->second.mtime, st.st_mtim) && same_time(it->second.ctime, st.st_ctim)) {
+        ::close(fd);
+        it->second.last_used = ++g_program_cache_clock;
+        g_preloaded_program = it->second.program;
+        return;
+    }
+
+    std::string source;
+    char chunk[65536];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        source.append(chunk, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    if (n < 0) return;
+
+    // A program that doesn't parse is remembered too (with no program), so
+    // that only the job, which reports the error, parses it again
+    CachedProgram entry;
+    try {
+        entry.program = mbasic::CompiledProgram::compile(mbasic::parse(source));
+    } catch (const mbasic::MBasicError&) {
+    }
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtim;
+    entry.ctime = st.st_ctim;
+    entry.last_used = ++g_program_cache_clock;
+
+    g_program_cache.erase(key);
+    if (g_program_cache.size() >= g_program_cache_limit) {
+        auto oldest = std::min_element(g_program_cache.begin(), g_program_cache.end(),
+                                       [](const auto& a, const auto& b) {
+                                           return a.second.last_used < b.second.last_used;
+                                       });
+        g_program_cache.erase(oldest);
+    }
+    g_preloaded_program = entry.program;
+    g_program_cache.emplace(key, std::move(entry));
+}
+
+// Zygote: the job itself, in the forked child
+int run_job(const mbasic::ZygoteJob& job) {
+    // The cache is no use to the job, and freeing it at exit would write to,
+    // and so copy, every page it shares with the zygote
+    [[maybe_unused]] auto* inherited = new decltype(g_program_cache)(std::move(g_program_cache));
+
+    std::vector<char*> argv;
+    for (const auto& arg : job.args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    return run_command(static_cast<int>(job.args.size()), argv.data());
+}
+
+// mbasicc --zygote[=SOCKET] [--zygote-cache=N]
+int run_zygote_server(int argc, char* argv[]) {
+    mbasic::ZygoteOptions options;
+    options.socket_path = mbasic::default_zygote_socket();
+    for (int i = 1; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--zygote") {
+            continue;
+        } else if (flag.rfind("--zygote=", 0) == 0) {
+            options.socket_path = flag.substr(9);
+        } else if (flag.rfind("--zygote-cache=", 0) == 0) {
+            int limit = std::atoi(flag.c_str() + 15);
+            g_program_cache_limit = limit > 0 ? static_cast<size_t>(limit) : 0;
+        } else {
+            std::cerr << "Unknown zygote option: " << flag
+                      << " (interpreter options go to mbasic-run)\n";
+            return 1;
+        }
+    }
+    options.before_fork = prepare_zygote_job;
+    options.run = run_job;
+    return mbasic::run_zygote(options);
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--zygote") == 0 || std::strncmp(argv[i], "--zygote=", 9) == 0) {
+            return run_zygote_server(argc, argv);
+        }
+    }
+    return run_command(argc, argv);
+}
@@ -0,0 +1,312 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// In-memory FileSystem Implementation
+
+#include "mbasic/memory_fs.hpp"
+#include "mbasic/error.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace mbasic {
+
+struct MemoryFile {
+    std::mutex mutex;
+    std::vector<char> bytes;
+};
+
+// Most bytes peek() hands out at a time
+constexpr size_t MEMORY_PEEK_SIZE = 4096;
+
+// ============================================================================
+// MemoryFileHandle - a cursor over a shared byte vector
+// ============================================================================
+// Other handles, maybe on other threads, may resize the bytes at any time,
+// so every access holds the file's mutex, and peek() hands out a copy.
+
+namespace {
+
+class MemoryFileHandle : public FileHandle {
+public:
+    MemoryFileHandle(std::shared_ptr<MemoryFile> file, FileSystem::Mode mode, int record_length)
+        : file_(std::move(file)), mode_(mode), record_length_(record_length) {
+        if (mode_ == FileSystem::Mode::APPEND) {
+            std::lock_guard<std::mutex> lock(file_->mutex);
+            cursor_ = file_->bytes.size();
+        }
+    }
+
+    bool is_open() const override { return file_ != nullptr; }
+
+    void close() override { file_.reset(); }
+
+    bool read_line(std::string& line) override {
+        check_read();
+        drop_peek();
+        line.clear();
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        const std::vector<char>& bytes = file_->bytes;
+        if (cursor_ >= bytes.size()) {
+            return false;
+        }
+        const char* start = bytes.data() + cursor_;
+        size_t avail = bytes.size() - cursor_;
+        const char* nl = static_cast<const char*>(std::memchr(start, '\n', avail));
+        if (nl) {
+            line.assign(start, nl);
+            cursor_ += static_cast<size_t>(nl - start) + 1;
+        } else {
+            line.assign(start, avail);
+            cursor_ = bytes.size();
+        }
+        return true;
+    }
+
+    void write_line(const std::string& line) override {
+        write_bytes(line.data(), line.size(), true);
+    }
+
+    void write(const std::string& data) override {
+        write_bytes(data.data(), data.size(), false);
+    }
+
+    std::string read_chars(int n) override {
+        check_read();
+        drop_peek();
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        size_t count = std::min(static_cast<size_t>(std::max(n, 0)), remaining());
+        std::string result(file_->bytes.data() + cursor_, count);
+        cursor_ += count;
+        return result;
+    }
+
+    bool eof() const override {
+        // Output files are always positioned at their end
+        if (mode_ == FileSystem::Mode::OUTPUT || mode_ == FileSystem::Mode::APPEND) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        return cursor_ >= file_->bytes.size();
+    }
+
+    int64_t position() const override {
+        int64_t pos = static_cast<int64_t>(cursor_);
+        if (mode_ == FileSystem::Mode::RANDOM && record_length_ > 0) {
+            return pos / record_length_;
+        }
+        return (pos + LOC_BLOCK_SIZE - 1) / LOC_BLOCK_SIZE;
+    }
+
+    int64_t length() const override {
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        return static_cast<int64_t>(file_->bytes.size());
+    }
+
+    int record_length() const override { return record_length_; }
+
+    void seek_record(int64_t record, int record_length) override {
+        drop_peek();
+        cursor_ = static_cast<size_t>((record - 1) * record_length);
+    }
+
+    int read_raw(char* buffer, int size) override {
+        check_read();
+        drop_peek();
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        size_t count = std::min(static_cast<size_t>(std::max(size, 0)), remaining());
+        std::memcpy(buffer, file_->bytes.data() + cursor_, count);
+        cursor_ += count;
+        return static_cast<int>(count);
+    }
+
+    void write_raw(const char* buffer, int size) override {
+        write_bytes(buffer, static_cast<size_t>(std::max(size, 0)), false);
+    }
+
+    void flush() override {}
+
+    std::string_view peek() override {
+        check_read();
+        if (peek_pos_ < peek_buffer_.size()) {
+            return std::string_view(peek_buffer_).substr(peek_pos_);
+        }
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        size_t count = std::min(MEMORY_PEEK_SIZE, remaining());
+        peek_buffer_.assign(file_->bytes.data() + cursor_, count);
+        peek_pos_ = 0;
+        return peek_buffer_;
+    }
+
+    void consume(size_t n) override {
+        cursor_ += n;
+        peek_pos_ += n;
+    }
+
+private:
+    // Moving the cursor other than by consume() drops what peek() copied
+    void drop_peek() {
+        peek_buffer_.clear();
+        peek_pos_ = 0;
+    }
+
+    // Call with the file's mutex held
+    size_t remaining() const {
+        return cursor_ < file_->bytes.size() ? file_->bytes.size() - cursor_ : 0;
+    }
+
+    // Same errors the native handles give for the wrong direction
+    void check_read() const {
+        if (mode_ == FileSystem::Mode::OUTPUT || mode_ == FileSystem::Mode::APPEND) {
+            throw_bad_mode();
+        }
+    }
+
+    // Write src, then a newline if newline is set, as one change to the file
+    void write_bytes(const char* src, size_t n, bool newline) {
+        if (mode_ == FileSystem::Mode::INPUT) {
+            throw_bad_mode();
+        }
+        drop_peek();
+        size_t total = n + (newline ? 1 : 0);
+        if (total == 0) return;
+        std::lock_guard<std::mutex> lock(file_->mutex);
+        std::vector<char>& bytes = file_->bytes;
+        if (mode_ == FileSystem::Mode::APPEND) {
+            // Always at the end, as with O_APPEND, whatever others wrote
+            cursor_ = bytes.size();
+        }
+        if (cursor_ + total > bytes.size()) {
+            // Writing past the end leaves zeros in any gap, like a file hole
+            bytes.resize(cursor_ + total);
+        }
+        std::memcpy(bytes.data() + cursor_, src, n);
+        if (newline) {
+            bytes[cursor_ + n] = '\n';
+        }
+        cursor_ += total;
+    }
+
+    std::shared_ptr<MemoryFile> file_;
+    FileSystem::Mode mode_;
+    int record_length_;
+    size_t cursor_ = 0;
+
+    // What the last peek() copied, and how much of it has been consumed
+    std::string peek_buffer_;
+    size_t peek_pos_ = 0;
+};
+
+} // namespace
+
+// ============================================================================
+// MemoryFileSystem Implementation
+// ============================================================================
+
+std::unique_ptr<FileHandle> MemoryFileSystem::open(
+    const std::string& filename,
+    Mode mode,
+    int record_length,
+    [[maybe_unused]] bool shared) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(filename);
+    if (it == files_.end()) {
+        if (mode == Mode::INPUT) {
+            return nullptr;
+        }
+        it = files_.emplace(filename, std::make_shared<MemoryFile>()).first;
+    } else if (mode == Mode::OUTPUT) {
+        // Truncate in place, so handles still open on the file see it too
+        std::lock_guard<std::mutex> file_lock(it->second->mutex);
+        it->second->bytes.clear();
+    }
+    return std::make_unique<MemoryFileHandle>(it->second, mode, record_length);
+}
+
+bool MemoryFileSystem::exists(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.count(filename) != 0;
+}
+
+bool MemoryFileSystem::remove(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.erase(filename) != 0;
+}
+
+bool MemoryFileSystem::rename(const std::string& old_name, const std::string& new_name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(old_name);
+    if (it == files_.end()) {
+        return false;
+    }
+    auto data = it->second;
+    files_.erase(it);
+    files_[new_name] = std::move(data);
+    return true;
+}
+
+void MemoryFileSystem::put(const std::string& filename, const std::string& contents) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto file = std::make_shared<MemoryFile>();
+    file->bytes.assign(contents.begin(), contents.end());
+    files_[filename] = std::move(file);
+}
+
+std::optional<std::string> MemoryFileSystem::get(const std::string& filename) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(filename);
+    if (it == files_.end()) {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> file_lock(it->second->mutex);
+    return std::string(it->second->bytes.begin(), it->second->bytes.end());
+}
+
+std::vector<std::string> MemoryFileSystem::list() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> names;
+    for (const auto& [name, file] : files_) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+bool MemoryFileSystem::seed_from(const std::string& directory) {
+    DIR* dir = ::opendir(directory.c_str());
+    if (!dir) {
+        return false;
+    }
+    while (struct dirent* entry = ::readdir(dir)) {
+        std::string path = directory + "/" + entry->d_name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        std::ifstream in(path, std::ios::binary);
+        auto file = std::make_shared<MemoryFile>();
+        file->bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_[entry->d_name] = std::move(file);
+    }
+    ::closedir(dir);
+    return true;
+}
+
+bool MemoryFileSystem::dump_to(const std::string& directory) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool ok = true;
+    for (const auto& [name, file] : files_) {
+        std::ofstream out(directory + "/" + name, std::ios::binary | std::ios::trunc);
+        std::lock_guard<std::mutex> file_lock(file->mutex);
+        out.write(file->bytes.data(), static_cast<std::streamsize>(file->bytes.size()));
+        if (!out) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+} // namespace mbasic
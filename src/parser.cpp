@@ -327,6 +327,8 @@ Stmt Parser::parse_statement() {
         case TokenType::PUT: advance(); return parse_put();
         case TokenType::LSET: advance(); return parse_lset();
         case TokenType::RSET: advance(); return parse_rset();
+        case TokenType::LOCK: advance(); return parse_lock();
+        case TokenType::UNLOCK: advance(); return parse_unlock();
         case TokenType::WRITE: advance(); return parse_write();
         case TokenType::CHAIN: advance(); return parse_chain();
         case TokenType::COMMON: advance(); return parse_common();
@@ -1143,8 +1145,10 @@ Stmt Parser::parse_width() {
     stmt->line = current().line;
     stmt->column = current().column;
 
-    // WIDTH #n, w or WIDTH w
-    if (match(TokenType::HASH)) {
+    // WIDTH #n, w, WIDTH LPRINT w or WIDTH w
+    if (match(TokenType::LPRINT)) {
+        stmt->printer = true;
+    } else if (match(TokenType::HASH)) {
         stmt->file_number = parse_expression();
         expect(TokenType::COMMA, "Expected ',' after file number");
     }
@@ -1233,7 +1237,7 @@ Stmt Parser::parse_open() {
             stmt->record_length = parse_expression();
         }
     } else if (check(TokenType::FOR)) {
-        // Modern syntax: OPEN filename FOR mode AS #n [LEN = reclen]
+        // Modern syntax: OPEN filename FOR mode [SHARED] AS #n [LEN = reclen]
         stmt->filename = std::move(first_expr);
 
         expect(TokenType::FOR, "Expected FOR in OPEN");
@@ -1250,6 +1254,11 @@ Stmt Parser::parse_open() {
             throw ParseError("Expected INPUT, OUTPUT, APPEND, or RANDOM", current().line, current().column);
         }
 
+        // Optional SHARED: other processes may update the file at the same time
+        if (match(TokenType::SHARED)) {
+            stmt->shared = true;
+        }
+
         expect(TokenType::AS, "Expected AS in OPEN");
         match(TokenType::HASH);  // Optional #
         stmt->file_number = parse_expression();
@@ -1369,6 +1378,45 @@ Stmt Parser::parse_rset() {
     return Stmt{std::move(stmt)};
 }
 
+Stmt Parser::parse_lock() {
+    auto stmt = std::make_unique<LockStmt>();
+    stmt->line = current().line;
+    stmt->column = current().column;
+
+    match(TokenType::HASH);
+    stmt->file_number = parse_expression();
+    parse_lock_range(stmt->first_record, stmt->last_record);
+
+    return Stmt{std::move(stmt)};
+}
+
+Stmt Parser::parse_unlock() {
+    auto stmt = std::make_unique<UnlockStmt>();
+    stmt->line = current().line;
+    stmt->column = current().column;
+
+    match(TokenType::HASH);
+    stmt->file_number = parse_expression();
+    parse_lock_range(stmt->first_record, stmt->last_record);
+
+    return Stmt{std::move(stmt)};
+}
+
+// Record range of LOCK/UNLOCK: [, [first] [TO last]]
+void Parser::parse_lock_range(std::optional<Expr>& first, std::optional<Expr>& last) {
+    if (!match(TokenType::COMMA)) {
+        return;
+    }
+    if (!check(TokenType::TO)) {
+        first = parse_expression();
+    }
+    if (match(TokenType::TO)) {
+        last = parse_expression();
+    } else if (!first) {
+        throw ParseError("Expected record number", current().line, current().column);
+    }
+}
+
 Stmt Parser::parse_write() {
     auto stmt = std::make_unique<WriteStmt>();
     stmt->line = current().line;
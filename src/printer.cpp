@@ -0,0 +1,229 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Printer Implementation - column tracking and the spooling writer thread
+
+#include "mbasic/printer.hpp"
+#include "mbasic/error.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace mbasic {
+
+// ============================================================================
+// Printer
+// ============================================================================
+
+void Printer::print(std::string_view text) {
+    if (width_ >= UNLIMITED_WIDTH || width_ <= 0) {
+        write(text);
+        column_ = advance_column(column_, text);
+        return;
+    }
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        size_t line = nl == std::string_view::npos ? text.size() : nl;
+        size_t room = column_ < width_ ? static_cast<size_t>(width_ - column_) : 0;
+        if (line > room) {
+            // The rest of this line doesn't fit: fill the line and go on
+            // with the next one
+            write(text.substr(0, room));
+            write("\n");
+            column_ = 0;
+            text.remove_prefix(room);
+            continue;
+        }
+        size_t n = nl == std::string_view::npos ? text.size() : nl + 1;
+        write(text.substr(0, n));
+        column_ = advance_column(column_, text.substr(0, n));
+        text.remove_prefix(n);
+    }
+}
+
+// ============================================================================
+// SpoolPrinter::Impl - single-producer, single-consumer ring buffer
+// ============================================================================
+// head and tail count bytes since the start, so head - tail is the amount
+// queued and the ring position is the count masked by the size. Only the
+// program thread moves head and only the writer moves tail. Each side sets
+// its waiting flag under the mutex before sleeping and the other checks the
+// flag after moving its counter (all sequentially consistent), so a wakeup
+// can't be missed.
+
+struct SpoolPrinter::Impl {
+    std::string path;
+    std::vector<char> ring;
+    size_t mask = 0;
+
+    std::atomic<size_t> head{0};        // Bytes queued by the program
+    std::atomic<size_t> tail{0};        // Bytes written (or dropped) by the writer
+    std::atomic<int> error{0};          // errno of a failure not yet reported
+    std::atomic<bool> stop{false};
+    std::atomic<bool> writer_waiting{false};
+    std::atomic<bool> program_waiting{false};
+
+    std::mutex mutex;                   // Only for sleeping
+    std::condition_variable writer_cv;
+    std::condition_variable program_cv;
+
+    int fd = -1;                        // Used by the writer thread only
+    std::thread thread;                 // Last, so it starts after everything it uses
+
+    Impl(std::string p, size_t size) : path(std::move(p)) {
+        size_t capacity = 1;
+        while (capacity < std::max<size_t>(size, 1)) capacity <<= 1;
+        ring.resize(capacity);
+        mask = capacity - 1;
+        thread = std::thread([this] { run(); });
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop.store(true);
+        }
+        writer_cv.notify_one();
+        thread.join();
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void check_error() {
+        int err = error.exchange(0);
+        if (err != 0) {
+            throw RuntimeError(ErrorCode::DEVICE_FAULT,
+                               "Device fault: " + path + ": " + system_error_text(err));
+        }
+    }
+
+    // Program side: queue text, waiting for room when the ring is full
+    void push(const char* data, size_t size) {
+        while (size > 0) {
+            check_error();
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t space = ring.size() - (h - tail.load());
+            if (space == 0) {
+                wait_for([&] { return tail.load() != h - ring.size() || error.load() != 0; });
+                continue;
+            }
+            size_t n = std::min(size, space);
+            size_t pos = h & mask;
+            size_t first = std::min(n, ring.size() - pos);
+            std::memcpy(ring.data() + pos, data, first);
+            std::memcpy(ring.data(), data + first, n - first);
+            head.store(h + n);
+            if (writer_waiting.load()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                writer_cv.notify_one();
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    // Program side: wait until everything queued has been written
+    void drain() {
+        size_t h = head.load(std::memory_order_relaxed);
+        wait_for([&] { return tail.load() == h; });
+        check_error();
+    }
+
+    template<typename Ready>
+    void wait_for(Ready ready) {
+        std::unique_lock<std::mutex> lock(mutex);
+        program_waiting.store(true);
+        program_cv.wait(lock, ready);
+        program_waiting.store(false);
+    }
+
+    // Writer side: mark bytes up to t as done
+    void advance_tail(size_t t) {
+        tail.store(t);
+        if (program_waiting.load()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            program_cv.notify_one();
+        }
+    }
+
+    // Writer side: give up on the device until more output arrives
+    void fail(int err, size_t h) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        error.store(err);
+        advance_tail(h);
+    }
+
+    void run() {
+        // A pipe whose reader has gone reports EPIPE instead of killing the
+        // process; the signal stays pending on this thread and dies with it
+        sigset_t pipe_signal;
+        sigemptyset(&pipe_signal);
+        sigaddset(&pipe_signal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+
+        for (;;) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t h = head.load();
+            if (h == t) {
+                if (stop.load()) break;
+                std::unique_lock<std::mutex> lock(mutex);
+                writer_waiting.store(true);
+                writer_cv.wait(lock, [&] { return head.load() != t || stop.load(); });
+                writer_waiting.store(false);
+                continue;
+            }
+            if (error.load() != 0) {
+                // Output queued before the program saw the failure is dropped
+                advance_tail(h);
+                continue;
+            }
+            if (fd < 0) {
+                fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+                if (fd < 0) {
+                    fail(errno, h);
+                    continue;
+                }
+            }
+            size_t pos = t & mask;
+            size_t n = std::min(h - t, ring.size() - pos);
+            ssize_t written = ::write(fd, ring.data() + pos, n);
+            if (written < 0) {
+                if (errno != EINTR) fail(errno, h);
+                continue;
+            }
+            advance_tail(t + static_cast<size_t>(written));
+        }
+    }
+};
+
+SpoolPrinter::SpoolPrinter(std::string path, size_t buffer_size)
+    : impl_(std::make_unique<Impl>(std::move(path), buffer_size)) {}
+
+SpoolPrinter::~SpoolPrinter() = default;
+
+void SpoolPrinter::write(std::string_view text) {
+    impl_->push(text.data(), text.size());
+}
+
+void SpoolPrinter::flush() {
+    impl_->drain();
+}
+
+const std::string& SpoolPrinter::path() const {
+    return impl_->path;
+}
+
+} // namespace mbasic
@@ -18,8 +18,8 @@
 
 namespace mbasic {
 
-// Global for pre-input hook
-static std::string g_prefill_text;
+// Text for the pre-input hook, which runs on the thread calling readline()
+static thread_local std::string g_prefill_text;
 
 // Pre-input hook for readline - inserts text before user input
 // macOS editline uses (const char*, int) signature, GNU readline uses (void)
@@ -0,0 +1,53 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// mbasic-run - run mbasicc in a process forked by a resident zygote
+// (mbasicc --zygote). The arguments go to mbasicc as they are; standard
+// input, output and error and the working directory are this process's,
+// and the exit status is the job's.
+
+#include "mbasic/zygote.hpp"
+#include "mbasic/error.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+
+namespace {
+
+void usage() {
+    std::cout << "Usage: mbasic-run [--socket=PATH] [mbasicc options] [filename.bas]\n\n";
+    std::cout << "Run mbasicc in a process forked by a zygote started with mbasicc --zygote,\n";
+    std::cout << "skipping its start-up (and parsing, with --zygote-cache).\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --socket=PATH   Zygote socket (default " << mbasic::default_zygote_socket() << ")\n";
+    std::cout << "  --help, -h      Show this help (mbasicc --help lists the other options)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string socket_path = mbasic::default_zygote_socket();
+    std::vector<std::string> args = {"mbasicc"};
+
+    int arg = 1;
+    if (arg < argc && std::string(argv[arg]).rfind("--socket=", 0) == 0) {
+        socket_path = argv[arg] + 9;
+        arg++;
+    }
+    if (arg < argc && (std::string(argv[arg]) == "--help" || std::string(argv[arg]) == "-h")) {
+        usage();
+        return 0;
+    }
+    for (; arg < argc; ++arg) {
+        args.push_back(argv[arg]);
+    }
+
+    int status = mbasic::run_zygote_job(socket_path, args);
+    if (status < 0) {
+        std::cerr << "mbasic-run: " << socket_path << ": " << mbasic::system_error_text(errno)
+                  << "\n";
+        return 1;
+    }
+    return status;
+}
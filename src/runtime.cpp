@@ -5,120 +5,118 @@
 namespace mbasic {
 
 // ============================================================================
-// StatementTable
+// CompiledProgram
 // ============================================================================
 
-const std::string StatementTable::empty_string_;
-
-void StatementTable::build(Program& program) {
-    table_.clear();
-    line_first_stmt_.clear();
-    line_numbers_.clear();
-    line_text_.clear();
-
+std::shared_ptr<const CompiledProgram> CompiledProgram::compile(Program program) {
+    auto compiled = std::make_shared<CompiledProgram>();
+    compiled->def_type_map_ = std::move(program.def_type_map);
     for (auto& line : program.lines) {
         int line_num = line.line_number;
-        line_numbers_.push_back(line_num);
-        line_first_stmt_[line_num] = 0;
-        line_text_[line_num] = line.source_text;
-
-        for (size_t i = 0; i < line.statements.size(); ++i) {
-            table_[{line_num, static_cast<int>(i)}] = &line.statements[i];
-        }
+        compiled->lines_[line_num] = std::make_shared<const Line>(std::move(line));
     }
-
-    std::sort(line_numbers_.begin(), line_numbers_.end());
+    compiled->index();
+    return compiled;
 }
 
-void StatementTable::merge(Program& program) {
-    // Merge lines from another program
-    // Existing line numbers are replaced, new ones are added
+std::shared_ptr<const CompiledProgram> CompiledProgram::merge(Program program) const {
+    // Existing line numbers are replaced, new ones are added; the DEF types
+    // stay those of this program
+    auto merged = std::make_shared<CompiledProgram>();
+    merged->def_type_map_ = def_type_map_;
+    merged->lines_ = lines_;
     for (auto& line : program.lines) {
         int line_num = line.line_number;
+        merged->lines_[line_num] = std::make_shared<const Line>(std::move(line));
+    }
+    merged->index();
+    return merged;
+}
 
-        // First, remove any existing statements for this line
-        auto it = table_.begin();
-        while (it != table_.end()) {
-            if (it->first.first == line_num) {
-                it = table_.erase(it);
-            } else {
-                ++it;
-            }
-        }
-
-        // Store the line in our persistent storage
-        auto stored_line = std::make_unique<Line>(std::move(line));
-
-        // Add the new statements
-        line_first_stmt_[line_num] = 0;
-        line_text_[line_num] = stored_line->source_text;
+void CompiledProgram::index() {
+    data_values_.clear();
+    data_lines_.clear();
+    user_functions_.clear();
 
-        for (size_t i = 0; i < stored_line->statements.size(); ++i) {
-            table_[{line_num, static_cast<int>(i)}] = &stored_line->statements[i];
-        }
-
-        // Check if this line number is already in line_numbers_
-        auto pos = std::lower_bound(line_numbers_.begin(), line_numbers_.end(), line_num);
-        if (pos == line_numbers_.end() || *pos != line_num) {
-            // Insert new line number in sorted order
-            line_numbers_.insert(pos, line_num);
+    for (const auto& [line_num, line] : lines_) {
+        for (const auto& stmt : line->statements) {
+            if (auto* data = std::get_if<std::unique_ptr<DataStmt>>(&stmt)) {
+                data_lines_.emplace(line_num, data_values_.size());
+                for (const auto& val : (*data)->values) {
+                    data_values_.push_back(val);
+                }
+            } else if (auto* def = std::get_if<std::unique_ptr<DefFnStmt>>(&stmt)) {
+                user_functions_[(*def)->name] = def->get();
+            }
         }
-
-        // Keep the line alive
-        merged_lines_.push_back(std::move(stored_line));
     }
 }
 
-Stmt* StatementTable::get(const PC& pc) {
-    auto it = table_.find({pc.line, pc.stmt});
-    return (it != table_.end()) ? it->second : nullptr;
+const Stmt* CompiledProgram::get(const PC& pc) const {
+    auto it = lines_.find(pc.line);
+    if (it == lines_.end() || pc.stmt < 0 ||
+        static_cast<size_t>(pc.stmt) >= it->second->statements.size()) {
+        return nullptr;
+    }
+    return &it->second->statements[static_cast<size_t>(pc.stmt)];
 }
 
-PC StatementTable::first() const {
-    if (line_numbers_.empty()) {
+PC CompiledProgram::first() const {
+    if (lines_.empty()) {
         return PC::halted();
     }
-    return PC::running_at(line_numbers_.front(), 0);
+    return PC::running_at(lines_.begin()->first, 0);
 }
 
-PC StatementTable::next(const PC& current) const {
+PC CompiledProgram::next(const PC& current) const {
     // Try next statement on same line
-    auto it = table_.find({current.line, current.stmt + 1});
-    if (it != table_.end()) {
+    if (valid(PC::running_at(current.line, current.stmt + 1))) {
         return PC::running_at(current.line, current.stmt + 1);
     }
 
     // Find next line
-    auto line_it = std::upper_bound(line_numbers_.begin(), line_numbers_.end(), current.line);
-    if (line_it == line_numbers_.end()) {
+    auto line_it = lines_.upper_bound(current.line);
+    if (line_it == lines_.end()) {
         return PC::halted();
     }
 
-    return PC::running_at(*line_it, 0);
+    return PC::running_at(line_it->first, 0);
 }
 
-PC StatementTable::find_line(int line_num) const {
-    auto it = line_first_stmt_.find(line_num);
-    if (it == line_first_stmt_.end()) {
+PC CompiledProgram::find_line(int line_num) const {
+    if (lines_.find(line_num) == lines_.end()) {
         return PC::halted(StopReason::ERROR);
     }
-    return PC::running_at(line_num, it->second);
+    return PC::running_at(line_num, 0);
+}
+
+bool CompiledProgram::valid(const PC& pc) const {
+    return get(pc) != nullptr;
+}
+
+std::string_view CompiledProgram::line_text(int line_num) const {
+    auto it = lines_.find(line_num);
+    return (it != lines_.end()) ? std::string_view(it->second->source_text) : std::string_view();
 }
 
-bool StatementTable::valid(const PC& pc) const {
-    return table_.find({pc.line, pc.stmt}) != table_.end();
+size_t CompiledProgram::data_index(int line_num) const {
+    // First DATA at or after the line; the end if there is none
+    auto it = data_lines_.lower_bound(line_num);
+    return (it != data_lines_.end()) ? it->second : data_values_.size();
 }
 
-const std::string& StatementTable::line_text(int line_num) const {
-    auto it = line_text_.find(line_num);
-    return (it != line_text_.end()) ? it->second : empty_string_;
+const DefFnStmt* CompiledProgram::user_function(const std::string& name) const {
+    auto it = user_functions_.find(name);
+    return (it != user_functions_.end()) ? it->second : nullptr;
 }
 
 // ============================================================================
 // Runtime
 // ============================================================================
 
-Runtime::Runtime() {
+Runtime::Runtime()
+    : program(CompiledProgram::compile(Program{})), filesystem(FileSystem::create_native()),
+      rnd_engine(std::random_device{}()) {
     // Initialize default types (all SINGLE)
     for (char c = 'a'; c <= 'z'; ++c) {
         def_type_map[c] = VarType::SINGLE;
@@ -129,28 +127,19 @@ Runtime::Runtime() {
     variables_["erl%"] = int16_t{0};
 }
 
-void Runtime::load(Program& program) {
-    // Copy DEF type map
-    def_type_map = program.def_type_map;
-
-    // Build statement table
-    statements.build(program);
+void Runtime::load(std::shared_ptr<const CompiledProgram> compiled) {
+    program = std::move(compiled);
 
-    // Collect DATA values
-    collect_data(program);
-
-    // Collect user functions
-    user_functions.clear();
-    for (auto& line : program.lines) {
-        for (auto& stmt : line.statements) {
-            if (auto* def = std::get_if<std::unique_ptr<DefFnStmt>>(&stmt)) {
-                user_functions[(*def)->name] = def->get();
-            }
-        }
-    }
+    // Copy DEF type map
+    def_type_map = program->def_types();
 
     // Set PC to first statement
-    pc = statements.first();
+    data_ptr = 0;
+    pc = program->first();
+}
+
+void Runtime::load(Program source) {
+    load(CompiledProgram::compile(std::move(source)));
 }
 
 void Runtime::reset() {
@@ -165,7 +154,7 @@ void Runtime::reset() {
     arrays_.clear();
 
     // Reset execution state
-    pc = statements.first();
+    pc = program->first();
     next_pc = std::nullopt;
     exec_stack.clear();
     for_states.clear();
@@ -181,18 +170,50 @@ void Runtime::reset() {
     error_handler_is_gosub = false;
 
     // Close files
-    for (auto& [num, file] : files) {
-        if (file.is_open()) file.close();
-    }
+    close_files();
+}
+
+void Runtime::close_files() {
+    // Detach the handles first so a failed flush still leaves no files open
+    auto open_files = std::move(files);
     files.clear();
     field_buffers.clear();
+    field_index.clear();
+    for (auto& [num, file] : open_files) {
+        file->close();
+    }
+}
+
+void Runtime::drop_fields(int filenum) {
+    auto it = field_buffers.find(filenum);
+    if (it == field_buffers.end()) {
+        return;
+    }
+    for (const auto& field : it->second.bindings) {
+        // A later FIELD on another file may have taken the variable over
+        auto ref = field_index.find(field.name);
+        if (ref != field_index.end() && ref->second.buffer == &it->second) {
+            field_index.erase(ref);
+        }
+    }
+    field_buffers.erase(it);
+}
+
+void Runtime::flush_files() {
+    for (auto& [num, file] : files) {
+        file->flush();
+    }
+}
+
+void Runtime::flush_due_files(bool waiting) {
+    for (auto& [num, file] : files) {
+        file->flush_due(waiting);
+    }
 }
 
 void Runtime::clear() {
+    program = CompiledProgram::compile(Program{});
     reset();
-    data_values.clear();
-    data_line_map.clear();
-    user_functions.clear();
     breakpoints.clear();
 }
 
@@ -218,6 +239,14 @@ bool Runtime::has_variable(const std::string& name) const {
     return variables_.find(name) != variables_.end();
 }
 
+Value& Runtime::variable_storage(const std::string& name) {
+    auto it = variables_.find(name);
+    if (it == variables_.end()) {
+        it = variables_.emplace(name, default_for_type(resolve_type(name))).first;
+    }
+    return it->second;
+}
+
 // ============================================================================
 // Array Access
 // ============================================================================
@@ -308,52 +337,16 @@ size_t Runtime::array_index(const ArrayData& arr, const std::vector<int>& indice
 // DATA/READ
 // ============================================================================
 
-void Runtime::collect_data(Program& program) {
-    data_values.clear();
-    data_line_map.clear();
-
-    for (const auto& line : program.lines) {
-        for (const auto& stmt : line.statements) {
-            if (auto* data = std::get_if<std::unique_ptr<DataStmt>>(&stmt)) {
-                size_t start_idx = data_values.size();
-                data_line_map[line.line_number] = start_idx;
-
-                for (const auto& val : (*data)->values) {
-                    data_values.push_back(val);
-                }
-            }
-        }
-    }
-
-    data_ptr = 0;
-}
-
 Value Runtime::read_data() {
-    if (data_ptr >= data_values.size()) {
+    const auto& values = program->data();
+    if (data_ptr >= values.size()) {
         throw RuntimeError(ErrorCode::OUT_OF_DATA, "Out of DATA");
     }
-    return data_values[data_ptr++];
+    return values[data_ptr++];
 }
 
 void Runtime::restore_data(std::optional<int> line) {
-    if (!line) {
-        data_ptr = 0;
-    } else {
-        auto it = data_line_map.find(*line);
-        if (it != data_line_map.end()) {
-            data_ptr = it->second;
-        } else {
-            // Find first DATA at or after the specified line
-            for (const auto& [ln, idx] : data_line_map) {
-                if (ln >= *line) {
-                    data_ptr = idx;
-                    return;
-                }
-            }
-            // No DATA found at or after line, restore to end
-            data_ptr = data_values.size();
-        }
-    }
+    data_ptr = line ? program->data_index(*line) : 0;
 }
 
 // ============================================================================
@@ -35,6 +35,9 @@ static const std::unordered_map<std::string, TokenType> keywords = {
     {"reset", TokenType::RESET},
     {"rset", TokenType::RSET},
     {"append", TokenType::APPEND},
+    {"lock", TokenType::LOCK},
+    {"unlock", TokenType::UNLOCK},
+    {"shared", TokenType::SHARED},
 
     // Control flow
     {"all", TokenType::ALL},
@@ -214,6 +217,9 @@ std::string token_type_name(TokenType t) {
         case TokenType::RESET: return "RESET";
         case TokenType::RSET: return "RSET";
         case TokenType::APPEND: return "APPEND";
+        case TokenType::LOCK: return "LOCK";
+        case TokenType::UNLOCK: return "UNLOCK";
+        case TokenType::SHARED: return "SHARED";
         case TokenType::ALL: return "ALL";
         case TokenType::CALL: return "CALL";
         case TokenType::CHAIN: return "CHAIN";
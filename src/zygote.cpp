@@ -0,0 +1,409 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Zygote - fork a ready interpreter for each job sent over a Unix socket
+
+#include "mbasic/zygote.hpp"
+#include "mbasic/error.hpp"
+#include <iostream>
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace mbasic {
+
+namespace {
+
+// A request is REQUEST_MAGIC followed by the arguments, each ending in a
+// NUL, in one SOCK_SEQPACKET message carrying JOB_FDS descriptors: standard
+// input, output, error and the working directory. The reply is the exit
+// status as an int32_t.
+constexpr char REQUEST_MAGIC[4] = {'M', 'B', 'Z', '1'};
+constexpr size_t MAX_REQUEST = 64 * 1024;
+constexpr int JOB_FDS = 4;
+
+// Write end of the pipe that wakes the poll loop (child exits, signals)
+int g_wake_fd = -1;
+volatile std::sig_atomic_t g_stop = 0;
+
+void wake() {
+    int saved = errno;
+    char c = 0;
+    [[maybe_unused]] ssize_t n = ::write(g_wake_fd, &c, 1);
+    errno = saved;
+}
+
+void on_child(int) {
+    wake();
+}
+
+void on_stop(int) {
+    g_stop = 1;
+    wake();
+}
+
+struct Connection {
+    int fd = -1;
+    pid_t pid = -1;             // Job running for this client, once forked
+    bool abandoned = false;     // Client went away; the job was sent SIGTERM
+};
+
+int listen_on(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    auto* sa = reinterpret_cast<sockaddr*>(&addr);
+
+    // A socket someone answers on belongs to a running zygote; one nobody
+    // answers on was left behind by one that died
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            return -1;
+        }
+        int probe = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && ::connect(probe, sa, sizeof(addr)) == 0) {
+            ::close(probe);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        if (probe >= 0) ::close(probe);
+        ::unlink(path.c_str());
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    mode_t old_mask = ::umask(077);
+    int result = ::bind(fd, sa, sizeof(addr));
+    ::umask(old_mask);
+    if (result != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+bool same_user(int fd) {
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           cred.uid == ::geteuid();
+}
+
+void close_all(const int* fds, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (fds[i] >= 0) ::close(fds[i]);
+    }
+}
+
+// Read a request. Returns 1 with job and fds filled in, 0 if there is
+// nothing to read yet, or -1 if the client closed or sent garbage.
+int receive_job(int fd, ZygoteJob& job, int fds[JOB_FDS]) {
+    std::string buffer(MAX_REQUEST, '\0');
+    iovec iov{buffer.data(), buffer.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * JOB_FDS)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+
+    int received = 0;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); n >= 0 && c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int passed;
+            std::memcpy(&passed, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (received < JOB_FDS) {
+                fds[received++] = passed;
+            } else {
+                ::close(passed);
+            }
+        }
+    }
+
+    size_t size = n > 0 ? static_cast<size_t>(n) : 0;
+    if (received != JOB_FDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        size <= sizeof(REQUEST_MAGIC) ||
+        std::memcmp(buffer.data(), REQUEST_MAGIC, sizeof(REQUEST_MAGIC)) != 0 ||
+        buffer[size - 1] != '\0') {
+        close_all(fds, received);
+        return -1;
+    }
+
+    job.args.clear();
+    size_t pos = sizeof(REQUEST_MAGIC);
+    while (pos < size) {
+        size_t end = buffer.find('\0', pos);
+        job.args.push_back(buffer.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    job.cwd_fd = fds[3];
+    return 1;
+}
+
+void send_status(int fd, int status) {
+    int32_t value = status;
+    [[maybe_unused]] ssize_t n = ::send(fd, &value, sizeof(value), MSG_NOSIGNAL);
+}
+
+// Exit status the way a shell reports it
+int exit_status(int wait_status) {
+    if (WIFSIGNALED(wait_status)) return 128 + WTERMSIG(wait_status);
+    return WEXITSTATUS(wait_status);
+}
+
+} // namespace
+
+std::string default_zygote_socket() {
+    const char* dir = std::getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) return std::string(dir) + "/mbasicc.sock";
+    return "/tmp/mbasicc-" + std::to_string(::getuid()) + ".sock";
+}
+
+int run_zygote(const ZygoteOptions& options) {
+    // Received descriptors must not land on 0, 1 or 2, where the child
+    // puts them
+    int null_fd;
+    while ((null_fd = ::open("/dev/null", O_RDWR)) >= 0 && null_fd <= 2) {
+    }
+    if (null_fd > 2) ::close(null_fd);
+
+    int wake_pipe[2];
+    if (::pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        std::cerr << "Error: " << system_error_text(errno) << "\n";
+        return 1;
+    }
+    int listener = listen_on(options.socket_path);
+    if (listener < 0) {
+        std::cerr << "Error: Could not listen on " << options.socket_path << ": "
+                  << system_error_text(errno) << "\n";
+        ::close(wake_pipe[0]);
+        ::close(wake_pipe[1]);
+        return 1;
+    }
+    g_wake_fd = wake_pipe[1];
+    g_stop = 0;
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGCHLD, on_child);
+    std::signal(SIGINT, on_stop);
+    std::signal(SIGTERM, on_stop);
+
+    std::vector<Connection> connections;
+
+    // Send the status of every job that has ended and drop its connection
+    auto reap = [&](int flags) {
+        int wait_status;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &wait_status, flags)) > 0) {
+            for (size_t i = 0; i < connections.size(); ++i) {
+                if (connections[i].pid != pid) continue;
+                send_status(connections[i].fd, exit_status(wait_status));
+                ::close(connections[i].fd);
+                connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i));
+                break;
+            }
+        }
+    };
+
+    while (!g_stop) {
+        std::vector<pollfd> fds;
+        fds.push_back({wake_pipe[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        for (const auto& connection : connections) {
+            fds.push_back({connection.fd, static_cast<short>(connection.abandoned ? 0 : POLLIN), 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: poll: " << system_error_text(errno) << "\n";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drain[256];
+            while (::read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        std::vector<size_t> closed;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            Connection& connection = connections[i];
+            if (connection.abandoned || !(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            if (connection.pid > 0) {
+                // A client says nothing once its job is running, so this
+                // is it going away
+                ::kill(connection.pid, SIGTERM);
+                connection.abandoned = true;
+                continue;
+            }
+
+            ZygoteJob job;
+            int job_fds[JOB_FDS] = {-1, -1, -1, -1};
+            int got = receive_job(connection.fd, job, job_fds);
+            if (got == 0) continue;
+            if (got < 0) {
+                closed.push_back(i);
+                continue;
+            }
+
+            if (options.before_fork) options.before_fork(job);
+            std::cout.flush();
+            std::fflush(nullptr);
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                // The job: nothing of the zygote's but what it prepared
+                ::close(listener);
+                ::close(wake_pipe[0]);
+                ::close(wake_pipe[1]);
+                for (const auto& other : connections) {
+                    ::close(other.fd);
+                }
+                std::signal(SIGPIPE, SIG_DFL);
+                std::signal(SIGCHLD, SIG_DFL);
+                std::signal(SIGINT, SIG_DFL);
+                std::signal(SIGTERM, SIG_DFL);
+                for (int fd = 0; fd < 3; ++fd) {
+                    ::dup2(job_fds[fd], fd);
+                }
+                if (::fchdir(job_fds[3]) != 0) {
+                    std::cerr << "Error: Could not enter the working directory: "
+                              << system_error_text(errno) << "\n";
+                    std::exit(1);
+                }
+                close_all(job_fds, JOB_FDS);
+                job.cwd_fd = -1;
+                std::exit(options.run(job));
+            }
+
+            close_all(job_fds, JOB_FDS);
+            if (pid < 0) {
+                send_status(connection.fd, 1);
+                closed.push_back(i);
+            } else {
+                connection.pid = pid;
+            }
+        }
+        for (size_t i = closed.size(); i-- > 0;) {
+            ::close(connections[closed[i]].fd);
+            connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(closed[i]));
+        }
+
+        reap(WNOHANG);
+
+        if (fds[1].revents & POLLIN) {
+            for (;;) {
+                int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) break;
+                if (!same_user(fd)) {
+                    ::close(fd);
+                    continue;
+                }
+                connections.push_back({fd});
+            }
+        }
+    }
+
+    // Stop taking jobs, end the running ones and tell their clients
+    ::close(listener);
+    ::unlink(options.socket_path.c_str());
+    for (const auto& connection : connections) {
+        if (connection.pid > 0) ::kill(connection.pid, SIGTERM);
+    }
+    reap(0);
+    for (const auto& connection : connections) {
+        ::close(connection.fd);
+    }
+
+    std::signal(SIGCHLD, SIG_DFL);
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    g_wake_fd = -1;
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    return 0;
+}
+
+int run_zygote_job(const std::string& socket_path, const std::vector<std::string>& args,
+                   int in_fd, int out_fd, int err_fd) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    std::string request(REQUEST_MAGIC, sizeof(REQUEST_MAGIC));
+    for (const auto& arg : args) {
+        request += arg;
+        request += '\0';
+    }
+    if (args.empty() || request.size() > MAX_REQUEST) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int cwd_fd = -1;
+    int status = -1;
+    int32_t value = 0;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        (cwd_fd = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+        int passed[JOB_FDS] = {in_fd, out_fd, err_fd, cwd_fd};
+        iovec iov{request.data(), request.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(passed))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(passed));
+        std::memcpy(CMSG_DATA(c), passed, sizeof(passed));
+
+        if (::sendmsg(fd, &msg, MSG_NOSIGNAL) >= 0) {
+            ssize_t n;
+            while ((n = ::recv(fd, &value, sizeof(value), 0)) < 0 && errno == EINTR) {
+            }
+            if (n == sizeof(value)) {
+                status = value;
+            } else if (n >= 0) {
+                errno = ECONNRESET;     // The zygote went away
+            }
+        }
+    }
+    int saved = errno;
+    if (cwd_fd >= 0) ::close(cwd_fd);
+    ::close(fd);
+    errno = saved;
+    return status;
+}
+
+} // namespace mbasic
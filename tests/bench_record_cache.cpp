@@ -0,0 +1,127 @@
+// MBASICC - MBASIC 5.21 C++ Interpreter
+// https://github.com/avwohl/mbasicc
+//
+// Record cache benchmark - replays a GET/PUT access trace against a random
+// file with different record cache settings.
+//
+// Usage: bench_record_cache [trace-file]
+//
+// A trace has one access per line: "G <record>" or "P <record>". Without a
+// trace file, a lookup-table workload is generated: 90% of GETs go to 300
+// hot records out of 100000, with a PUT every 50 accesses.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "mbasic/file_handler.hpp"
+
+using namespace mbasic;
+
+struct Access {
+    bool put;
+    int record;
+};
+
+constexpr int RECORD_LENGTH = 128;
+
+std::vector<Access> generate_trace(int records) {
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> hot(1, 300);
+    std::uniform_int_distribution<int> cold(1, records);
+    std::uniform_int_distribution<int> percent(1, 100);
+
+    std::vector<Access> trace;
+    for (int i = 0; i < 1000000; ++i) {
+        int record = percent(rng) <= 90 ? hot(rng) : cold(rng);
+        trace.push_back({i % 50 == 0, record});
+    }
+    return trace;
+}
+
+bool load_trace(const char* filename, std::vector<Access>& trace) {
+    std::ifstream in(filename);
+    if (!in) return false;
+    char op;
+    int record;
+    while (in >> op >> record) {
+        if (record >= 1) trace.push_back({op == 'P' || op == 'p', record});
+    }
+    return true;
+}
+
+void replay(const std::string& label, const std::string& name,
+            const std::vector<Access>& trace, const FileOptions& base) {
+    FileOptions options = base;
+    options.stats = std::make_shared<FileStats>();
+    auto fs = FileSystem::create_native(options);
+
+    char rec[RECORD_LENGTH];
+    std::memset(rec, 'x', sizeof(rec));
+
+    auto start = std::chrono::steady_clock::now();
+    auto f = fs->open(name, FileSystem::Mode::RANDOM, RECORD_LENGTH);
+    for (const auto& access : trace) {
+        if (access.put) {
+            f->write_record(access.record, rec, RECORD_LENGTH);
+        } else {
+            f->read_record(access.record, rec, RECORD_LENGTH);
+        }
+    }
+    f->close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const FileStats& stats = *options.stats;
+    std::printf("%-24s %8.3f s %10.0f accesses/s  hits %9llu  misses %9llu  reads %9llu  writes %7llu\n",
+                label.c_str(), seconds, trace.size() / seconds,
+                static_cast<unsigned long long>(stats.record_cache_hits),
+                static_cast<unsigned long long>(stats.record_cache_misses),
+                static_cast<unsigned long long>(stats.read_calls),
+                static_cast<unsigned long long>(stats.write_calls));
+}
+
+int main(int argc, char* argv[]) {
+    const int records = 100000;
+    std::vector<Access> trace;
+    if (argc > 1) {
+        if (!load_trace(argv[1], trace)) {
+            std::cerr << "Cannot read trace: " << argv[1] << "\n";
+            return 1;
+        }
+    } else {
+        trace = generate_trace(records);
+    }
+
+    // Size the file to cover every record in the trace
+    int highest = records;
+    for (const auto& access : trace) highest = std::max(highest, access.record);
+    std::string name = "bench_record_cache_" + std::to_string(::getpid()) + ".tmp";
+    {
+        auto f = FileSystem::create_native()->open(name, FileSystem::Mode::RANDOM, RECORD_LENGTH);
+        char rec[RECORD_LENGTH];
+        std::memset(rec, ' ', sizeof(rec));
+        for (int r = 1; r <= highest; ++r) f->write_record(r, rec, RECORD_LENGTH);
+        f->close();
+    }
+
+    std::cout << trace.size() << " accesses, " << highest << " records of "
+              << RECORD_LENGTH << " bytes\n";
+
+    FileOptions options;
+    replay("no cache", name, trace, options);
+    for (int capacity : {64, 512, 4096}) {
+        options.record_cache_records = capacity;
+        options.record_cache_write_back = false;
+        replay("cache " + std::to_string(capacity), name, trace, options);
+        options.record_cache_write_back = true;
+        replay("cache " + std::to_string(capacity) + " write-back", name, trace, options);
+    }
+
+    std::remove(name.c_str());
+    return 0;
+}
@@ -0,0 +1,910 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "mbasic/file_handler.hpp"
+#include "mbasic/memory_fs.hpp"
+#include "mbasic/error.hpp"
+
+using namespace mbasic;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        tests_passed++;
+        std::cout << "  PASS: " << name << "\n";
+    } else {
+        tests_failed++;
+        std::cout << "  FAIL: " << name << "\n";
+    }
+}
+
+// Unique scratch file name in the working directory
+std::string temp_name(const std::string& tag) {
+    return "test_file_io_" + std::to_string(::getpid()) + "_" + tag + ".tmp";
+}
+
+void test_sequential() {
+    std::cout << "\n=== Sequential File Tests ===\n";
+
+    auto fs = FileSystem::create_native();
+    std::string name = temp_name("seq");
+
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    test("Open for output", out != nullptr);
+    for (int i = 0; i < 10000; ++i) {
+        out->write_line("line " + std::to_string(i));
+    }
+    out->write("no newline");
+    test("Length tracks buffered writes", out->length() == 98900);
+    out->close();
+
+    auto app = fs->open(name, FileSystem::Mode::APPEND);
+    app->write("!\n");
+    app->close();
+
+    auto in = fs->open(name, FileSystem::Mode::INPUT);
+    std::string line;
+    int count = 0;
+    bool in_order = true;
+    while (!in->eof() && in->read_line(line)) {
+        if (count < 10000 && line != "line " + std::to_string(count)) in_order = false;
+        count++;
+    }
+    test("Read back every line", count == 10001 && in_order);
+    test("Append lands at end", line == "no newline!");
+    test("Read past end fails", !in->read_line(line));
+    in->close();
+
+    auto chars = fs->open(name, FileSystem::Mode::INPUT);
+    test("read_chars", chars->read_chars(7) == "line 0\n");
+    test("read_chars continues", chars->read_chars(4) == "line");
+    chars->close();
+
+    test("Missing file is not opened", fs->open(temp_name("missing"), FileSystem::Mode::INPUT) == nullptr);
+    test("Remove", fs->remove(name) && !fs->exists(name));
+}
+
+// Size of a file as seen by another reader
+long disk_size(const std::string& name) {
+    FILE* f = std::fopen(name.c_str(), "rb");
+    if (!f) return -1;
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fclose(f);
+    return size;
+}
+
+void test_metadata() {
+    std::cout << "\n=== LOF/LOC/EOF Tests ===\n";
+
+    std::string name = temp_name("meta");
+    FileOptions options;
+    options.stats = std::make_shared<FileStats>();
+    auto fs = FileSystem::create_native(options);
+
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    out->write(std::string(300, 'm'));
+    test("LOC counts 128-byte blocks written", out->position() == 3);
+    out->close();
+
+    auto in = fs->open(name, FileSystem::Mode::INPUT);
+    uint64_t reads = options.stats->read_calls;
+    test("EOF and LOF without reading", !in->eof() && in->length() == 300 &&
+                                        options.stats->read_calls == reads);
+    in->read_chars(200);
+    test("LOC counts 128-byte blocks read", in->position() == 2);
+    in->read_chars(100);
+    reads = options.stats->read_calls;
+    test("EOF at end without reading", in->eof() && options.stats->read_calls == reads);
+    in->close();
+
+    auto rnd = fs->open(name, FileSystem::Mode::RANDOM, 100);
+    test("Record length from OPEN", rnd->record_length() == 100);
+    test("LOC before any GET", rnd->position() == 0);
+    rnd->close();
+
+    std::remove(name.c_str());
+}
+
+void test_write_behind() {
+    std::cout << "\n=== Write-Behind Tests ===\n";
+
+    std::string name = temp_name("wb");
+
+    auto fs = FileSystem::create_native();
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    out->write("hello\n");
+    test("Output stays buffered", disk_size(name) == 0);
+    out->flush();
+    test("Flush writes it out", disk_size(name) == 6);
+    out->close();
+
+    FileOptions sync;
+    sync.sync_writes = true;
+    auto sync_fs = FileSystem::create_native(sync);
+    auto synced = sync_fs->open(name, FileSystem::Mode::APPEND);
+    synced->write("world\n");
+    test("sync_writes writes every statement", disk_size(name) == 12);
+    synced->close();
+
+    std::remove(name.c_str());
+}
+
+void test_input_items() {
+    std::cout << "\n=== INPUT# Item Tests ===\n";
+
+    auto fs = FileSystem::create_native();
+    std::string name = temp_name("items");
+
+    std::string head = "  12, -3.5D2 7\r\n"
+                       "\"a, \" junk,\"quoted\" tail ,plain text  ,\n"
+                       "\n\n  next line\n";
+    // Followed by an unquoted item straddling the first buffer refill
+    size_t long_len = 65536 - head.size() - 3;
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    out->write(head + std::string(long_len, 'x') + ",abcdef,\"q");
+    out->close();
+
+    auto f = fs->open(name, FileSystem::Mode::INPUT);
+    std::string scratch;
+    std::string_view item;
+    auto next = [&](bool string_item) {
+        return read_input_item(*f, string_item, scratch, item) ? std::string(item) : std::string("<eof>");
+    };
+    test("Number after leading spaces", next(false) == "12");
+    test("Number with D exponent", next(false) == "-3.5D2");
+    test("Space ends a number", next(false) == "7");
+    test("Quoted string keeps comma and space", next(true) == "a, ");
+    test("Text after closing quote is skipped", next(true) == "quoted");
+    test("Unquoted string drops trailing spaces", next(true) == "plain text");
+    test("Items continue onto later lines", next(true) == "next line");
+    test("Long item", next(false).size() == long_len);
+    test("Item across a buffer refill", next(true) == "abcdef");
+    test("End of file ends a quoted item", next(true) == "q");
+    test("Past end of file", next(true) == "<eof>");
+    f->close();
+
+    out = fs->open(name, FileSystem::Mode::OUTPUT);
+    out->write(std::string(300, 'y') + "\n");
+    out->close();
+    f = fs->open(name, FileSystem::Mode::INPUT);
+    test("Unquoted string stops at 255 characters", next(true).size() == 255 && next(true).size() == 45);
+    f->close();
+
+    // Delimiters past the first scan window
+    out = fs->open(name, FileSystem::Mode::OUTPUT);
+    out->write(std::string(100, 'a') + "," + std::string(70, '1') + "\t2\r\n");
+    out->close();
+    f = fs->open(name, FileSystem::Mode::INPUT);
+    test("Items longer than a scan window", next(true) == std::string(100, 'a') &&
+         next(false) == std::string(70, '1') && next(false) == "2" && next(true) == "<eof>");
+    f->close();
+
+    std::remove(name.c_str());
+}
+
+void test_read_ahead() {
+    std::cout << "\n=== Read-Ahead Tests ===\n";
+
+    std::string name = temp_name("ahead");
+    auto fs = FileSystem::create_native();
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    for (int i = 0; i < 100000; ++i) {
+        out->write_line(std::to_string(i));
+    }
+    out->close();
+
+    FileOptions options;
+    options.read_ahead = true;
+    options.stats = std::make_shared<FileStats>();
+    auto ahead_fs = FileSystem::create_native(options);
+    auto in = ahead_fs->open(name, FileSystem::Mode::INPUT);
+    std::string line;
+    int count = 0;
+    bool in_order = true;
+    while (in->read_line(line)) {
+        if (line != std::to_string(count)) in_order = false;
+        count++;
+    }
+    test("Read-ahead returns every line in order", count == 100000 && in_order);
+    test("Read-ahead buffers were used",
+         options.stats->read_ahead_hits + options.stats->read_ahead_waits > 0);
+    test("Stats count every byte", options.stats->bytes_read == static_cast<uint64_t>(in->length()));
+    in->close();
+
+    std::remove(name.c_str());
+}
+
+void test_compressed() {
+    std::cout << "\n=== Compressed File Tests ===\n";
+
+    if (!CompressedFileHandle::compressed_extension("file.gz")) {
+        std::cout << "  (built without zlib, skipped)\n";
+        return;
+    }
+
+    std::string name = temp_name("gz") + ".gz";
+    auto fs = FileSystem::create_native();
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    size_t plain_size = 0;
+    for (int i = 0; i < 100000; ++i) {
+        std::string line = "record " + std::to_string(i) + ",\"same text every time\"";
+        out->write_line(line);
+        plain_size += line.size() + 1;
+    }
+    test("LOC counts uncompressed blocks",
+         out->position() == static_cast<int64_t>((plain_size + 127) / 128));
+    out->close();
+
+    std::FILE* raw = std::fopen(name.c_str(), "rb");
+    unsigned char magic[2] = {0, 0};
+    if (raw) {
+        std::fread(magic, 1, 2, raw);
+        std::fclose(raw);
+    }
+    test("Output is gzip", magic[0] == 0x1f && magic[1] == 0x8b);
+    test("Output is compressed", disk_size(name) < static_cast<int64_t>(plain_size) / 4);
+
+    auto app = fs->open(name, FileSystem::Mode::APPEND);
+    app->write_line("appended");
+    app->close();
+
+    auto in = fs->open(name, FileSystem::Mode::INPUT);
+    test("LOF is the compressed size", in->length() == disk_size(name));
+    std::string line, scratch;
+    std::string_view item;
+    int count = 0;
+    bool in_order = true;
+    while (count < 100000 && read_input_item(*in, true, scratch, item)) {
+        if (item != "record " + std::to_string(count)) in_order = false;
+        read_input_item(*in, true, scratch, item);
+        count++;
+    }
+    test("INPUT# reads every item across blocks", count == 100000 && in_order);
+    test("Appended member is read", in->read_line(line) && line == "appended" && in->eof());
+    bool bad_mode = false;
+    try {
+        char rec[16];
+        in->read_record(1, rec, sizeof(rec));
+    } catch (const RuntimeError& e) {
+        bad_mode = e.error_code == ErrorCode::BAD_FILE_MODE;
+    }
+    test("GET on a compressed file is a bad file mode", bad_mode);
+    in->close();
+
+    // A file cut short is an error, not a silent end of file
+    ::truncate(name.c_str(), disk_size(name) / 2);
+    in = fs->open(name, FileSystem::Mode::INPUT);
+    bool truncated = false;
+    try {
+        while (in->read_line(line)) {
+        }
+    } catch (const RuntimeError& e) {
+        truncated = e.error_code == ErrorCode::DISK_IO_ERROR;
+    }
+    test("Truncated file reports Disk I/O error", truncated);
+    in->close();
+    std::remove(name.c_str());
+
+    auto rnd = fs->open(name, FileSystem::Mode::RANDOM, 16);
+    char rec[16];
+    std::memset(rec, 'r', sizeof(rec));
+    rnd->write_record(1, rec, sizeof(rec));
+    rnd->close();
+    test("RANDOM files are not compressed", disk_size(name) == 16);
+    std::remove(name.c_str());
+
+    FileOptions options;
+    options.compressed_files = false;
+    out = FileSystem::create_native(options)->open(name, FileSystem::Mode::OUTPUT);
+    out->write_line("plain");
+    out->close();
+    test("compressed_files off writes plain text", disk_size(name) == 6);
+    std::remove(name.c_str());
+}
+
+void test_zstd() {
+    std::cout << "\n=== Zstandard File Tests ===\n";
+
+    if (!CompressedFileHandle::compressed_extension("file.zst")) {
+        std::cout << "  (built without zstd, skipped)\n";
+        return;
+    }
+
+    std::string name = temp_name("zst") + ".zst";
+    auto fs = FileSystem::create_native();
+    auto out = fs->open(name, FileSystem::Mode::OUTPUT);
+    size_t plain_size = 0;
+    for (int i = 0; i < 100000; ++i) {
+        std::string line = "record " + std::to_string(i) + ",\"same text every time\"";
+        out->write_line(line);
+        plain_size += line.size() + 1;
+        if (i == 50000) out->flush();   // Ends a block mid-frame
+    }
+    out->close();
+
+    std::FILE* raw = std::fopen(name.c_str(), "rb");
+    unsigned char magic[4] = {0, 0, 0, 0};
+    if (raw) {
+        std::fread(magic, 1, 4, raw);
+        std::fclose(raw);
+    }
+    test("Output is zstd", magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd);
+    test("Output is compressed", disk_size(name) < static_cast<int64_t>(plain_size) / 4);
+
+    auto app = fs->open(name, FileSystem::Mode::APPEND);
+    app->write_line("appended");
+    app->close();
+
+    auto in = fs->open(name, FileSystem::Mode::INPUT);
+    std::string line;
+    int count = 0;
+    bool in_order = true;
+    while (count < 100000 && in->read_line(line)) {
+        if (line != "record " + std::to_string(count) + ",\"same text every time\"") in_order = false;
+        count++;
+    }
+    test("Every line comes back", count == 100000 && in_order);
+    test("Appended frame is read", in->read_line(line) && line == "appended" && in->eof());
+    in->close();
+
+    ::truncate(name.c_str(), disk_size(name) / 2);
+    in = fs->open(name, FileSystem::Mode::INPUT);
+    bool truncated = false;
+    try {
+        while (in->read_line(line)) {
+        }
+    } catch (const RuntimeError& e) {
+        truncated = e.error_code == ErrorCode::DISK_IO_ERROR;
+    }
+    test("Truncated file reports Disk I/O error", truncated);
+    in->close();
+    std::remove(name.c_str());
+}
+
+void test_random() {
+    std::cout << "\n=== Random File Tests ===\n";
+
+    auto fs = FileSystem::create_native();
+    std::string name = temp_name("rnd");
+    const int reclen = 32;
+
+    auto f = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    test("Random file is created", f != nullptr && fs->exists(name));
+
+    char rec[reclen];
+    for (int r = 200; r >= 1; --r) {
+        std::memset(rec, 'A' + r % 26, reclen);
+        f->seek_record(r, reclen);
+        f->write_raw(rec, reclen);
+    }
+    test("LOF after PUTs", f->length() == 200 * reclen);
+
+    bool all_match = true;
+    for (int r = 1; r <= 200; r += 7) {
+        f->seek_record(r, reclen);
+        int n = f->read_raw(rec, reclen);
+        if (n != reclen || rec[0] != 'A' + r % 26 || rec[reclen - 1] != 'A' + r % 26) all_match = false;
+    }
+    test("GET sees PUT records", all_match);
+
+    f->seek_record(201, reclen);
+    test("Read past end is short", f->read_raw(rec, reclen) == 0);
+
+    // Overwrite inside an existing read window
+    f->seek_record(3, reclen);
+    f->read_raw(rec, reclen);
+    std::memset(rec, 'z', reclen);
+    f->seek_record(4, reclen);
+    f->write_raw(rec, reclen);
+    f->seek_record(4, reclen);
+    f->read_raw(rec, reclen);
+    test("Read after overwrite", rec[0] == 'z');
+    f->close();
+
+    auto g = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    g->seek_record(4, reclen);
+    g->read_raw(rec, reclen);
+    test("Overwrite persisted", rec[0] == 'z' && g->length() == 200 * reclen);
+    g->close();
+
+    std::remove(name.c_str());
+}
+
+void test_record_cache() {
+    std::cout << "\n=== PUT Batching Tests ===\n";
+
+    auto fs = FileSystem::create_native();
+    std::string name = temp_name("put");
+    const int reclen = 16;
+    char rec[reclen];
+
+    auto f = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    // Two contiguous runs (1-50, 60-100) written out of order
+    for (int r = 100; r >= 1; --r) {
+        if (r > 50 && r < 60) continue;
+        std::memset(rec, 'a' + r % 26, reclen);
+        f->write_record(r, rec, reclen);
+    }
+    test("PUTs are held back", disk_size(name) == 0);
+    test("LOF counts held-back records", f->length() == 100 * reclen);
+    test("LOC is the last record written", f->position() == 1);
+
+    f->read_record(60, rec, reclen);
+    test("GET sees a held-back record", rec[0] == 'a' + 60 % 26);
+    f->seek_record(49, reclen);
+    char two[2 * reclen];
+    f->read_raw(two, 2 * reclen);
+    test("Raw reads see held-back records", two[0] == 'a' + 49 % 26 && two[reclen] == 'a' + 50 % 26);
+
+    std::memset(rec, '#', reclen);
+    f->write_record(49, rec, reclen);
+    f->read_record(49, rec, reclen);
+    test("Re-PUT replaces the cached record", rec[0] == '#');
+
+    f->flush();
+    test("Flush writes every record", disk_size(name) == 100 * reclen);
+    f->close();
+
+    auto g = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    bool all_match = true;
+    for (int r = 1; r <= 100; ++r) {
+        if (r > 50 && r < 60) continue;
+        g->read_record(r, rec, reclen);
+        char want = r == 49 ? '#' : static_cast<char>('a' + r % 26);
+        if (rec[0] != want || rec[reclen - 1] != want) all_match = false;
+    }
+    test("Batched records persisted", all_match);
+    g->read_record(55, rec, reclen);
+    test("Gap between runs is empty", rec[0] == '\0');
+    g->close();
+
+    FileOptions durable;
+    durable.durability = FileOptions::Durability::RECORDS;
+    durable.sync_every_records = 2;
+    auto durable_fs = FileSystem::create_native(durable);
+    auto d = durable_fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    d->write_record(101, rec, reclen);
+    test("Durability N holds records until N", disk_size(name) == 100 * reclen);
+    d->write_record(102, rec, reclen);
+    test("Durability N writes after N PUTs", disk_size(name) == 102 * reclen);
+    d->close();
+
+    std::remove(name.c_str());
+}
+
+void test_record_lru() {
+    std::cout << "\n=== Record Cache Tests ===\n";
+
+    std::string name = temp_name("lru");
+    const int reclen = 8;
+    char rec[reclen];
+
+    for (bool write_back : {false, true}) {
+        std::string mode = write_back ? " (write-back)" : " (write-through)";
+        FileOptions options;
+        options.record_cache_records = 4;
+        options.record_cache_write_back = write_back;
+        options.stats = std::make_shared<FileStats>();
+        auto fs = FileSystem::create_native(options);
+
+        std::remove(name.c_str());
+        auto f = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+        for (int r = 1; r <= 10; ++r) {
+            std::memset(rec, '0' + r % 10, reclen);
+            f->write_record(r, rec, reclen);
+        }
+        test("LOF counts cached PUTs" + mode, f->length() == 10 * reclen);
+
+        // Records 7-10 are cached; 1 is not
+        f->read_record(9, rec, reclen);
+        f->read_record(10, rec, reclen);
+        f->read_record(1, rec, reclen);
+        test("Hits and misses are counted" + mode,
+             options.stats->record_cache_hits == 2 && options.stats->record_cache_misses == 1);
+        test("Evicted record reads back" + mode, rec[0] == '1');
+
+        f->seek_record(7, reclen);
+        char raw[4 * reclen];
+        int got = f->read_raw(raw, 4 * reclen);
+        test("Raw reads see cached PUTs" + mode, got == 4 * reclen && raw[0] == '7' && raw[3 * reclen] == '0');
+        test("EOF after the last record" + mode, f->eof());
+
+        test("Past end is not cached" + mode, f->read_record(11, rec, reclen) == 0 && f->length() == 10 * reclen);
+        f->close();
+        test("CLOSE writes every record" + mode, disk_size(name) == 10 * reclen);
+    }
+
+    std::remove(name.c_str());
+}
+
+void test_large_random() {
+    std::cout << "\n=== Large Random File Tests ===\n";
+
+    // Record 10,000,000 of 512 bytes starts past 5 GB; the file stays sparse
+    const int reclen = 512;
+    const int64_t far_record = 10000000;
+    const int64_t far_end = far_record * reclen;
+    // The record a 32-bit offset would wrap around to
+    const int64_t alias_record = far_record - (int64_t(1) << 32) / reclen;
+
+    FileOptions mapped;
+    mapped.mmap_random = true;
+    for (const FileOptions& options : {FileOptions{}, mapped}) {
+        std::string label = options.mmap_random ? "Mapped: " : "Buffered: ";
+        std::string name = temp_name("large");
+        auto fs = FileSystem::create_native(options);
+        auto f = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+
+        char rec[reclen];
+        std::memset(rec, 'L', sizeof(rec));
+        try {
+            f->write_record(1, rec, reclen);
+            f->write_record(far_record, rec, reclen);
+            f->flush();
+        } catch (const RuntimeError& e) {
+            // A file system without large file support
+            std::cout << "  (" << e.what() << ", skipped)\n";
+            f->close();
+            std::remove(name.c_str());
+            continue;
+        }
+        test(label + "LOF past 4 GB", f->length() == far_end && disk_size(name) == far_end);
+        test(label + "LOC is the 64-bit record number", f->position() == far_record);
+
+        std::memset(rec, 0, sizeof(rec));
+        test(label + "Far record reads back",
+             f->read_record(far_record, rec, reclen) == reclen && rec[0] == 'L' && rec[reclen - 1] == 'L');
+        std::memset(rec, 'x', sizeof(rec));
+        test(label + "No 32-bit wraparound",
+             f->read_record(alias_record, rec, reclen) == reclen && rec[0] == '\0');
+        f->close();
+
+        struct stat st;
+        test(label + "File is sparse",
+             ::stat(name.c_str(), &st) == 0 && st.st_blocks * 512 < 64 * 1024 * 1024);
+        std::remove(name.c_str());
+    }
+}
+
+void test_record_locks() {
+    std::cout << "\n=== Record Locking Tests ===\n";
+
+    std::string name = temp_name("lock");
+    const int reclen = 16;
+    auto fs = FileSystem::create_native();
+    auto a = fs->open(name, FileSystem::Mode::RANDOM, reclen, true);
+    auto b = fs->open(name, FileSystem::Mode::RANDOM, reclen, true);
+
+    test("Lock records", a->lock_records(1, 10));
+    test("Overlapping lock is refused", !b->lock_records(5, 5));
+    test("Whole-file lock is refused", !b->lock_records(0, 0));
+    test("Disjoint lock is granted", b->lock_records(11, 20));
+    a->unlock_records(1, 10);
+    test("Unlocked records can be locked", b->lock_records(5, 5));
+    b->unlock_records(5, 5);
+    b->unlock_records(11, 20);
+
+    char rec[reclen];
+    std::memset(rec, 'A', reclen);
+    a->write_record(3, rec, reclen);
+    std::memset(rec, 0, reclen);
+    test("SHARED PUT is seen by another handle at once",
+         b->read_record(3, rec, reclen) == reclen && rec[0] == 'A');
+    std::memset(rec, 'B', reclen);
+    b->write_record(3, rec, reclen);
+    a->read_record(3, rec, reclen);
+    test("SHARED GET rereads the file", rec[0] == 'B');
+    b->write_record(8, rec, reclen);
+    test("SHARED LOF follows other writers", a->length() == 8 * reclen);
+    a->close();
+    b->close();
+
+    // Worker processes bump a counter record under LOCK. Without the lock
+    // (or with stale caches) increments would be lost.
+    FileOptions cached;
+    cached.record_cache_records = 64;
+    cached.record_cache_write_back = true;
+    const int workers = 4;
+    const int rounds = 200;
+    std::memset(rec, 0, reclen);
+    auto init = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    init->write_record(1, rec, reclen);
+    init->close();
+    std::vector<pid_t> children;
+    for (int w = 0; w < workers; ++w) {
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            auto f = FileSystem::create_native(cached)->open(name, FileSystem::Mode::RANDOM, reclen);
+            char counter[reclen];
+            for (int i = 0; i < rounds; ++i) {
+                while (!f->lock_records(1, 1)) {
+                    ::usleep(100);
+                }
+                f->read_record(1, counter, reclen);
+                int value;
+                std::memcpy(&value, counter, sizeof(value));
+                ++value;
+                std::memcpy(counter, &value, sizeof(value));
+                f->write_record(1, counter, reclen);
+                f->unlock_records(1, 1);
+            }
+            f->close();
+            ::_exit(0);
+        }
+        children.push_back(pid);
+    }
+    bool children_ok = true;
+    for (pid_t pid : children) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) children_ok = false;
+    }
+    auto check = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    check->read_record(1, rec, reclen);
+    int total;
+    std::memcpy(&total, rec, sizeof(total));
+    check->close();
+    test("No lost updates between locking processes", children_ok && total == workers * rounds);
+
+    std::remove(name.c_str());
+}
+
+void test_descriptor_pool() {
+    std::cout << "\n=== Descriptor Pool Tests ===\n";
+
+    // Twelve files through three descriptors, written in turn
+    FileOptions options;
+    options.max_descriptors = 3;
+    options.stats = std::make_shared<FileStats>();
+    auto fs = FileSystem::create_native(options);
+    const int count = 12;
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<FileHandle>> files;
+    for (int i = 0; i < count; ++i) {
+        names.push_back(temp_name("pool" + std::to_string(i)));
+        files.push_back(fs->open(names[i], FileSystem::Mode::OUTPUT));
+    }
+    bool all_open = true;
+    for (auto& f : files) all_open = all_open && f && f->is_open();
+    test("More files open than descriptors", all_open);
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < count; ++i) {
+            files[i]->write_line("file " + std::to_string(i) + " line " + std::to_string(round));
+            files[i]->flush();
+        }
+    }
+    test("Evicted files reopen on demand", options.stats->descriptor_reopens > 0);
+    for (auto& f : files) f->close();
+    std::string line;
+    auto in = fs->open(names[7], FileSystem::Mode::INPUT);
+    in->read_line(line);
+    in->read_line(line);
+    test("Reopened OUTPUT file is not truncated", line == "file 7 line 1");
+    in->close();
+
+    // Random files keep their records across evictions
+    const int reclen = 8;
+    files.clear();
+    for (int i = 0; i < count; ++i) {
+        files.push_back(fs->open(names[i], FileSystem::Mode::RANDOM, reclen));
+    }
+    char rec[reclen];
+    for (int r = 1; r <= 5; ++r) {
+        for (int i = 0; i < count; ++i) {
+            std::snprintf(rec, sizeof(rec), "%02d-%02d", i, r);
+            files[i]->write_record(r, rec, reclen);
+            files[i]->flush();
+        }
+    }
+    bool records_ok = true;
+    for (int i = 0; i < count; ++i) {
+        char expect[reclen];
+        std::snprintf(expect, sizeof(expect), "%02d-%02d", i, 4);
+        records_ok = records_ok && files[i]->read_record(4, rec, reclen) == reclen &&
+                     std::strcmp(rec, expect) == 0;
+    }
+    test("GET after eviction reads the right file", records_ok);
+
+    // A LOCKed file keeps its descriptor, so the lock survives
+    test("Lock while pooled", files[0]->lock_records(1, 1));
+    for (int i = 1; i < count; ++i) files[i]->read_record(1, rec, reclen);
+    auto other = FileSystem::create_native()->open(names[0], FileSystem::Mode::RANDOM, reclen);
+    test("Lock survives other files' activity", !other->lock_records(1, 1));
+    files[0]->unlock_records(1, 1);
+    test("UNLOCK releases it", other->lock_records(1, 1));
+    other->close();
+
+    // KILL and NAME of open files
+    files[1]->read_record(1, rec, reclen);
+    fs->remove(names[2]);
+    fs->rename(names[3], names[3] + ".renamed");
+    for (int i = 4; i < count; ++i) files[i]->read_record(1, rec, reclen);
+    std::strcpy(rec, "killed");
+    files[2]->write_record(1, rec, reclen);
+    test("KILLed open file stays usable",
+         files[2]->read_record(1, rec, reclen) == reclen && std::strcmp(rec, "killed") == 0);
+    std::strcpy(rec, "renamed");
+    files[3]->write_record(2, rec, reclen);
+    files[3]->close();
+    auto renamed = fs->open(names[3] + ".renamed", FileSystem::Mode::RANDOM, reclen);
+    test("Renamed open file reopens under its new name",
+         renamed->read_record(2, rec, reclen) == reclen && std::strcmp(rec, "renamed") == 0);
+    renamed->close();
+    for (auto& f : files) f->close();
+
+    names[3] += ".renamed";
+    for (const auto& name : names) std::remove(name.c_str());
+}
+
+void test_devices() {
+    std::cout << "\n=== Device Tests ===\n";
+
+    auto fs = FileSystem::create_native();
+    std::string name = temp_name("pipe");
+
+    // Write through a command, then read its output back through another
+    auto out = fs->open("PIPE:tr a-z A-Z > " + name, FileSystem::Mode::OUTPUT);
+    test("Open output pipe", out && out->is_open());
+    out->write_line("hello, 42");
+    out->write("world");
+    out->close();
+    test("CLOSE waits for the command", disk_size(name) == 15);
+
+    auto in = fs->open("pipe:cat " + name, FileSystem::Mode::INPUT);
+    test("Device names ignore case", in && in->is_open());
+    std::string scratch;
+    std::string_view item;
+    read_input_item(*in, true, scratch, item);
+    test("INPUT# item from a pipe", item == "HELLO");
+    read_input_item(*in, false, scratch, item);
+    test("Numeric item from a pipe", item == "42");
+    std::string line;
+    test("LINE INPUT# of an unterminated last line", in->read_line(line) && line == "WORLD");
+    test("EOF after the command's output", in->eof());
+    in->close();
+
+    bool bad_mode = false;
+    try {
+        fs->open("PIPE:cat", FileSystem::Mode::RANDOM);
+    } catch (const RuntimeError& e) {
+        bad_mode = e.error_code == ErrorCode::BAD_FILE_MODE;
+    }
+    test("Devices can't be opened RANDOM", bad_mode);
+
+    std::remove(name.c_str());
+}
+
+void test_mapped() {
+    std::cout << "\n=== Mapped Random File Tests ===\n";
+
+    FileOptions options;
+    options.mmap_random = true;
+    auto fs = FileSystem::create_native(options);
+    std::string name = temp_name("mmap");
+    const int reclen = 32;
+    const int count = 40000;  // More than one growth chunk
+    char rec[reclen];
+
+    auto f = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    test("RANDOM opens mapped", dynamic_cast<MappedFileHandle*>(f.get()) != nullptr);
+    for (int r = 1; r <= count; ++r) {
+        std::snprintf(rec, reclen, "%-31d", r);
+        f->write_record(r, rec, reclen);
+    }
+    test("LOF after appends", f->length() == static_cast<int64_t>(count) * reclen);
+    test("File grows ahead of the records", disk_size(name) > static_cast<long>(count) * reclen);
+
+    f->read_record(12345, rec, reclen);
+    test("GET from mapping", std::atoi(rec) == 12345);
+    test("LOC is the last record read", f->position() == 12345);
+    test("GET past end is short", f->read_record(count + 1, rec, reclen) == 0);
+    f->close();
+    test("CLOSE trims the file", disk_size(name) == static_cast<long>(count) * reclen);
+
+    auto g = fs->open(name, FileSystem::Mode::RANDOM, reclen);
+    g->read_record(count, rec, reclen);
+    test("Records persisted", std::atoi(rec) == count);
+    std::memset(rec, 'x', reclen);
+    g->write_record(2, rec, reclen);
+    g->close();
+
+    auto plain = FileSystem::create_native()->open(name, FileSystem::Mode::RANDOM, reclen);
+    plain->read_record(2, rec, reclen);
+    test("Buffered handle sees mapped PUT", rec[0] == 'x' && plain->length() == static_cast<int64_t>(count) * reclen);
+    plain->close();
+
+    std::remove(name.c_str());
+}
+
+void test_memory_fs() {
+    std::cout << "\n=== Memory File System Tests ===\n";
+
+    MemoryFileSystem fs;
+    auto out = fs.open("seq.txt", FileSystem::Mode::OUTPUT);
+    out->write_line("first");
+    out->write("\"a, b\",42\n");
+    out->close();
+    auto app = fs.open("seq.txt", FileSystem::Mode::APPEND);
+    app->write_line("last");
+    app->close();
+    test("Sequential contents", fs.get("seq.txt") == std::string("first\n\"a, b\",42\nlast\n"));
+
+    auto in = fs.open("seq.txt", FileSystem::Mode::INPUT);
+    std::string line, scratch;
+    std::string_view item;
+    in->read_line(line);
+    bool items = read_input_item(*in, true, scratch, item) && item == "a, b" &&
+                 read_input_item(*in, false, scratch, item) && item == "42";
+    test("LINE INPUT# and INPUT# items", line == "first" && items);
+    in->read_line(line);
+    test("EOF at end", line == "last" && in->eof());
+    bool bad_mode = false;
+    try {
+        in->write("x");
+    } catch (const RuntimeError& e) {
+        bad_mode = e.error_code == ErrorCode::BAD_FILE_MODE;
+    }
+    test("Writing an input file is a bad file mode", bad_mode);
+    in->close();
+    test("Missing file is not opened", fs.open("none.txt", FileSystem::Mode::INPUT) == nullptr);
+
+    auto rnd = fs.open("rnd.dat", FileSystem::Mode::RANDOM, 16);
+    char rec[16];
+    std::memset(rec, 'r', sizeof(rec));
+    rnd->write_record(3, rec, 16);
+    test("Random LOF and LOC", rnd->length() == 48 && rnd->position() == 3);
+    test("Gap records read as zeros", rnd->read_record(1, rec, 16) == 16 && rec[0] == '\0');
+    test("Read past end is short", rnd->read_record(4, rec, 16) == 0);
+
+    test("Rename", fs.rename("rnd.dat", "moved.dat") && fs.exists("moved.dat") && !fs.exists("rnd.dat"));
+    test("Remove", fs.remove("moved.dat") && !fs.exists("moved.dat"));
+    rnd->write_record(1, rec, 16);
+    test("Removed file stays usable while open", rnd->length() == 48);
+    rnd->close();
+
+    char dir_template[] = "/tmp/mbasic_memfs_XXXXXX";
+    std::string dir = ::mkdtemp(dir_template);
+    test("Dump", fs.dump_to(dir) && disk_size(dir + "/seq.txt") == 21);
+    MemoryFileSystem seeded;
+    test("Seed", seeded.seed_from(dir) && seeded.get("seq.txt") == fs.get("seq.txt") &&
+                 seeded.list() == std::vector<std::string>{"seq.txt"});
+    std::remove((dir + "/seq.txt").c_str());
+    ::rmdir(dir.c_str());
+}
+
+int main() {
+    std::cout << "MBASIC File I/O Tests\n";
+    std::cout << "=====================\n";
+
+    test_sequential();
+    test_metadata();
+    test_write_behind();
+    test_input_items();
+    test_read_ahead();
+    test_compressed();
+    test_zstd();
+    test_random();
+    test_record_cache();
+    test_record_lru();
+    test_large_random();
+    test_record_locks();
+    test_descriptor_pool();
+    test_devices();
+    test_mapped();
+    test_memory_fs();
+
+    std::cout << "\n=====================\n";
+    std::cout << "Tests passed: " << tests_passed << "\n";
+    std::cout << "Tests failed: " << tests_failed << "\n";
+
+    return tests_failed > 0 ? 1 : 0;
+}
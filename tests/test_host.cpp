@@ -0,0 +1,261 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "mbasic/host.hpp"
+#include "mbasic/error.hpp"
+#include "mbasic/parser.hpp"
+
+using namespace mbasic;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        tests_passed++;
+        std::cout << "  PASS: " << name << "\n";
+    } else {
+        tests_failed++;
+        std::cout << "  FAIL: " << name << "\n";
+    }
+}
+
+// Output and results of every session, filled in by the host's callbacks
+struct Recorder {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<SessionHost::SessionId, std::string> output;
+    std::map<SessionHost::SessionId, SessionResult> results;
+
+    SessionHost::OutputCallback on_output() {
+        return [this](SessionHost::SessionId id, std::string_view text) {
+            std::lock_guard<std::mutex> lock(mutex);
+            output[id] += text;
+            changed.notify_all();
+        };
+    }
+
+    SessionHost::ExitCallback on_exit() {
+        return [this](SessionHost::SessionId id, const SessionResult& result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            results[id] = result;
+            changed.notify_all();
+        };
+    }
+
+    // Wait (up to a few seconds) until a session's output contains text
+    bool wait_for_output(SessionHost::SessionId id, const std::string& text) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return changed.wait_for(lock, std::chrono::seconds(5), [&] {
+            return output[id].find(text) != std::string::npos;
+        });
+    }
+
+    bool exited(SessionHost::SessionId id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return results.count(id) > 0;
+    }
+
+    bool wait_for_exit(SessionHost::SessionId id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return changed.wait_for(lock, std::chrono::seconds(5), [&] {
+            return results.count(id) > 0;
+        });
+    }
+};
+
+void test_many_sessions() {
+    std::cout << "\n=== Many Sessions ===\n";
+
+    HostOptions options;
+    options.workers = 4;
+    options.slice_statements = 50;
+    SessionHost host(options);
+    Recorder rec;
+
+    std::vector<SessionHost::SessionId> ids;
+    for (int i = 0; i < 200; ++i) {
+        std::string source = "10 S = 0\n20 FOR J = 1 TO 500\n30 S = S + J\n40 NEXT J\n"
+                             "50 PRINT " + std::to_string(i) + "; S\n";
+        ids.push_back(host.start(source, rec.on_output(), rec.on_exit()));
+    }
+    host.wait_idle();
+
+    bool all_right = true;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        std::string expected = " " + std::to_string(i) + "  125250 \n";
+        if (rec.output[ids[i]] != expected || rec.results[ids[i]].reason != StopReason::END) {
+            all_right = false;
+        }
+    }
+    test("Every session prints its own result", all_right);
+    test("No sessions left", host.session_count() == 0);
+
+    HostStats stats = host.stats();
+    test("Sessions counted", stats.sessions_started == 200 && stats.sessions_finished == 200);
+    test("Long sessions run in several slices", stats.slices > 200);
+}
+
+void test_time_slices() {
+    std::cout << "\n=== Time Slices ===\n";
+
+    // With one worker, a session that never ends must still let others run
+    HostOptions options;
+    options.workers = 1;
+    options.slice_statements = 100;
+    SessionHost host(options);
+    Recorder rec;
+
+    auto busy = host.start("10 GOTO 10\n", rec.on_output(), rec.on_exit());
+    auto quick = host.start("10 PRINT \"done\"\n", rec.on_output(), rec.on_exit());
+    test("Short session finishes beside an endless one", rec.wait_for_exit(quick));
+    test("Endless session is still running", !rec.exited(busy));
+
+    test("Cancel finds the session", host.cancel(busy));
+    test("Cancelled session ends", rec.wait_for_exit(busy));
+    test("Cancelled session reports BREAK", rec.results[busy].reason == StopReason::BREAK);
+    test("Finished sessions are unknown", !host.cancel(busy) && !host.provide_input(quick, "x"));
+}
+
+void test_input() {
+    std::cout << "\n=== Input ===\n";
+
+    HostOptions options;
+    options.workers = 2;
+    SessionHost host(options);
+    Recorder rec;
+
+    auto id = host.start("10 INPUT \"Number\"; A\n20 LINE INPUT \"Name: \"; N$\n"
+                         "30 PRINT A * 2; N$\n",
+                         rec.on_output(), rec.on_exit());
+    test("Prompt is delivered before input", rec.wait_for_output(id, "Number? "));
+    host.provide_input(id, "21");
+    test("Second prompt", rec.wait_for_output(id, "Name: "));
+    host.provide_input(id, "Ada");
+    test("Session ends after its input", rec.wait_for_exit(id));
+    test("Input reaches the program", rec.output[id] == "Number? Name:  42 Ada\n");
+
+    // Input queued ahead of the prompt is used when the prompt comes
+    auto early = host.start("10 INPUT A\n20 PRINT A + 1\n", rec.on_output(), rec.on_exit());
+    host.provide_input(early, "1");
+    test("Early input is kept", rec.wait_for_exit(early) && rec.output[early] == "?  2 \n");
+
+    // The console devices are the session's own console
+    auto device = host.start("10 OPEN \"O\", #1, \"STDOUT:\"\n20 PRINT #1, \"dev\";\n"
+                             "30 PRINT POS(0)\n40 OPEN \"I\", #2, \"STDIN:\"\n"
+                             "50 PRINT EOF(2)\n",
+                             rec.on_output(), rec.on_exit());
+    test("STDOUT: and STDIN: use the session's console",
+         rec.wait_for_exit(device) && rec.output[device] == "dev 4 \n-1 \n");
+
+    auto waiting = host.start("10 INPUT A\n", rec.on_output(), rec.on_exit());
+    test("Session waits for input", rec.wait_for_output(waiting, "? "));
+    host.cancel(waiting);
+    test("Cancel ends a session waiting for input",
+         rec.wait_for_exit(waiting) && rec.results[waiting].reason == StopReason::BREAK);
+}
+
+void test_parking() {
+    std::cout << "\n=== Parking ===\n";
+
+    // One worker: sessions waiting for input must not hold it
+    HostOptions options;
+    options.workers = 1;
+    SessionHost host(options);
+    Recorder rec;
+
+    std::vector<SessionHost::SessionId> waiting;
+    for (int i = 0; i < 50; ++i) {
+        waiting.push_back(host.start("10 A$ = INPUT$(2)\n20 PRINT A$\n",
+                                     rec.on_output(), rec.on_exit()));
+    }
+    auto busy = host.start("10 FOR I = 1 TO 1000: NEXT\n20 PRINT \"ok\"\n",
+                           rec.on_output(), rec.on_exit());
+    test("Others run while sessions wait for input", rec.wait_for_exit(busy));
+    bool none_exited = true;
+    for (auto id : waiting) {
+        if (rec.exited(id)) none_exited = false;
+    }
+    test("Waiting sessions are parked", none_exited && host.stats().parks >= 50);
+
+    // INPUT$ takes characters from as many lines as it needs
+    for (auto id : waiting) {
+        host.provide_input(id, "x");
+        host.provide_input(id, "yz");
+    }
+    host.wait_idle();
+    bool all_right = true;
+    for (auto id : waiting) {
+        if (rec.output[id] != "xy\n") all_right = false;
+    }
+    test("Parked sessions resume with their input", all_right);
+}
+
+void test_shared_program() {
+    std::cout << "\n=== Shared Program ===\n";
+
+    HostOptions options;
+    options.workers = 8;
+    options.slice_statements = 20;
+    SessionHost host(options);
+    Recorder rec;
+
+    // One parse for all sessions
+    auto program = CompiledProgram::compile(parse(
+        "10 DEF FNS(N) = N * (N + 1) / 2\n20 READ A, B\n30 FOR I = 1 TO A: T = T + I: NEXT\n"
+        "40 PRINT T; FNS(A); B\n50 DATA 100, 7\n"));
+    std::vector<SessionHost::SessionId> ids;
+    for (int i = 0; i < 64; ++i) {
+        ids.push_back(host.start(program, rec.on_output(), rec.on_exit()));
+    }
+    host.wait_idle();
+
+    bool all_right = true;
+    for (auto id : ids) {
+        if (rec.output[id] != " 5050  5050  7 \n") all_right = false;
+    }
+    test("Sessions run one compiled program at the same time", all_right);
+    test("Only the caller holds the program afterwards", program.use_count() == 1);
+}
+
+void test_errors() {
+    std::cout << "\n=== Errors ===\n";
+
+    SessionHost host;
+    Recorder rec;
+
+    auto id = host.start("10 PRINT 1 / 0\n", rec.on_output(), rec.on_exit());
+    host.wait_idle();
+    test("Runtime error is reported", rec.results[id].error &&
+                                      rec.results[id].error->code == ErrorCode::DIVISION_BY_ZERO);
+
+    bool thrown = false;
+    try {
+        host.start("10 PRINT (\n", rec.on_output(), rec.on_exit());
+    } catch (const MBasicError&) {
+        thrown = true;
+    }
+    test("Parse errors are thrown by start", thrown);
+}
+
+int main() {
+    std::cout << "MBASIC Session Host Tests\n";
+    std::cout << "=========================\n";
+
+    test_many_sessions();
+    test_time_slices();
+    test_input();
+    test_parking();
+    test_shared_program();
+    test_errors();
+
+    std::cout << "\n=====================\n";
+    std::cout << "Tests passed: " << tests_passed << "\n";
+    std::cout << "Tests failed: " << tests_failed << "\n";
+
+    return tests_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,500 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include "mbasic/parser.hpp"
+#include "mbasic/runtime.hpp"
+#include "mbasic/interpreter.hpp"
+#include "mbasic/io_handler.hpp"
+#include "mbasic/printer.hpp"
+#include "mbasic/file_handler.hpp"
+#include "mbasic/error.hpp"
+
+using namespace mbasic;
+
+// Count every heap allocation, so tests can check what a statement costs
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        tests_passed++;
+        std::cout << "  PASS: " << name << "\n";
+    } else {
+        tests_failed++;
+        std::cout << "  FAIL: " << name << "\n";
+    }
+}
+
+// Console that keeps everything printed
+class CaptureIO : public IOHandler {
+public:
+    std::string output;
+
+    void print(const std::string& text) override {
+        output += text;
+        column_ = advance_column(column_, text);
+    }
+    std::string input(const std::string&) override { return {}; }
+    std::optional<char> inkey() override { return std::nullopt; }
+    int get_column() const override { return column_; }
+    void set_column(int col) override { column_ = col; }
+    int get_width() const override { return 80; }
+    void set_width(int) override {}
+
+private:
+    int column_ = 0;
+};
+
+// Printer that keeps everything LPRINTed
+class CapturePrinter : public Printer {
+public:
+    std::string output;
+
+protected:
+    void write(std::string_view text) override { output += text; }
+};
+
+// Run a program and return what it printed
+std::string run(const std::string& source, std::shared_ptr<Printer> printer = nullptr) {
+    Program program = parse(source);
+    Runtime runtime;
+    runtime.load(std::move(program));
+    runtime.printer = std::move(printer);
+    CaptureIO io;
+    Interpreter interp(runtime, &io);
+    interp.run();
+    return io.output;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Heap allocations made by running source
+size_t allocations(const std::string& source) {
+    Program program = parse(source);
+    Runtime runtime;
+    runtime.load(std::move(program));
+    CaptureIO io;
+    io.output.reserve(1 << 20);
+    Interpreter interp(runtime, &io);
+    size_t before = g_allocations.load();
+    interp.run();
+    return g_allocations.load() - before;
+}
+
+void test_advance_column() {
+    std::cout << "\n=== Column Tracking Tests ===\n";
+
+    test("Plain text", advance_column(3, "abcd") == 7);
+    test("Newline resets", advance_column(10, "ab\ncde") == 3);
+    test("Only the last line counts", advance_column(0, "x\ny\n\nabcdefgh") == 8);
+    test("Tab moves to the next zone", advance_column(0, "ab\tc") == 15);
+    test("Tab at a zone boundary", advance_column(14, "\t") == 28);
+    test("Empty text", advance_column(5, "") == 5);
+}
+
+void test_print_format() {
+    std::cout << "\n=== PRINT Formatting Tests ===\n";
+
+    test("Numbers get a sign space and a trailing space",
+         run("10 PRINT 1;-2;3.5\n") == " 1 -2  3.5 \n");
+    test("Commas move to 14-column zones",
+         run("10 PRINT \"A\",\"B\"\n") == "A             B\n");
+    test("Zone after a long item",
+         run("10 PRINT \"abcdefghijklmnop\",\"x\"\n") ==
+         "abcdefghijklmnop            x\n");
+    test("Trailing semicolon keeps the line open",
+         run("10 PRINT \"a\";\n20 PRINT \"b\"\n") == "ab\n");
+    test("Zones continue from the console column",
+         run("10 PRINT \"abc\";\n20 PRINT ,\"d\"\n") == "abc           d\n");
+    test("TAB counts items earlier in the statement",
+         run("10 PRINT \"abc\";TAB(10);\"x\"\n") == "abc      x\n");
+    test("WRITE quotes strings and separates with commas",
+         run("10 WRITE \"a\",1,\"b\"\n") == "\"a\",1,\"b\"\n");
+    test("WRITE prints numbers without spaces",
+         run("10 WRITE -2,0.5,3\n") == "-2,0.5,3\n");
+    test("LPRINT follows the PRINT separator rules",
+         run("10 LPRINT \"a\";\n20 LPRINT \"b\",\"c\"\n") == "ab            c\n");
+    test("Number formatting is unchanged",
+         to_string(Value{2.5}) == " 2.5 " && to_string(Value{int16_t{-7}}) == "-7 " &&
+         to_string(Value{1.0 / 3.0}) == " 0.333333 " && to_string(Value{1e10}) == " 10000000000 ");
+}
+
+void test_printer() {
+    std::cout << "\n=== Printer Tests ===\n";
+
+    auto lpt = std::make_shared<CapturePrinter>();
+    std::string console = run("10 LPRINT \"ab\";\n20 X = POS(0): PRINT LPOS(0);X\n"
+                              "30 LPRINT TAB(6);\"c\"\n", lpt);
+    test("LPOS follows printer output", console == " 3  1 \n");
+    test("LPRINT doesn't reach the console", console.find("ab") == std::string::npos);
+    test("TAB in LPRINT counts printer columns", lpt->output == "ab   c\n");
+
+    lpt = std::make_shared<CapturePrinter>();
+    console = run("10 LPRINT \"abc\";LPOS(0);POS(0)\n20 PRINT \"de\";POS(0);LPOS(0)\n", lpt);
+    test("LPOS inside LPRINT counts the items before it", lpt->output == "abc 4  1 \n");
+    test("POS inside PRINT counts the items before it", console == "de 3  1 \n");
+
+    lpt = std::make_shared<CapturePrinter>();
+    run("10 WIDTH LPRINT 4\n20 LPRINT \"abcdefghij\"\n30 LPRINT \"xy\";\n40 LPRINT \"zzz\"\n", lpt);
+    test("WIDTH LPRINT breaks lines", lpt->output == "abcd\nefgh\nij\nxyzz\nz\n");
+
+    test("Without a printer LPRINT goes to the console",
+         run("10 PRINT \"x\";\n20 LPRINT \"y\"\n30 PRINT LPOS(0)\n") == "xy\n 1 \n");
+
+    // A ring much smaller than the output has to wrap many times
+    char dir_template[] = "/tmp/mbasic_printer_XXXXXX";
+    std::string dir = ::mkdtemp(dir_template);
+    std::string path = dir + "/spool.txt";
+    std::string expected;
+    {
+        SpoolPrinter spool(path, 64);
+        for (int i = 0; i < 2000; ++i) {
+            std::string line = "line " + std::to_string(i) + "\n";
+            spool.print(line);
+            expected += line;
+        }
+        spool.flush();
+        test("Spool file has everything after flush", read_file(path) == expected);
+        spool.print("tail");
+    }
+    test("Spool file is finished when the printer goes away", read_file(path) == expected + "tail");
+    ::unlink(path.c_str());
+
+    {
+        SpoolPrinter spool(dir + "/missing/spool.txt");
+        spool.print("x");
+        bool fault = false;
+        try {
+            spool.flush();
+        } catch (const RuntimeError& e) {
+            fault = e.error_code == ErrorCode::DEVICE_FAULT;
+        }
+        test("Unwritable spool reports Device fault", fault);
+        bool again = false;
+        try {
+            spool.flush();
+        } catch (const RuntimeError&) {
+            again = true;
+        }
+        test("A fault is reported once", !again);
+        spool.print("y");
+        try {
+            spool.flush();
+        } catch (const RuntimeError&) {
+            again = true;
+        }
+        test("New output tries the device again", again);
+    }
+    ::rmdir(dir.c_str());
+}
+
+// Run until the program ends or stops for input
+void run_ticks(Interpreter& interp) {
+    while (interp.tick()) {
+    }
+}
+
+void test_suspended_input() {
+    std::cout << "\n=== Suspended Input Tests ===\n";
+
+    Program program = parse("10 INPUT \"Age\"; A, B$\n20 LINE INPUT L$\n"
+                            "30 C$ = INPUT$(2) + \"-\" + INPUT$(2)\n"
+                            "40 PRINT A; B$; L$; C$\n");
+    Runtime runtime;
+    runtime.load(std::move(program));
+    CaptureIO io;
+    Interpreter interp(runtime, &io);
+
+    run_ticks(interp);
+    test("INPUT stops the interpreter", interp.waiting_for_input() &&
+                                        runtime.pc.reason == StopReason::INPUT);
+    test("Prompt is shown while waiting", io.output == "Age? ");
+    test("Waiting variables are reported",
+         interp.state().pending_vars == std::vector<std::string>{"a", "b$"} ||
+         interp.state().pending_vars == std::vector<std::string>{"A", "B$"});
+
+    run_ticks(interp);
+    test("tick() without input stays stopped", interp.waiting_for_input() && io.output == "Age? ");
+
+    interp.provide_input("42, x");
+    run_ticks(interp);
+    test("LINE INPUT waits next", interp.waiting_for_input() && io.output == "Age? ");
+    interp.provide_input("a line");
+
+    // INPUT$ characters come from separate lines; the first INPUT$ keeps
+    // what it took while the statement waits for the second
+    run_ticks(interp);
+    interp.provide_input("p");
+    run_ticks(interp);
+    interp.provide_input("q");
+    run_ticks(interp);
+    test("INPUT$ waits for its characters", interp.waiting_for_input());
+    interp.provide_input("rst");
+    run_ticks(interp);
+    test("Program runs to the end", runtime.pc.reason == StopReason::END);
+    test("Input reaches every variable", io.output == "Age?  42 xa linepq-rs\n");
+    test("Unused input stays queued", interp.state().input_buffer == std::vector<std::string>{"t"});
+
+    // Empty lines (the end of console input) end each INPUT$ once
+    Program empty_lines = parse("10 B$ = INPUT$(2) + INPUT$(2)\n20 PRINT \"<\"; B$; \">\"\n");
+    Runtime empty_runtime;
+    empty_runtime.load(std::move(empty_lines));
+    CaptureIO empty_io;
+    Interpreter empty_interp(empty_runtime, &empty_io);
+    for (int i = 0; i < 4 && empty_runtime.pc.reason != StopReason::END; ++i) {
+        run_ticks(empty_interp);
+        if (empty_interp.waiting_for_input()) empty_interp.provide_input("");
+    }
+    test("Empty lines end INPUT$", empty_io.output == "<>\n");
+
+    // run() reads from the IOHandler instead
+    test("run() asks the console", run("10 INPUT A\n20 PRINT A\n") == "?  0 \n");
+}
+
+// Run source with a line of input for every stop, and return what it printed
+std::string run_with_input(const std::string& source, const std::vector<std::string>& lines) {
+    Runtime runtime;
+    runtime.load(parse(source));
+    CaptureIO io;
+    Interpreter interp(runtime, &io);
+    for (const auto& line : lines) {
+        run_ticks(interp);
+        if (!interp.waiting_for_input()) break;
+        interp.provide_input(line);
+    }
+    run_ticks(interp);
+    if (!interp.state().input_buffer.empty()) io.output += "<unused input>";
+    return io.output;
+}
+
+void test_input_in_if() {
+    std::cout << "\n=== Input Inside IF Tests ===\n";
+
+    // Only the INPUT runs again, not the condition or what came before it
+    test("INPUT after a change to the IF condition",
+         run_with_input("10 IF A = 0 THEN A = 1: PRINT \"hi\": INPUT B\n20 PRINT A; B\n",
+                        {"5"}) == "hi\n?  1  5 \n");
+    test("Inline statements before INPUT run once",
+         run_with_input("10 IF 1 THEN PRINT \"q\": INPUT C\n20 PRINT C\n", {"7"}) ==
+         "q\n?  7 \n");
+    test("INPUT in ELSE and a nested IF",
+         run_with_input("10 IF 0 THEN PRINT \"no\" ELSE IF K = 0 THEN K = K + 1: INPUT D\n"
+                        "20 PRINT K; D\n", {"3"}) == "?  1  3 \n");
+    test("INPUT$ calls inside IF keep their characters",
+         run_with_input("10 IF N = 0 THEN N = N + 1: A$ = INPUT$(1): PRINT \"x\": B$ = INPUT$(2)\n"
+                        "20 PRINT N; A$; B$\n", {"a", "bc"}) == "x\n 1 abc\n");
+    test("INPUT$ in the IF condition isn't asked again",
+         run_with_input("10 IF ASC(INPUT$(1)) THEN M = M + 1: INPUT E: PRINT INPUT$(1)\n"
+                        "20 PRINT M; E\n", {"y", "4", "z"}) == "z\n 1  4 \n");
+
+    // The same through run() and a console on streams
+    std::istringstream in("7\n");
+    std::ostringstream out;
+    {
+        Runtime runtime;
+        runtime.load(parse("10 IF 1 THEN PRINT \"q\": INPUT C\n20 PRINT C\n"));
+        ConsoleIO io(in, out);
+        Interpreter(runtime, &io).run();
+    }
+    test("run() prints inline statements once", out.str() == "q\n?  7 \n");
+
+    // Calls that finished before the statement stopped for console input
+    // aren't made again when it runs again
+    char path_template[] = "/tmp/mbasic_replay_XXXXXX";
+    int file = ::mkstemp(path_template);
+    std::string path = path_template;
+    [[maybe_unused]] ssize_t written = ::write(file, "abcdefghij", 10);
+    ::close(file);
+    test("File INPUT$ before console INPUT$ reads once",
+         run_with_input("10 OPEN \"I\", #1, \"" + path + "\"\n"
+                        "20 A$ = INPUT$(3, 1) + INPUT$(1)\n30 PRINT A$; \"|\"; INPUT$(3, 1)\n",
+                        {"x"}) == "abcx|def\n");
+    ::unlink(path.c_str());
+    test("RND before console INPUT$ draws once",
+         run_with_input("10 X = RND(-1)\n20 A = RND + LEN(INPUT$(1))\n30 X = RND(-1)\n"
+                        "40 B = RND + 1\n50 PRINT A - B\n", {"x"}) == " 0 \n");
+}
+
+void test_stdout_device() {
+    std::cout << "\n=== Console Device Tests ===\n";
+
+    // Standard output redirected to a file, so neither stream is flushed
+    // line by line
+    char path_template[] = "/tmp/mbasic_stdout_XXXXXX";
+    int file = ::mkstemp(path_template);
+    std::string path = path_template;
+    std::cout.flush();
+    int saved = ::dup(STDOUT_FILENO);
+    ::dup2(file, STDOUT_FILENO);
+    {
+        Runtime runtime;
+        runtime.load(parse("10 OPEN \"O\", #1, \"STDOUT:\"\n20 PRINT #1, \"first\"\n"
+                           "30 PRINT \"second\"\n40 PRINT #1, \"third\"\n50 CLOSE #1\n"));
+        ConsoleIO io;
+        Interpreter(runtime, &io).run();
+    }
+    std::cout.flush();
+    ::dup2(saved, STDOUT_FILENO);
+    ::close(saved);
+    ::close(file);
+    test("STDOUT: and PRINT come out in program order",
+         read_file(path) == "first\nsecond\nthird\n");
+    ::unlink(path.c_str());
+
+    // The devices are the interpreter's own console, whatever it is
+    test("STDOUT: goes to the IOHandler and moves POS",
+         run("10 OPEN \"O\", #1, \"stdout:\"\n20 PRINT #1, \"ab\";\n"
+             "30 PRINT POS(0)\n40 CLOSE #1\n") == "ab 3 \n");
+    test("STDIN: of a console without input is at its end",
+         run("10 OPEN \"I\", #1, \"STDIN:\"\n20 PRINT EOF(1)\n") == "-1 \n");
+    test("STDIN: can't be written",
+         run("10 ON ERROR GOTO 100\n20 OPEN \"O\", #1, \"STDIN:\"\n30 END\n"
+             "100 PRINT ERR\n") == " 54 \n");
+
+    std::istringstream in("5,x\nline two\n7\n");
+    std::ostringstream out;
+    {
+        Runtime runtime;
+        runtime.load(parse("10 OPEN \"I\", #1, \"STDIN:\"\n20 INPUT #1, A, B$\n"
+                           "30 LINE INPUT #1, C$\n40 INPUT D\n50 PRINT A; B$; C$; D; EOF(1)\n"));
+        ConsoleIO io(in, out);
+        Interpreter(runtime, &io).run();
+    }
+    test("STDIN: reads the console's stream", out.str() == "?  5 xline two 7 -1 \n");
+}
+
+void test_flush_interval() {
+    std::cout << "\n=== File Flush Interval Tests ===\n";
+
+    char path_template[] = "/tmp/mbasic_flush_XXXXXX";
+    ::close(::mkstemp(path_template));
+    std::string path = path_template;
+    Runtime runtime;
+    runtime.load(parse("10 OPEN \"O\", #1, \"" + path + "\"\n20 PRINT #1, \"x\"\n"
+                       "30 INPUT A\n40 PRINT #1, \"y\"\n50 FOR I = 1 TO 5000: NEXT\n"
+                       "60 CLOSE #1\n"));
+    FileOptions options;
+    options.flush_interval_ms = 20;
+    runtime.filesystem = FileSystem::create_native(options);
+    CaptureIO io;
+    Interpreter interp(runtime, &io);
+
+    run_ticks(interp);
+    test("Output is written before waiting for input", read_file(path) == "x\n");
+    interp.provide_input("1");
+    interp.tick();
+    interp.tick();
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    for (int i = 0; i < 1100 && interp.tick(); ++i) {
+    }
+    test("Output is written while the file is left alone",
+         runtime.pc.is_running() && read_file(path) == "x\ny\n");
+    run_ticks(interp);
+    ::unlink(path.c_str());
+}
+
+void test_shared_program() {
+    std::cout << "\n=== Shared Program Tests ===\n";
+
+    char dir_template[] = "/tmp/mbasic_merge_XXXXXX";
+    std::string dir = ::mkdtemp(dir_template);
+    std::string path = dir + "/extra.bas";
+    std::ofstream(path) << "30 PRINT FNB(2); \"merged\"\n40 DATA 7\n50 DEF FNB(X) = X * 3\n";
+
+    auto program = CompiledProgram::compile(parse(
+        "10 MERGE \"" + path + "\"\n20 READ A: PRINT A\n30 PRINT \"original\"\n40 DATA 5\n"));
+
+    // Two runs of one program; the first merges, the second must not see it
+    Runtime first;
+    first.load(program);
+    CaptureIO first_io;
+    Interpreter(first, &first_io).run();
+    test("MERGE replaces and adds lines", first_io.output == " 7 \n 6 merged\n");
+    test("MERGE copies the program", first.program != program);
+
+    Runtime second;
+    second.load(program);
+    second.pc = program->find_line(20);
+    CaptureIO second_io;
+    Interpreter(second, &second_io).run();
+    test("Shared program is unchanged by MERGE", second_io.output == " 5 \noriginal\n");
+    test("Missing lines give no statement", !program->get(PC::running_at(50, 0)) &&
+                                            program->line_text(99).empty());
+
+    ::unlink(path.c_str());
+    ::rmdir(dir.c_str());
+}
+
+void test_print_allocations() {
+    std::cout << "\n=== PRINT Allocation Tests ===\n";
+
+    // The difference between two loop counts is what the extra iterations
+    // cost, leaving out setup; buffers that grow once show up as a fraction
+    auto per_iteration = [](const std::string& body) {
+        std::string few = "10 FOR I=1 TO 100: " + body + ": NEXT\n";
+        std::string many = "10 FOR I=1 TO 1100: " + body + ": NEXT\n";
+        size_t a = allocations(few);
+        size_t b = allocations(many);
+        return b > a ? static_cast<double>(b - a) / 1000.0 : 0.0;
+    };
+
+    double baseline = per_iteration("X=I*2.5");
+    double print = per_iteration("PRINT I;I*2.5,\"ab\";-I");
+    double write = per_iteration("WRITE I,\"ab\",I/3");
+    std::cout << "  allocations per iteration: loop " << baseline
+              << ", PRINT " << print << ", WRITE " << write << "\n";
+    test("PRINT allocates nothing per item", print < baseline + 0.5);
+    test("WRITE allocates nothing per item", write < baseline + 0.5);
+}
+
+int main() {
+    std::cout << "MBASIC Interpreter Tests\n";
+    std::cout << "========================\n";
+
+    test_advance_column();
+    test_print_format();
+    test_printer();
+    test_suspended_input();
+    test_input_in_if();
+    test_stdout_device();
+    test_flush_interval();
+    test_shared_program();
+    test_print_allocations();
+
+    std::cout << "\n=====================\n";
+    std::cout << "Tests passed: " << tests_passed << "\n";
+    std::cout << "Tests failed: " << tests_failed << "\n";
+
+    return tests_failed > 0 ? 1 : 0;
+}
@@ -76,6 +76,13 @@ void test_keywords() {
          tokens[1].type == TokenType::GOSUB &&
          tokens[2].type == TokenType::RETURN);
 
+    tokens = tokenize("LOCK#1 UNLOCK SHARED");
+    test("Record locking keywords", tokens.size() == 6 &&
+         tokens[0].type == TokenType::LOCK &&
+         tokens[1].type == TokenType::HASH &&
+         tokens[3].type == TokenType::UNLOCK &&
+         tokens[4].type == TokenType::SHARED);
+
     // Case insensitivity
     tokens = tokenize("Print PRINT print PrInT");
     test("Case insensitive keywords", tokens.size() == 5 &&
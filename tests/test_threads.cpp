@@ -0,0 +1,218 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include "mbasic/parser.hpp"
+#include "mbasic/runtime.hpp"
+#include "mbasic/interpreter.hpp"
+#include "mbasic/io_handler.hpp"
+#include "mbasic/memory_fs.hpp"
+
+// Many interpreters at once, each on its own thread with its own IOHandler.
+// Build with -DMBASIC_TSAN=ON (CMake) or TSAN=1 (make) to have
+// ThreadSanitizer check for data races as well.
+
+using namespace mbasic;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        tests_passed++;
+        std::cout << "  PASS: " << name << "\n";
+    } else {
+        tests_failed++;
+        std::cout << "  FAIL: " << name << "\n";
+    }
+}
+
+constexpr int THREADS = 8;
+constexpr int RUNS_PER_THREAD = 25;
+
+// Console that keeps everything printed
+class CaptureIO : public IOHandler {
+public:
+    std::string output;
+
+    void print(const std::string& text) override {
+        output += text;
+        column_ = advance_column(column_, text);
+    }
+    std::string input(const std::string&) override { return {}; }
+    std::optional<char> inkey() override { return std::nullopt; }
+    int get_column() const override { return column_; }
+    void set_column(int col) override { column_ = col; }
+    int get_width() const override { return 80; }
+    void set_width(int) override {}
+
+private:
+    int column_ = 0;
+};
+
+// RND, INPUT, files, DATE$/TIME$, PRINT USING and DEF FN in one program
+const char* WORKLOAD =
+    "10 RANDOMIZE 42\n"
+    "20 A = RND: B = RND\n"
+    "30 INPUT \"N\"; N\n"
+    "40 OPEN \"O\", #1, F$\n"
+    "50 FOR I = 1 TO N: PRINT #1, I * I: NEXT\n"
+    "60 CLOSE #1\n"
+    "70 OPEN \"I\", #1, F$\n"
+    "80 WHILE NOT EOF(1): INPUT #1, X: S = S + X: WEND\n"
+    "90 CLOSE #1: KILL F$\n"
+    "100 D$ = DATE$: T$ = TIME$\n"
+    "110 PRINT USING \"#.#####\"; A; B\n"
+    "120 PRINT S; LEN(D$); LEN(T$); FNQ(N)\n"
+    "130 DEF FNQ(X) = X * 2\n";
+
+// Run the workload to the end, answering its INPUT with n
+std::string run_workload(const std::shared_ptr<const CompiledProgram>& program,
+                         const std::shared_ptr<FileSystem>& filesystem,
+                         const std::string& filename, int n) {
+    Runtime runtime;
+    runtime.filesystem = filesystem;
+    runtime.load(program);
+    runtime.set_variable("f$", filename);
+    CaptureIO io;
+    Interpreter interp(runtime, &io);
+    for (;;) {
+        while (interp.tick()) {
+        }
+        if (!interp.waiting_for_input()) break;
+        interp.provide_input(std::to_string(n));
+    }
+    interp.finish();
+    if (interp.state().error) {
+        return "error: " + interp.state().error->message;
+    }
+    return io.output;
+}
+
+void test_parallel_interpreters() {
+    std::cout << "\n=== Parallel Interpreters ===\n";
+
+    auto program = CompiledProgram::compile(parse(WORKLOAD));
+    auto filesystem = std::make_shared<MemoryFileSystem>();
+
+    // What each thread should see, worked out on this thread first
+    std::vector<std::string> expected;
+    for (int t = 0; t < THREADS; ++t) {
+        expected.push_back(run_workload(program, filesystem, "ref.txt", 10 + t));
+    }
+    test("Workload runs", expected[0].find("error") == std::string::npos &&
+                          expected[0].find(" 385  10  8  20 ") != std::string::npos);
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            std::string filename = "thread" + std::to_string(t) + ".txt";
+            for (int i = 0; i < RUNS_PER_THREAD; ++i) {
+                if (run_workload(program, filesystem, filename, 10 + t) != expected[t]) {
+                    mismatches.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    test("Every run matches the single-threaded result", mismatches.load() == 0);
+    test("Files are cleaned up", filesystem->list().empty());
+}
+
+void test_shared_file() {
+    std::cout << "\n=== Shared Memory File ===\n";
+
+    // Writers append to one file while readers go through it
+    auto writer = CompiledProgram::compile(parse(
+        "10 OPEN \"A\", #1, \"shared.txt\"\n"
+        "20 FOR I = 1 TO 200: PRINT #1, \"line\"; I: NEXT\n30 CLOSE #1\n"));
+    auto reader = CompiledProgram::compile(parse(
+        "10 OPEN \"I\", #1, \"shared.txt\"\n"
+        "20 WHILE NOT EOF(1): LINE INPUT #1, L$: N = N + 1: WEND\n30 CLOSE #1\n"));
+    auto filesystem = std::make_shared<MemoryFileSystem>();
+    filesystem->put("shared.txt", "");
+
+    std::atomic<int> errors{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            Runtime runtime;
+            runtime.filesystem = filesystem;
+            runtime.load(t % 2 ? reader : writer);
+            CaptureIO io;
+            Interpreter interp(runtime, &io);
+            interp.run();
+            if (interp.state().error) {
+                errors.fetch_add(1);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    test("Sessions share a file without errors", errors.load() == 0);
+
+    std::istringstream lines(filesystem->get("shared.txt").value_or(""));
+    std::string line;
+    int count = 0;
+    bool whole = true;
+    while (std::getline(lines, line)) {
+        count++;
+        whole = whole && line.rfind("line ", 0) == 0 && line.back() == ' ';
+    }
+    test("Every line written is there whole", count == (THREADS / 2) * 200 && whole);
+}
+
+void test_console_streams() {
+    std::cout << "\n=== Console Streams ===\n";
+
+    // ConsoleIO on its own streams, one per thread
+    auto program = CompiledProgram::compile(parse(
+        "10 INPUT X\n20 A$ = INPUT$(3)\n30 PRINT X * 3; A$\n"));
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < RUNS_PER_THREAD; ++i) {
+                std::istringstream in(std::to_string(t) + "\nabc");
+                std::ostringstream out;
+                {
+                    ConsoleIO io(in, out);
+                    Runtime runtime;
+                    runtime.load(program);
+                    Interpreter interp(runtime, &io);
+                    interp.run();
+                }
+                std::string want = "? " + std::string(t == 0 ? " 0" : " " + std::to_string(t * 3)) +
+                                   " abc\n";
+                if (out.str() != want) {
+                    mismatches.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    test("Each console reads and writes its own streams", mismatches.load() == 0);
+}
+
+int main() {
+    std::cout << "MBASIC Thread Tests\n";
+    std::cout << "===================\n";
+
+    test_parallel_interpreters();
+    test_shared_file();
+    test_console_streams();
+
+    std::cout << "\n=====================\n";
+    std::cout << "Tests passed: " << tests_passed << "\n";
+    std::cout << "Tests failed: " << tests_failed << "\n";
+
+    return tests_failed > 0 ? 1 : 0;
+}
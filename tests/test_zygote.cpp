@@ -0,0 +1,235 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "mbasic/zygote.hpp"
+#include "mbasic/parser.hpp"
+#include "mbasic/runtime.hpp"
+#include "mbasic/interpreter.hpp"
+
+using namespace mbasic;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        tests_passed++;
+        std::cout << "  PASS: " << name << "\n";
+    } else {
+        tests_failed++;
+        std::cout << "  FAIL: " << name << "\n";
+    }
+}
+
+// ============================================================================
+// The test zygote's jobs, named by their first argument
+// ============================================================================
+
+// Kept by the zygote between jobs
+int g_jobs_prepared = 0;
+std::map<std::string, std::shared_ptr<const CompiledProgram>> g_programs;
+std::map<std::string, int> g_compiles;
+std::shared_ptr<const CompiledProgram> g_program;
+
+// Set by a job in its own copy of the zygote
+bool g_touched = false;
+
+void prepare(const ZygoteJob& job) {
+    g_jobs_prepared++;
+    g_program.reset();
+    if (job.args.size() > 2 && job.args[1] == "basic") {
+        auto& program = g_programs[job.args[2]];
+        if (!program) {
+            program = CompiledProgram::compile(parse(job.args[2]));
+            g_compiles[job.args[2]]++;
+        }
+        g_program = program;
+    }
+}
+
+int run(const ZygoteJob& job) {
+    const std::string& name = job.args.size() > 1 ? job.args[1] : "";
+    if (name == "echo") {
+        std::string line;
+        std::getline(std::cin, line);
+        for (size_t i = 2; i < job.args.size(); ++i) {
+            std::cout << job.args[i] << " ";
+        }
+        std::cout << line << "\n";
+        return 0;
+    }
+    if (name == "status") {
+        return std::atoi(job.args[2].c_str());
+    }
+    if (name == "abort") {
+        std::abort();
+    }
+    if (name == "cwd") {
+        char path[4096];
+        std::cout << (::getcwd(path, sizeof(path)) ? path : "") << "\n";
+        return 0;
+    }
+    if (name == "prepared") {
+        std::cout << g_jobs_prepared << "\n";
+        return 0;
+    }
+    if (name == "touch") {
+        std::cout << g_touched << "\n";
+        g_touched = true;
+        return 0;
+    }
+    if (name == "compiles") {
+        std::cout << g_compiles[job.args[2]] << "\n";
+        return 0;
+    }
+    if (name == "basic") {
+        // Console on the passed standard input and output
+        Runtime runtime;
+        runtime.load(g_program);
+        Interpreter interp(runtime);
+        interp.run();
+        return interp.state().error ? 1 : 0;
+    }
+    return 2;
+}
+
+// Run a job with input as its standard input; returns the exit status and
+// sets output to what it wrote
+int run_job(const std::string& socket, const std::vector<std::string>& args,
+            std::string& output, const std::string& input = "") {
+    int in[2], out[2];
+    if (::pipe(in) != 0 || ::pipe(out) != 0) return -1;
+    [[maybe_unused]] ssize_t written = ::write(in[1], input.data(), input.size());
+    ::close(in[1]);
+    int status = run_zygote_job(socket, args, in[0], out[1], 2);
+    ::close(in[0]);
+    ::close(out[1]);
+    output.clear();
+    char buffer[4096];
+    ssize_t n;
+    while ((n = ::read(out[0], buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, static_cast<size_t>(n));
+    }
+    ::close(out[0]);
+    return status;
+}
+
+int run_job(const std::string& socket, const std::vector<std::string>& args) {
+    std::string output;
+    return run_job(socket, args, output);
+}
+
+// ============================================================================
+// Tests
+// ============================================================================
+
+void test_zygote(const std::string& socket, pid_t zygote) {
+    std::cout << "\n=== Jobs ===\n";
+
+    // Wait for the zygote to listen
+    bool up = false;
+    for (int i = 0; i < 500 && !up; ++i) {
+        up = run_job(socket, {"t", "status", "0"}) == 0;
+        if (!up) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    test("Zygote takes jobs", up);
+
+    std::string output;
+    test("Job gets its arguments and input",
+         run_job(socket, {"t", "echo", "a", "b c"}, output, "line\n") == 0 &&
+         output == "a b c line\n");
+    test("Job's exit status comes back", run_job(socket, {"t", "status", "7"}) == 7);
+    test("Job killed by a signal reports 128 + signal",
+         run_job(socket, {"t", "abort"}) == 128 + SIGABRT);
+
+    char dir_template[] = "/tmp/mbasic_zygote_XXXXXX";
+    std::string dir = ::mkdtemp(dir_template);
+    char old_dir[4096];
+    bool moved = ::getcwd(old_dir, sizeof(old_dir)) && ::chdir(dir.c_str()) == 0;
+    run_job(socket, {"t", "cwd"}, output);
+    bool returned = moved && ::chdir(old_dir) == 0;
+    ::rmdir(dir.c_str());
+    test("Job runs in the client's directory", returned && output == dir + "\n");
+
+    std::string first, second;
+    run_job(socket, {"t", "prepared"}, first);
+    run_job(socket, {"t", "prepared"}, second);
+    test("Zygote prepares every job before forking",
+         std::atoi(second.c_str()) == std::atoi(first.c_str()) + 1);
+    run_job(socket, {"t", "touch"}, first);
+    run_job(socket, {"t", "touch"}, second);
+    test("Jobs don't see each other's changes", first == "0\n" && second == "0\n");
+
+    std::cout << "\n=== Programs ===\n";
+
+    const std::string source = "10 INPUT A\n20 PRINT A * 2\n";
+    bool doubled = true;
+    for (int i = 1; i <= 3; ++i) {
+        run_job(socket, {"t", "basic", source}, output, std::to_string(i) + "\n");
+        doubled = doubled && output == "?  " + std::to_string(i * 2) + " \n";
+    }
+    test("Forked interpreters use the passed console", doubled);
+    run_job(socket, {"t", "compiles", source}, output);
+    test("Program is parsed once for every job", output == "1\n");
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> clients;
+    for (int t = 0; t < 8; ++t) {
+        clients.emplace_back([&, t] {
+            std::string result;
+            std::string word = "w" + std::to_string(t);
+            if (run_job(socket, {"t", "echo", word}, result, "x\n") != 0 || result != word + " x\n") {
+                mismatches.fetch_add(1);
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    test("Clients at once each get their own job", mismatches.load() == 0);
+
+    ZygoteOptions second_zygote;
+    second_zygote.socket_path = socket;
+    test("A second zygote won't take a live socket", run_zygote(second_zygote) == 1);
+
+    std::cout << "\n=== Shutdown ===\n";
+
+    ::kill(zygote, SIGTERM);
+    int wait_status = 0;
+    ::waitpid(zygote, &wait_status, 0);
+    test("Zygote stops on SIGTERM", WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0);
+    test("Socket is removed", ::access(socket.c_str(), F_OK) != 0);
+    test("Client reports an absent zygote", run_job(socket, {"t", "status", "0"}) == -1);
+}
+
+int main() {
+    std::cout << "MBASIC Zygote Tests\n";
+    std::cout << "===================\n";
+
+    std::string socket = "/tmp/mbasic_zygote_" + std::to_string(::getpid()) + ".sock";
+    std::cout.flush();
+    pid_t zygote = ::fork();
+    if (zygote == 0) {
+        ZygoteOptions options;
+        options.socket_path = socket;
+        options.before_fork = prepare;
+        options.run = run;
+        std::exit(run_zygote(options));
+    }
+
+    test_zygote(socket, zygote);
+
+    std::cout << "\n=====================\n";
+    std::cout << "Tests passed: " << tests_passed << "\n";
+    std::cout << "Tests failed: " << tests_failed << "\n";
+
+    return tests_failed > 0 ? 1 : 0;
+}